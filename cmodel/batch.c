@@ -0,0 +1,429 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Batch runner: executes the jobs of a manifest on a pool of worker
+  threads and writes one summary line per job.
+
+  Manifest, one job per line ('#' starts a comment):
+
+    binary  load-offset  entry-pc  cycle-limit  bdos
+
+  Numbers may be decimal or 0x hex, a cycle limit of 0 means no limit and
+  bdos=1 services the CP/M console calls at 0x0005 like main.c does.
+
+  Every worker owns one i8080_state and 64kiB of memory for its whole
+  life; between jobs i8080_reset() only clears the pages the previous job
+  wrote. Jobs are split into one contiguous range per worker and a worker
+  that runs dry steals half of the remaining range of another one.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "i8080.h"
+
+#define MAX_LINE 1024
+
+struct image
+{
+    char* filename;
+    uint8_t* data;
+    long sizeb;
+};
+
+struct job
+{
+    int image; /* index into images[] */
+    uint16_t offset;
+    uint16_t entry;
+    uint64_t cycle_limit;
+    int bdos;
+
+    /* results */
+    const char* result;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint8_t a, f, b, c, d, e, h, l;
+    uint16_t sp;
+    uint16_t pc;
+    uint64_t out_bytes;
+    uint32_t out_hash; /* FNV-1a of the console output */
+};
+
+struct worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int next; /* first job of the range still owned */
+    int end;  /* one past the last */
+    int id;
+};
+
+static struct image* images;
+static int num_images;
+static struct job* jobs;
+static int num_jobs;
+static struct worker* workers;
+static int num_workers;
+static int engine = I8080_ENGINE_THREADED;
+
+/* job run by the calling worker, for the BDOS handler */
+static __thread struct job* current_job;
+
+/*----------------------------------------------------------------------------*/
+/* Manifest                                                                   */
+/*----------------------------------------------------------------------------*/
+static int load_image (const char* filename)
+{
+    struct image* image;
+    FILE* f;
+    int i;
+
+    for (i = 0; i < num_images; i++) {
+        if (!strcmp (images[i].filename, filename))
+            return i;
+    }
+
+    if (NULL == (f = fopen (filename, "rb"))) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+        exit (-1);
+    }
+
+    images = realloc (images, (num_images + 1) * sizeof(struct image));
+    image = &images[num_images];
+    image->filename = strdup (filename);
+
+    fseek (f, 0, SEEK_END);
+    image->sizeb = ftell (f);
+    fseek (f, 0, SEEK_SET);
+    image->sizeb = (image->sizeb > 0x10000) ? 0x10000 : image->sizeb;
+    image->data = malloc (image->sizeb);
+    if (fread (image->data, 1, image->sizeb, f) != (size_t)image->sizeb) {
+        fprintf (stderr, "Error: unable to read %s\n", filename);
+        exit (-1);
+    }
+    fclose (f);
+
+    return num_images++;
+}
+
+static void read_manifest (const char* filename)
+{
+    char line[MAX_LINE];
+    int line_nr = 0;
+    FILE* f;
+
+    if (NULL == (f = fopen (filename, "r"))) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+        exit (-1);
+    }
+
+    while (fgets (line, sizeof(line), f)) {
+        char binary[MAX_LINE];
+        char offset[64], entry[64], limit[64], bdos[64];
+        char* comment;
+        struct job* job;
+        int n;
+
+        line_nr++;
+        if (NULL != (comment = strchr (line, '#')))
+            *comment = '\0';
+
+        n = sscanf (line, "%1023s %63s %63s %63s %63s", binary, offset, entry, limit, bdos);
+        if (n <= 0)
+            continue;
+        if (n != 5) {
+            fprintf (stderr, "Error: %s:%d: expected 'binary offset entry cycle-limit bdos'\n", filename, line_nr);
+            exit (-1);
+        }
+
+        jobs = realloc (jobs, (num_jobs + 1) * sizeof(struct job));
+        job = &jobs[num_jobs++];
+        memset (job, 0, sizeof(struct job));
+        job->image = load_image (binary);
+        job->offset = strtoul (offset, NULL, 0);
+        job->entry = strtoul (entry, NULL, 0);
+        job->cycle_limit = strtoull (limit, NULL, 0);
+        job->bdos = strtol (bdos, NULL, 0);
+    }
+    fclose (f);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Job execution                                                              */
+/*----------------------------------------------------------------------------*/
+static void console_write (const char* text, const size_t len)
+{
+    struct job* job = current_job;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        job->out_hash ^= (uint8_t)text[i];
+        job->out_hash *= 16777619u;
+    }
+    job->out_bytes += len;
+}
+
+static int bdos_handler (struct i8080_state* state)
+{
+    if (state->pc == 0x5) { /* BDOS entry point */
+        switch (state->c) {
+            case 0x2: { /* BDOS: C_WRITE */
+                char ch = state->e;
+                console_write (&ch, 1);
+                break;
+            }
+            case 0x9: { /* BDOS: C_WRITESTR */
+                uint16_t de = (((uint8_t)state->d << 8 ) | ((uint8_t)state->e << 0));
+                int len = 0;
+                while (state->mem[de] != '$' && len < 0x10000) {
+                    console_write ((const char*)&state->mem[de], 1);
+                    de++;
+                    len++;
+                }
+                console_write ("\n", 1);
+                break;
+            }
+            default: {
+                current_job->result = "bdos-error";
+                i8080_stop (state);
+                return 0;
+            }
+        }
+
+        state->pc++;
+        return 0;
+    }
+
+    return -1;
+}
+
+static void run_job (struct i8080_state* state, struct job* job)
+{
+    const struct image* image = &images[job->image];
+    long sizeb = image->sizeb;
+    int rc;
+
+    i8080_reset (state);
+    if (job->offset + sizeb > 0x10000)
+        sizeb = 0x10000 - job->offset;
+    i8080_invalidate (state, job->offset, sizeb);
+    memcpy (&state->mem[job->offset], image->data, sizeb);
+
+    i8080_set_pc (state, job->entry);
+    i8080_set_instr_handler (state, job->bdos ? bdos_handler : NULL);
+
+    current_job = job;
+    job->out_hash = 2166136261u;
+
+    rc = i8080_run (state, job->cycle_limit ? job->cycle_limit : UINT64_MAX);
+
+    if (job->result == NULL) {
+        switch (rc) {
+            case I8080_RUN_HALT:   job->result = "halt";   break;
+            case I8080_RUN_BUDGET: job->result = "budget"; break;
+            case I8080_RUN_STOP:   job->result = "stop";   break;
+            default:               job->result = "error";  break;
+        }
+    }
+
+    job->cycles = state->cycles;
+    job->instructions = state->instructions;
+    job->a = state->a;
+    job->f = state->f;
+    job->b = state->b;
+    job->c = state->c;
+    job->d = state->d;
+    job->e = state->e;
+    job->h = state->h;
+    job->l = state->l;
+    job->sp = state->sp;
+    job->pc = state->pc;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Work stealing pool                                                         */
+/*----------------------------------------------------------------------------*/
+static int take_job (struct worker* self)
+{
+    int job = -1;
+
+    pthread_mutex_lock (&self->lock);
+    if (self->next < self->end)
+        job = self->next++;
+    pthread_mutex_unlock (&self->lock);
+
+    return job;
+}
+
+/* move the upper half of another worker's range over to self */
+static int steal_jobs (struct worker* self)
+{
+    int i;
+
+    for (i = 1; i < num_workers; i++) {
+        struct worker* victim = &workers[(self->id + i) % num_workers];
+        int lo = 0;
+        int hi = 0;
+
+        pthread_mutex_lock (&victim->lock);
+        if (victim->next < victim->end) {
+            hi = victim->end;
+            lo = victim->end - ((victim->end - victim->next + 1) / 2);
+            victim->end = lo;
+        }
+        pthread_mutex_unlock (&victim->lock);
+
+        if (lo < hi) {
+            pthread_mutex_lock (&self->lock);
+            self->next = lo;
+            self->end = hi;
+            pthread_mutex_unlock (&self->lock);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void* worker_main (void* arg)
+{
+    struct worker* self = arg;
+    struct i8080_state* state;
+    uint8_t* ram;
+    int job;
+
+    ram = (uint8_t*)malloc (0x10000 /* 64kiB */);
+    if (ram == NULL || NULL == (state = i8080_create_engine (ram, 0x10000 /* 64kiB */, engine))) {
+        fprintf (stderr, "Error: unable to create worker %d\n", self->id);
+        exit (-1);
+    }
+    state->log = stderr;
+
+    for (;;) {
+        while ((job = take_job (self)) >= 0)
+            run_job (state, &jobs[job]);
+        if (!steal_jobs (self))
+            break;
+    }
+
+    i8080_destroy (state);
+    free (ram);
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Main                                                                       */
+/*----------------------------------------------------------------------------*/
+static void write_summary (FILE* f)
+{
+    int i;
+
+    fprintf (f, "# job result cycles instructions pc sp a psw b c d e h l out_bytes out_fnv binary\n");
+    for (i = 0; i < num_jobs; i++) {
+        const struct job* job = &jobs[i];
+
+        fprintf (f, "%d %s %llu %llu %04x %04x %02x %02x %02x %02x %02x %02x %02x %02x %llu %08x %s\n",
+                 i, job->result, (unsigned long long)job->cycles, (unsigned long long)job->instructions,
+                 job->pc, job->sp, job->a, job->f, job->b, job->c, job->d, job->e, job->h, job->l,
+                 (unsigned long long)job->out_bytes, job->out_hash, images[job->image].filename);
+    }
+}
+
+static void usage (const char* prog)
+{
+    fprintf (stderr, "usage: %s [-e switch|threaded|bbcache] [-j threads] [-o summary.txt] manifest\n", prog);
+    exit (-1);
+}
+
+int main (int argc, char** argv)
+{
+    int opt;
+    int i;
+    const char* summary_file = NULL;
+    FILE* summary = stdout;
+
+    num_workers = sysconf (_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt (argc, argv, "e:j:o:")) != -1) {
+        switch (opt) {
+            case 'e': {
+                if (!strcmp (optarg, "switch"))
+                    engine = I8080_ENGINE_SWITCH;
+                else if (!strcmp (optarg, "threaded"))
+                    engine = I8080_ENGINE_THREADED;
+                else if (!strcmp (optarg, "bbcache"))
+                    engine = I8080_ENGINE_BBCACHE;
+                else
+                    usage (argv[0]);
+                break;
+            }
+            case 'j': num_workers = atoi (optarg); break;
+            case 'o': summary_file = optarg; break;
+            default: usage (argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage (argv[0]);
+
+    read_manifest (argv[optind]);
+
+    /* before any job runs, a bad path must not cost the whole batch */
+    if (summary_file && NULL == (summary = fopen (summary_file, "w"))) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", summary_file, strerror(errno));
+        exit (-1);
+    }
+
+    if (num_workers < 1)
+        num_workers = 1;
+    if (num_workers > num_jobs)
+        num_workers = (num_jobs > 0) ? num_jobs : 1;
+
+    workers = calloc (num_workers, sizeof(struct worker));
+    for (i = 0; i < num_workers; i++) {
+        workers[i].id = i;
+        workers[i].next = (int)(((int64_t)num_jobs * i) / num_workers);
+        workers[i].end = (int)(((int64_t)num_jobs * (i + 1)) / num_workers);
+        pthread_mutex_init (&workers[i].lock, NULL);
+    }
+    for (i = 0; i < num_workers; i++) {
+        if (pthread_create (&workers[i].thread, NULL, worker_main, &workers[i])) {
+            fprintf (stderr, "Error: unable to start worker %d\n", i);
+            exit (-1);
+        }
+    }
+    for (i = 0; i < num_workers; i++)
+        pthread_join (workers[i].thread, NULL);
+
+    write_summary (summary);
+    if (summary != stdout)
+        fclose (summary);
+
+    return 0;
+}
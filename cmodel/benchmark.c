@@ -0,0 +1,770 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Emulator speed benchmark.
+
+  Runs fixed workloads headless (no trace, profile or instr_func) on each
+  engine and reports instructions per second, emulated MHz and ns per
+  instruction as JSON, one result per line:
+
+    cpudiag   tb/cpudiag_mod.hex, run to HLT CPUDIAG_RUNS times
+    invaders  the Space Invaders ROM for N frames (attract mode, no input)
+    loop      16-bit DCX/ORA/JNZ count down
+    memcpy    4kiB MOV A,M/STAX D copy loop
+    call      CALL/PUSH/POP/RET loop
+
+  Every workload starts from a snapshot of its initial state, so each
+  repetition executes exactly the same instructions. Only i8080_run() is
+  timed. After the warmup repetitions the median, minimum and maximum
+  time of the repetitions are reported; spread is (max - min) / median.
+
+  With -m the opcode family microbenchmarks run instead: a generated guest
+  loop repeats MICRO_BODY instructions of one family (MOV r,r, MOV r,M,
+  ALU register and immediate, INR/DCR, DAD, PUSH/POP, CALL/RET, taken and
+  not taken conditional jumps, IN/OUT) inside a DCR B/JNZ, DCR C/JNZ
+  loop. The same loop with an empty body is measured as "empty" and
+  subtracted, which leaves the cycles and ns per instruction of the family
+  (body_cycles_per_instr, body_ns_per_instr) for each engine. The "exec"
+  engine steps the switch engine through i8080_exec() one instruction at a
+  time; it only runs workloads that end in HLT and is the default for -m
+  only.
+
+  With -b the results are compared with a baseline file written by an
+  earlier run: the exit status is 1 if a workload got slower than the
+  threshold (-t, percent), 2 if no result has a baseline entry to compare
+  with. "make bench" builds the cpudiag binary from the
+  hex file and writes bench.json, BENCH_FLAGS="-b baseline.json" compares.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i8080.h"
+
+#define CPUDIAG_RUNS     1000
+#define PROGRAM_RUNS     10
+#define REPS_MAX         101
+#define BASELINE_MAX     64
+
+#define ENGINES          4
+#define ENGINE_EXEC      3 /* the switch engine stepped with i8080_exec() */
+
+/* microbenchmarks: body instructions per loop iteration, outer loop count
+   (C), the body runs 256 * MICRO_OUTER times per program run */
+#define MICRO_BODY       64
+#define MICRO_OUTER      16
+#define MICRO_LOOP       0x0010
+#define MICRO_SUB        0x0f00
+#define MICRO_DATA       0x8000
+
+/* Space Invaders: 2MHz, 60 frames a second, RST 1 at mid screen and RST 2
+   at the start of the vertical blank */
+#define INVADERS_CLOCK_HZ  2000000
+#define INVADERS_FRAME     (INVADERS_CLOCK_HZ / 60)
+
+struct bench
+{
+    struct i8080_state* state;
+    uint8_t* mem;
+    struct i8080_snapshot* start;
+    int frames;
+    const char* cpudiag;
+    const char* rom;
+    int step; /* i8080_exec() instead of i8080_run() */
+    const struct micro* micro; /* the microbenchmark being set up */
+
+    uint64_t start_instructions;
+    uint64_t start_cycles;
+
+    /* executed by the current repetition */
+    uint64_t instructions;
+    uint64_t cycles;
+
+    /* invaders shift register, OUT 2 = amount, OUT 4 = data, IN 3 = result */
+    uint16_t shift;
+    uint8_t shift_amount;
+
+    /* microbenchmark OUT sink */
+    uint8_t latch;
+};
+
+struct workload
+{
+    const char* name;
+    int (*setup)(struct bench* b);
+    uint64_t (*run)(struct bench* b); /* one repetition, ns */
+    int halts; /* runs to HLT, so it can be stepped with i8080_exec() */
+};
+
+/* one opcode family: pattern is repeated up to MICRO_BODY instructions */
+struct micro
+{
+    const char* name;
+    uint8_t pattern[16];
+    uint8_t sizeb;
+    uint8_t instructions;
+    uint8_t next; /* a single jump to the following instruction */
+};
+
+struct result
+{
+    const char* workload;
+    const char* engine;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t median_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+
+    /* microbenchmarks: what is left after the empty loop is subtracted */
+    uint64_t body_instructions;
+    uint64_t body_cycles;
+    uint64_t body_ns;
+};
+
+struct baseline
+{
+    char workload[32];
+    char engine[16];
+    double mips;
+};
+
+static const char* const engine_names[ENGINES] = { "switch", "threaded", "bbcache", "exec" };
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+static int load_file (const char* filename, uint8_t* dst, const long max)
+{
+    FILE* fp;
+    long n;
+
+    if (NULL == (fp = fopen (filename, "rb"))) {
+        fprintf (stderr, "Error: unable to open %s\n", filename);
+        return -1;
+    }
+    n = fread (dst, 1, max, fp);
+    fclose (fp);
+    return (n > 0) ? 0 : -1;
+}
+
+static void count (struct bench* b)
+{
+    b->instructions += (b->state->instructions - b->start_instructions);
+    b->cycles += (b->state->cycles - b->start_cycles);
+}
+
+/* run from the snapshot to HLT, returns the ns spent in i8080_run() */
+static uint64_t run_to_halt (struct bench* b)
+{
+    uint64_t t;
+    int rc;
+
+    i8080_restore (b->state, b->start);
+    t = now_ns ();
+    if (b->step) {
+        while ((rc = i8080_exec (b->state)) == 0)
+            ;
+        rc = (rc == 1) ? I8080_RUN_HALT : I8080_RUN_ERROR;
+    } else {
+        while ((rc = i8080_run (b->state, UINT64_MAX)) == I8080_RUN_BUDGET)
+            ;
+    }
+    t = now_ns () - t;
+    if (rc != I8080_RUN_HALT)
+        fprintf (stderr, "Error: benchmark program did not halt\n");
+    count (b);
+    return t;
+}
+
+/*----------------------------------------------------------------------------*/
+/* cpudiag                                                                    */
+/*----------------------------------------------------------------------------*/
+static int setup_cpudiag (struct bench* b)
+{
+    /* the BDOS entry at 0005 is a NOP/RET pair, so no console handler */
+    return load_file (b->cpudiag, b->mem, 0x10000);
+}
+
+static uint64_t run_cpudiag (struct bench* b)
+{
+    uint64_t t = 0;
+    int i;
+
+    for (i = 0; i < CPUDIAG_RUNS; i++)
+        t += run_to_halt (b);
+    return t;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Space Invaders                                                             */
+/*----------------------------------------------------------------------------*/
+static uint8_t invaders_in (void* ctx, const uint8_t port)
+{
+    struct bench* b = ctx;
+
+    if (port == 3)
+        return (b->shift >> (8 - b->shift_amount)) & 0xff;
+    return 0;
+}
+
+static void invaders_out (void* ctx, const uint8_t port, const uint8_t byte)
+{
+    struct bench* b = ctx;
+
+    if (port == 2)
+        b->shift_amount = (byte & 7);
+    else if (port == 4)
+        b->shift = ((uint16_t)byte << 8) | (b->shift >> 8);
+}
+
+static void invaders_irq (struct i8080_state* state, void* ctx, const uint64_t when)
+{
+    const int vblank = ((when / (INVADERS_FRAME / 2)) & 1) == 0;
+
+    (void)ctx;
+    i8080_interrupt (state, vblank ? 2 : 1);
+    i8080_schedule (state, when + (INVADERS_FRAME / 2), invaders_irq, NULL);
+}
+
+static int setup_invaders (struct bench* b)
+{
+    uint16_t addr;
+
+    if (load_file (b->rom, b->mem, 0x2000) < 0)
+        return -1;
+
+    /* 8kiB ROM, 8kiB RAM (work RAM and video), RAM mirrored above */
+    i8080_map (b->state, 0x0000, 0x2000, b->mem, I8080_PAGE_ROM);
+    for (addr = 0x2000; addr != 0; addr += 0x2000)
+        i8080_map (b->state, addr, 0x2000, &b->mem[0x2000], I8080_PAGE_RAM);
+
+    i8080_set_port_default (b->state, invaders_in, invaders_out, b);
+    i8080_schedule (b->state, INVADERS_FRAME / 2, invaders_irq, NULL);
+    return 0;
+}
+
+static uint64_t run_invaders (struct bench* b)
+{
+    uint64_t t;
+
+    i8080_restore (b->state, b->start);
+    b->shift = 0;
+    b->shift_amount = 0;
+
+    t = now_ns ();
+    i8080_run (b->state, (uint64_t)b->frames * INVADERS_FRAME);
+    t = now_ns () - t;
+    count (b);
+    return t;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Synthetic loops                                                            */
+/*----------------------------------------------------------------------------*/
+static const uint8_t loop_code[] = {
+    0x01, 0xff, 0xff,       /* 0000 lxi b,ffffh */
+    0x0b,                   /* 0003 dcx b       */
+    0x78,                   /* 0004 mov a,b     */
+    0xb1,                   /* 0005 ora c       */
+    0xc2, 0x03, 0x00,       /* 0006 jnz 0003h   */
+    0x76,                   /* 0009 hlt         */
+};
+
+static const uint8_t memcpy_code[] = {
+    0x21, 0x00, 0x10,       /* 0000 lxi h,1000h */
+    0x11, 0x00, 0x20,       /* 0003 lxi d,2000h */
+    0x01, 0x00, 0x10,       /* 0006 lxi b,1000h */
+    0x7e,                   /* 0009 mov a,m     */
+    0x12,                   /* 000a stax d      */
+    0x23,                   /* 000b inx h       */
+    0x13,                   /* 000c inx d       */
+    0x0b,                   /* 000d dcx b       */
+    0x78,                   /* 000e mov a,b     */
+    0xb1,                   /* 000f ora c       */
+    0xc2, 0x09, 0x00,       /* 0010 jnz 0009h   */
+    0x76,                   /* 0013 hlt         */
+};
+
+static const uint8_t call_code[] = {
+    0x31, 0x00, 0xf0,       /* 0000 lxi sp,f000h */
+    0x01, 0x00, 0x40,       /* 0003 lxi b,4000h  */
+    0xcd, 0x12, 0x00,       /* 0006 call 0012h   */
+    0x0b,                   /* 0009 dcx b        */
+    0x78,                   /* 000a mov a,b      */
+    0xb1,                   /* 000b ora c        */
+    0xc2, 0x06, 0x00,       /* 000c jnz 0006h    */
+    0x76,                   /* 000f hlt          */
+    0x00, 0x00,
+    0xc5,                   /* 0012 push b       */
+    0xe1,                   /* 0013 pop h        */
+    0xc9,                   /* 0014 ret          */
+};
+
+static int setup_loop (struct bench* b)
+{
+    memcpy (b->mem, loop_code, sizeof(loop_code));
+    return 0;
+}
+
+static int setup_memcpy (struct bench* b)
+{
+    memcpy (b->mem, memcpy_code, sizeof(memcpy_code));
+    return 0;
+}
+
+static int setup_call (struct bench* b)
+{
+    memcpy (b->mem, call_code, sizeof(call_code));
+    return 0;
+}
+
+static uint64_t run_program (struct bench* b)
+{
+    uint64_t t = 0;
+    int i;
+
+    for (i = 0; i < PROGRAM_RUNS; i++)
+        t += run_to_halt (b);
+    return t;
+}
+
+static const struct workload workloads[] = {
+    { "cpudiag",  setup_cpudiag,  run_cpudiag,  1 },
+    { "invaders", setup_invaders, run_invaders, 0 },
+    { "loop",     setup_loop,     run_program,  1 },
+    { "memcpy",   setup_memcpy,   run_program,  1 },
+    { "call",     setup_call,     run_program,  1 },
+};
+
+#define WORKLOADS ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+/*----------------------------------------------------------------------------*/
+/* Microbenchmarks                                                            */
+/*----------------------------------------------------------------------------*/
+/* B and C are the loop counters, no body changes them or the stack depth;
+   H/L point at MICRO_DATA for the MOV r,M family */
+static const struct micro micros[] = {
+    { "empty",     { 0 }, 0, 0, 0 },
+    { "mov_rr",    { 0x7a, 0x5f, 0x57, 0x7c }, 4, 4, 0 },              /* mov a,d; mov e,a; mov d,a; mov a,h */
+    { "mov_rm",    { 0x7e, 0x56, 0x5e, 0x7e }, 4, 4, 0 },              /* mov a,m; mov d,m; mov e,m; mov a,m */
+    { "alu_r",     { 0x82, 0x93, 0xa4, 0xab, 0xb2, 0xbb, 0x8a, 0x9b }, /* add d; sub e; ana h; xra e */
+                   8, 8, 0 },                                          /* ora d; cmp e; adc d; sbb e */
+    { "alu_i",     { 0xc6, 0x01, 0xd6, 0x01, 0xe6, 0xff, 0xee, 0x00,   /* adi; sui; ani; xri */
+                     0xf6, 0x00, 0xfe, 0x00, 0xce, 0x00, 0xde, 0x00 }, /* ori; cpi; aci; sbi */
+                   16, 8, 0 },
+    { "inr_dcr",   { 0x14, 0x1d, 0x3c, 0x15 }, 4, 4, 0 },              /* inr d; dcr e; inr a; dcr d */
+    { "dad",       { 0x19, 0x09, 0x39, 0x19 }, 4, 4, 0 },              /* dad d; dad b; dad sp; dad d */
+    { "push_pop",  { 0xd5, 0xd1, 0xc5, 0xc1, 0xf5, 0xf1 }, 6, 6, 0 },  /* push/pop d, b, psw */
+    { "call_ret",  { 0xcd, MICRO_SUB & 0xff, MICRO_SUB >> 8 }, 3, 2, 0 }, /* call MICRO_SUB, ret */
+    { "jcc_taken", { 0xc2, 0x00, 0x00 }, 3, 1, 1 },                    /* jnz next (Z clear) */
+    { "jcc_not",   { 0xca, 0x00, 0x00 }, 3, 1, 1 },                    /* jz next (Z clear) */
+    { "in_out",    { 0xdb, 0x01, 0xd3, 0x02 }, 4, 2, 0 },              /* in 1; out 2 */
+};
+
+#define MICROS ((int)(sizeof(micros) / sizeof(micros[0])))
+
+static uint8_t micro_in (void* ctx, const uint8_t port)
+{
+    (void)ctx;
+    return port ^ 0x5a;
+}
+
+static void micro_out (void* ctx, const uint8_t port, const uint8_t byte)
+{
+    struct bench* b = ctx;
+
+    b->latch = byte ^ port;
+}
+
+static int setup_micro (struct bench* b)
+{
+    static const uint8_t head[MICRO_LOOP] = {
+        0x31, 0x00, 0xf0,       /* 0000 lxi sp,f000h */
+        0x21, MICRO_DATA & 0xff, MICRO_DATA >> 8, /* 0003 lxi h,MICRO_DATA */
+        0x11, 0x34, 0x12,       /* 0006 lxi d,1234h  */
+        0x3e, 0x01,             /* 0009 mvi a,01h    */
+        0xb7,                   /* 000b ora a (Z clear for the jcc bodies) */
+        0x06, 0x00,             /* 000c mvi b,00h    */
+        0x0e, MICRO_OUTER,      /* 000e mvi c,MICRO_OUTER */
+    };
+    const struct micro* m = b->micro;
+    uint16_t addr = MICRO_LOOP;
+    int n;
+
+    memcpy (b->mem, head, sizeof(head));
+    for (n = 0; m->instructions && n < MICRO_BODY; n += m->instructions) {
+        memcpy (&b->mem[addr], m->pattern, m->sizeb);
+        addr += m->sizeb;
+        if (m->next) {
+            b->mem[addr - 2] = addr & 0xff;
+            b->mem[addr - 1] = addr >> 8;
+        }
+    }
+
+    /* dcr b; jnz loop; dcr c; jnz loop; hlt */
+    b->mem[addr++] = 0x05;
+    b->mem[addr++] = 0xc2;
+    b->mem[addr++] = MICRO_LOOP & 0xff;
+    b->mem[addr++] = MICRO_LOOP >> 8;
+    b->mem[addr++] = 0x0d;
+    b->mem[addr++] = 0xc2;
+    b->mem[addr++] = MICRO_LOOP & 0xff;
+    b->mem[addr++] = MICRO_LOOP >> 8;
+    b->mem[addr++] = 0x76;
+
+    b->mem[MICRO_SUB] = 0xc9; /* ret */
+    memset (&b->mem[MICRO_DATA], 0xa5, 0x100);
+
+    i8080_set_port_in (b->state, 1, micro_in, b);
+    i8080_set_port_out (b->state, 2, micro_out, b);
+    return 0;
+}
+
+/* subtract the loop overhead measured by the empty body */
+static void micro_body (struct result* r, const struct result* empty)
+{
+    r->body_instructions = r->instructions - empty->instructions;
+    r->body_cycles = r->cycles - empty->cycles;
+    r->body_ns = (r->median_ns > empty->median_ns) ? (r->median_ns - empty->median_ns) : 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Measurement and reporting                                                  */
+/*----------------------------------------------------------------------------*/
+static int cmp_u64 (const void* x, const void* y)
+{
+    const uint64_t a = *(const uint64_t*)x;
+    const uint64_t b = *(const uint64_t*)y;
+
+    return (a < b) ? -1 : (a > b);
+}
+
+static int measure (struct bench* b, const struct workload* w, const int engine,
+                    const int warmup, const int reps, struct result* res)
+{
+    uint64_t ns[REPS_MAX];
+    int i;
+
+    memset (b->mem, 0, 0x10000);
+    b->step = (engine == ENGINE_EXEC);
+    b->state = i8080_create_engine (b->mem, 0x10000, b->step ? I8080_ENGINE_SWITCH : engine);
+    b->start = i8080_snapshot_create (b->state);
+    if (b->state == NULL || b->start == NULL || w->setup (b) < 0) {
+        fprintf (stderr, "Error: unable to set up %s\n", w->name);
+        i8080_snapshot_destroy (b->start);
+        i8080_destroy (b->state);
+        return -1;
+    }
+    i8080_set_pc (b->state, 0x0000);
+    i8080_snapshot (b->state, b->start);
+    b->start_instructions = b->state->instructions;
+    b->start_cycles = b->state->cycles;
+
+    /* every repetition executes the same instructions */
+    for (i = 0; i < warmup + reps; i++) {
+        uint64_t t;
+
+        b->instructions = 0;
+        b->cycles = 0;
+        t = w->run (b);
+        if (i >= warmup)
+            ns[i - warmup] = t;
+    }
+
+    i8080_snapshot_destroy (b->start);
+    i8080_destroy (b->state);
+
+    qsort (ns, reps, sizeof(uint64_t), cmp_u64);
+    res->workload = w->name;
+    res->engine = engine_names[engine];
+    res->instructions = b->instructions;
+    res->cycles = b->cycles;
+    res->median_ns = ns[reps / 2];
+    res->min_ns = ns[0];
+    res->max_ns = ns[reps - 1];
+    res->body_instructions = 0;
+    res->body_cycles = 0;
+    res->body_ns = 0;
+    return 0;
+}
+
+static double mips (const struct result* r)
+{
+    return r->median_ns ? ((double)r->instructions * 1000.0 / r->median_ns) : 0.0;
+}
+
+static int load_baseline (const char* filename, struct baseline* base, int* count)
+{
+    char line[1024];
+    FILE* fp;
+
+    if (NULL == (fp = fopen (filename, "r"))) {
+        fprintf (stderr, "Error: unable to open %s\n", filename);
+        return -1;
+    }
+
+    *count = 0;
+    while (fgets (line, sizeof(line), fp) && *count < BASELINE_MAX) {
+        struct baseline* e = &base[*count];
+        const char* w = strstr (line, "\"workload\": \"");
+        const char* n = strstr (line, "\"engine\": \"");
+        const char* m = strstr (line, "\"mips\": ");
+
+        if (w == NULL || n == NULL || m == NULL)
+            continue;
+        if (sscanf (w + 13, "%31[^\"]", e->workload) == 1 &&
+            sscanf (n + 11, "%15[^\"]", e->engine) == 1 &&
+            sscanf (m + 8, "%lf", &e->mips) == 1)
+            (*count)++;
+    }
+
+    fclose (fp);
+    return 0;
+}
+
+static const struct baseline* find_baseline (const struct baseline* base, const int count, const struct result* r)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!strcmp (base[i].workload, r->workload) && !strcmp (base[i].engine, r->engine))
+            return &base[i];
+    }
+    return NULL;
+}
+
+static void usage (const char* prog)
+{
+    int i;
+
+    fprintf (stderr, "usage: %s [options] [workload]...\n", prog);
+    fprintf (stderr, "       %s -m [options] [family]...\n", prog);
+    fprintf (stderr, "  -e E    : engine switch, threaded, bbcache or exec (repeatable,\n");
+    fprintf (stderr, "            default all but exec, -m: all)\n");
+    fprintf (stderr, "  -m      : opcode family microbenchmarks instead of the workloads\n");
+    fprintf (stderr, "  -r N    : timed repetitions (default 5)\n");
+    fprintf (stderr, "  -w N    : warmup repetitions (default 1)\n");
+    fprintf (stderr, "  -f N    : invaders frames (default 600)\n");
+    fprintf (stderr, "  -c FILE : cpudiag binary (default cpudiag_mod.bin)\n");
+    fprintf (stderr, "  -i FILE : invaders ROM (default ../tb/invaders.rom)\n");
+    fprintf (stderr, "  -o FILE : JSON results (default stdout)\n");
+    fprintf (stderr, "  -b FILE : compare with the results of an earlier run\n");
+    fprintf (stderr, "  -t PCT  : slowdown that fails the comparison (default 5)\n");
+    fprintf (stderr, "workloads:");
+    for (i = 0; i < WORKLOADS; i++)
+        fprintf (stderr, " %s", workloads[i].name);
+    fprintf (stderr, "\nfamilies:");
+    for (i = 1; i < MICROS; i++)
+        fprintf (stderr, " %s", micros[i].name);
+    fprintf (stderr, "\n");
+    exit (2);
+}
+
+int main (int argc, char** argv)
+{
+    static struct result results[ENGINES * (WORKLOADS + MICROS)];
+    static struct baseline base[BASELINE_MAX];
+    struct bench b;
+    int engines[ENGINES];
+    int selected[WORKLOADS + MICROS];
+    int nengines = 0;
+    int nresults = 0;
+    int nbase = 0;
+    int reps = 5;
+    int warmup = 1;
+    int micro = 0;
+    int count;
+    double threshold = 5.0;
+    const char* out_file = NULL;
+    const char* base_file = NULL;
+    int slower = 0;
+    int compared = 0;
+    FILE* out = stdout;
+    int opt;
+    int i;
+    int j;
+
+    memset (&b, 0, sizeof(b));
+    b.frames = 600;
+    b.cpudiag = "cpudiag_mod.bin";
+    b.rom = "../tb/invaders.rom";
+
+    while ((opt = getopt (argc, argv, "e:r:w:f:c:i:o:b:t:mh")) != -1) {
+        switch (opt) {
+            case 'e': {
+                for (i = 0; i < ENGINES && strcmp (optarg, engine_names[i]); i++)
+                    ;
+                if (i == ENGINES || nengines == ENGINES)
+                    usage (argv[0]);
+                engines[nengines++] = i;
+                break;
+            }
+            case 'r': reps = atoi (optarg); break;
+            case 'w': warmup = atoi (optarg); break;
+            case 'f': b.frames = atoi (optarg); break;
+            case 'c': b.cpudiag = optarg; break;
+            case 'i': b.rom = optarg; break;
+            case 'o': out_file = optarg; break;
+            case 'b': base_file = optarg; break;
+            case 't': threshold = atof (optarg); break;
+            case 'm': micro = 1; break;
+            default: usage (argv[0]);
+        }
+    }
+    if (reps < 1 || reps > REPS_MAX || warmup < 0 || b.frames < 1)
+        usage (argv[0]);
+    if (nengines == 0) {
+        for (i = 0; i < (micro ? ENGINES : ENGINE_EXEC); i++)
+            engines[nengines++] = i;
+    }
+
+    /* the microbenchmarks always measure the empty loop, micros[0] */
+    count = micro ? MICROS : WORKLOADS;
+    for (i = 0; i < count; i++)
+        selected[i] = (optind == argc) || (micro && i == 0);
+    for (j = optind; j < argc; j++) {
+        for (i = 0; i < count && strcmp (argv[j], micro ? micros[i].name : workloads[i].name); i++)
+            ;
+        if (i == count)
+            usage (argv[0]);
+        selected[i] = 1;
+    }
+
+    if (base_file && load_baseline (base_file, base, &nbase) < 0)
+        return 2;
+
+    b.mem = malloc (0x10000);
+    for (j = 0; j < nengines; j++) {
+        const int empty = nresults;
+
+        for (i = 0; i < count; i++) {
+            struct workload w = { micros[i].name, setup_micro, run_program, 1 };
+
+            if (!selected[i])
+                continue;
+            if (micro)
+                b.micro = &micros[i];
+            else
+                w = workloads[i];
+            if (engines[j] == ENGINE_EXEC && !w.halts) {
+                fprintf (stderr, "%s does not run to HLT, skipped for %s\n", w.name, engine_names[engines[j]]);
+                continue;
+            }
+            if (measure (&b, &w, engines[j], warmup, reps, &results[nresults]) < 0)
+                return 2;
+            if (micro && i > 0)
+                micro_body (&results[nresults], &results[empty]);
+            nresults++;
+        }
+    }
+    free (b.mem);
+
+    if (out_file && NULL == (out = fopen (out_file, "w"))) {
+        fprintf (stderr, "Error: unable to open %s\n", out_file);
+        return 2;
+    }
+
+    fprintf (out, "{\n  \"suite\": \"%s\",\n  \"repetitions\": %d,\n  \"warmup\": %d,\n",
+             micro ? "micro" : "workloads", reps, warmup);
+    if (micro)
+        fprintf (out, "  \"micro_body\": %d,\n  \"micro_iterations\": %d,\n", MICRO_BODY, 256 * MICRO_OUTER * PROGRAM_RUNS);
+    else
+        fprintf (out, "  \"invaders_frames\": %d,\n", b.frames);
+    fprintf (out, "  \"results\": [\n");
+    for (i = 0; i < nresults; i++) {
+        const struct result* r = &results[i];
+        const struct baseline* e = find_baseline (base, nbase, r);
+        const double m = mips (r);
+
+        fprintf (out, "    { \"workload\": \"%s\", \"engine\": \"%s\", \"instructions\": %llu, \"cycles\": %llu, "
+                 "\"median_ns\": %llu, \"min_ns\": %llu, \"max_ns\": %llu, \"spread_pct\": %.2f, "
+                 "\"mips\": %.3f, \"mhz\": %.3f, \"ns_per_instr\": %.3f",
+                 r->workload, r->engine, (unsigned long long)r->instructions, (unsigned long long)r->cycles,
+                 (unsigned long long)r->median_ns, (unsigned long long)r->min_ns, (unsigned long long)r->max_ns,
+                 100.0 * (r->max_ns - r->min_ns) / r->median_ns,
+                 m, (double)r->cycles * 1000.0 / r->median_ns, (double)r->median_ns / r->instructions);
+        if (r->body_instructions) {
+            fprintf (out, ", \"body_instructions\": %llu, \"body_cycles_per_instr\": %.3f, \"body_ns_per_instr\": %.3f",
+                     (unsigned long long)r->body_instructions, (double)r->body_cycles / r->body_instructions,
+                     (double)r->body_ns / r->body_instructions);
+        }
+        if (e && e->mips <= 0.0) {
+            fprintf (stderr, "Warning: baseline entry %s/%s has no MIPS, not compared\n", e->workload, e->engine);
+        } else if (e) {
+            const double change = 100.0 * (m - e->mips) / e->mips;
+
+            fprintf (out, ", \"baseline_mips\": %.3f, \"change_pct\": %.2f", e->mips, change);
+            fprintf (stderr, "%-10s %-9s %10.3f -> %10.3f MIPS %+7.2f%%%s\n", r->workload, r->engine,
+                     e->mips, m, change, (change < -threshold) ? "  SLOWER" : "");
+            if (change < -threshold)
+                slower++;
+            compared++;
+        }
+        fprintf (out, " }%s\n", (i + 1 < nresults) ? "," : "");
+    }
+    fprintf (out, "  ]\n}\n");
+
+    /* the per family cost as a table, families down, engines across */
+    if (micro) {
+        fprintf (stderr, "%-10s %6s", "family", "cycles");
+        for (j = 0; j < nengines; j++)
+            fprintf (stderr, " %9s", engine_names[engines[j]]);
+        fprintf (stderr, "   (ns per instruction)\n");
+        for (i = 1; i < MICROS; i++) {
+            int first = 1;
+
+            for (j = 0; j < nresults; j++) {
+                const struct result* r = &results[j];
+
+                if (strcmp (r->workload, micros[i].name) || r->body_instructions == 0)
+                    continue;
+                if (first)
+                    fprintf (stderr, "%-10s %6.2f", r->workload, (double)r->body_cycles / r->body_instructions);
+                fprintf (stderr, " %9.3f", (double)r->body_ns / r->body_instructions);
+                first = 0;
+            }
+            if (!first)
+                fprintf (stderr, "\n");
+        }
+    }
+
+    if (out != stdout)
+        fclose (out);
+
+    /* a renamed workload or engine must not pass as no regression */
+    if (base_file && compared == 0) {
+        fprintf (stderr, "Error: no result matches an entry of baseline %s\n", base_file);
+        return 2;
+    }
+    return slower ? 1 : 0;
+}
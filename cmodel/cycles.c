@@ -0,0 +1,319 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/* Regenerate the cycle count table (doc/cycle_counts_*.txt) from a cmodel
+   run over cpudiag and check it against reference tables. Every opcode is
+   counted under the name the RTL decoder gives it, with the fewest and
+   most T-states it took; conditional CALL and RET take the not taken
+   count or the taken count (I8080_CYCLES_TAKEN more) depending on the
+   flags. A table matches a reference when each of its min/max pairs lies
+   within the reference pair, so the datasheet ranges (cycle_counts_ref.txt)
+   hold however often cpudiag takes a branch. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "i8080.h"
+
+#define NAME_MAX_SIZEB 16
+
+/* opcode names of rtl/types.vhd (opcode_t) */
+static const char* const names[256] = {
+    "nop",    "lxi",    "stax",   "inx",    "inr",    "dcr",    "mvi2r",  "rlc",    /* 00 */
+    "und",    "dad",    "ldax",   "dcx",    "inr",    "dcr",    "mvi2r",  "rrc",
+    "und",    "lxi",    "stax",   "inx",    "inr",    "dcr",    "mvi2r",  "ral",    /* 10 */
+    "und",    "dad",    "ldax",   "dcx",    "inr",    "dcr",    "mvi2r",  "rar",
+    "und",    "lxi",    "shld",   "inx",    "inr",    "dcr",    "mvi2r",  "daa",    /* 20 */
+    "und",    "dad",    "lhld",   "dcx",    "inr",    "dcr",    "mvi2r",  "cma",
+    "und",    "lxi",    "sta",    "inx",    "inrm",   "dcrm",   "mvi2m",  "stc",    /* 30 */
+    "und",    "dad",    "lda",    "dcx",    "inr",    "dcr",    "mvi2r",  "cmc",
+    "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movm2r", "movr2r", /* 40 */
+    "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movm2r", "movr2r",
+    "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movm2r", "movr2r", /* 50 */
+    "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movm2r", "movr2r",
+    "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movm2r", "movr2r", /* 60 */
+    "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movm2r", "movr2r",
+    "movr2m", "movr2m", "movr2m", "movr2m", "movr2m", "movr2m", "hlt",    "movr2m", /* 70 */
+    "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movr2r", "movm2r", "movr2r",
+    "add",    "add",    "add",    "add",    "add",    "add",    "addm",   "add",    /* 80 */
+    "adc",    "adc",    "adc",    "adc",    "adc",    "adc",    "adcm",   "adc",
+    "sub",    "sub",    "sub",    "sub",    "sub",    "sub",    "subm",   "sub",    /* 90 */
+    "sbb",    "sbb",    "sbb",    "sbb",    "sbb",    "sbb",    "sbbm",   "sbb",
+    "ana",    "ana",    "ana",    "ana",    "ana",    "ana",    "anam",   "ana",    /* a0 */
+    "xra",    "xra",    "xra",    "xra",    "xra",    "xra",    "xram",   "xra",
+    "ora",    "ora",    "ora",    "ora",    "ora",    "ora",    "oram",   "ora",    /* b0 */
+    "cmp",    "cmp",    "cmp",    "cmp",    "cmp",    "cmp",    "cmpm",   "cmp",
+    "rnz",    "pop",    "jnz",    "jmp",    "cnz",    "push",   "adi",    "rst0",   /* c0 */
+    "rz",     "ret",    "jz",     "und",    "cz",     "call",   "aci",    "rst1",
+    "rnc",    "pop",    "jnc",    "outport","cnc",    "push",   "sui",    "rst2",   /* d0 */
+    "rc",     "und",    "jc",     "inport", "cc",     "und",    "sbi",    "rst3",
+    "rpo",    "pop",    "jpo",    "xthl",   "cpo",    "push",   "ani",    "rst4",   /* e0 */
+    "rpe",    "pchl",   "jpe",    "xchg",   "cpe",    "und",    "xri",    "rst5",
+    "rp",     "poppsw", "jp",     "di",     "cp",     "pushpsw","ori",    "rst6",   /* f0 */
+    "rm",     "sphl",   "jm",     "ei",     "cm",     "und",    "cpi",    "rst7",
+};
+
+struct entry
+{
+    char name[NAME_MAX_SIZEB];
+    int min;
+    int max;
+};
+
+struct table
+{
+    struct entry entry[256];
+    int count;
+};
+
+static struct entry* lookup (struct table* table, const char* name, const int add)
+{
+    int i;
+
+    for (i = 0; i < table->count; i++) {
+        if (!strcmp (table->entry[i].name, name))
+            return &table->entry[i];
+    }
+    if (!add || table->count == 256)
+        return NULL;
+
+    memset (&table->entry[i], 0, sizeof(struct entry));
+    snprintf (table->entry[i].name, NAME_MAX_SIZEB, "%s", name);
+    table->entry[i].min = -1;
+    table->entry[i].max = -1;
+    table->count++;
+    return &table->entry[i];
+}
+
+static void account (struct table* table, const char* name, const int cycles)
+{
+    struct entry* e = lookup (table, name, 1);
+
+    if (e->min < 0 || cycles < e->min)
+        e->min = cycles;
+    if (e->max < 0 || cycles > e->max)
+        e->max = cycles;
+}
+
+/* "  name,max : n" lines as written by tb/cpudiag.do, blanks are optional */
+static int load_table (const char* filename, struct table* table)
+{
+    char line[256];
+    char name[NAME_MAX_SIZEB];
+    char which[4];
+    int n;
+    FILE* fp;
+
+    if (NULL == (fp = fopen (filename, "r"))) {
+        fprintf (stderr, "Error: unable to open %s\n", filename);
+        return -1;
+    }
+    memset (table, 0, sizeof(struct table));
+
+    while (fgets (line, sizeof(line), fp)) {
+        struct entry* e;
+
+        if (sscanf (line, " %15[a-z0-9] , %3[a-z] : %d", name, which, &n) != 3)
+            continue;
+        e = lookup (table, name, 1);
+        if (e == NULL)
+            break;
+        if (!strcmp (which, "min"))
+            e->min = n;
+        else if (!strcmp (which, "max"))
+            e->max = n;
+    }
+
+    fclose (fp);
+    return 0;
+}
+
+static int compare_key (const void* x, const void* y)
+{
+    return strcmp (((const struct entry*)x)->name, ((const struct entry*)y)->name);
+}
+
+/* same order as tb/cpudiag.do (lsort of "name,max" and "name,min") */
+static void write_table (FILE* fp, struct table* table)
+{
+    char key[NAME_MAX_SIZEB + 4];
+    int i;
+
+    qsort (table->entry, table->count, sizeof(struct entry), compare_key);
+    for (i = 0; i < table->count; i++) {
+        const struct entry* e = &table->entry[i];
+
+        /* "push,max" sorts before "pushpsw,max" either way */
+        snprintf (key, sizeof(key), "%s,max", e->name);
+        fprintf (fp, "%10s : %d\n", key, e->max);
+        snprintf (key, sizeof(key), "%s,min", e->name);
+        fprintf (fp, "%10s : %d\n", key, e->min);
+    }
+}
+
+/* number of names that differ */
+static int compare (const char* filename, struct table* cmodel, struct table* ref)
+{
+    int errors = 0;
+    int i;
+
+    for (i = 0; i < cmodel->count; i++) {
+        const struct entry* c = &cmodel->entry[i];
+        const struct entry* r = lookup (ref, c->name, 0);
+
+        if (r == NULL) {
+            printf ("  %-8s %2d..%-2d  not in %s\n", c->name, c->min, c->max, filename);
+            errors++;
+        } else if (c->min < r->min || c->max > r->max) {
+            printf ("  %-8s %2d..%-2d  %s has %d..%d\n", c->name, c->min, c->max, filename, r->min, r->max);
+            errors++;
+        }
+    }
+    for (i = 0; i < ref->count; i++) {
+        if (lookup (cmodel, ref->entry[i].name, 0) == NULL) {
+            printf ("  %-8s not executed by cpudiag\n", ref->entry[i].name);
+            errors++;
+        }
+    }
+
+    if (errors)
+        printf ("%s: %d of %d instructions differ\n", filename, errors, ref->count);
+    else
+        printf ("%s: all %d instructions match\n", filename, ref->count);
+    return errors;
+}
+
+static struct table counts;
+static int last_opcode = -1;
+static uint64_t last_cycles;
+
+/* called before every instruction, so the previous one has completed */
+static int instr_handler (struct i8080_state* state)
+{
+    if (last_opcode >= 0)
+        account (&counts, names[last_opcode], (int)(state->cycles - last_cycles));
+
+    last_opcode = i8080_read (state, state->pc);
+    last_cycles = state->cycles;
+    return -1;
+}
+
+static void usage (const char* prog)
+{
+    fprintf (stderr, "usage: %s [-e engine] [-o table.txt] [-c ref.txt]... [-r table.txt]... [program.bin]\n", prog);
+    fprintf (stderr, "  -e E    : switch, threaded or bbcache\n");
+    fprintf (stderr, "  -o FILE : write the cycle count table (default stdout without -c)\n");
+    fprintf (stderr, "  -c FILE : compare with a reference table, exit status 1 if it differs\n");
+    fprintf (stderr, "  -r FILE : compare with a table and only report the differences\n");
+    fprintf (stderr, "  program : loaded at 0000 (default cpudiag_mod.bin)\n");
+    exit (2);
+}
+
+int main (int argc, char** argv)
+{
+    const char* refs[8];
+    int strict[8];
+    const char* out_file = NULL;
+    const char* program = "cpudiag_mod.bin";
+    int engine = I8080_ENGINE_SWITCH;
+    int nrefs = 0;
+    int errors = 0;
+    int opt;
+    int rc;
+    int i;
+    uint8_t* ram;
+    struct i8080_state* state;
+
+    while ((opt = getopt (argc, argv, "e:o:c:r:h")) != -1) {
+        switch (opt) {
+            case 'e': {
+                if (!strcmp (optarg, "switch"))
+                    engine = I8080_ENGINE_SWITCH;
+                else if (!strcmp (optarg, "threaded"))
+                    engine = I8080_ENGINE_THREADED;
+                else if (!strcmp (optarg, "bbcache"))
+                    engine = I8080_ENGINE_BBCACHE;
+                else
+                    usage (argv[0]);
+                break;
+            }
+            case 'o': out_file = optarg; break;
+            case 'c':
+            case 'r': {
+                if (nrefs == (int)(sizeof(refs) / sizeof(refs[0])))
+                    usage (argv[0]);
+                strict[nrefs] = (opt == 'c');
+                refs[nrefs++] = optarg;
+                break;
+            }
+            default: usage (argv[0]);
+        }
+    }
+    if (optind < argc)
+        program = argv[optind++];
+    if (optind != argc)
+        usage (argv[0]);
+
+    ram = (uint8_t*)malloc (0x10000 /* 64kiB */);
+    state = i8080_create_engine (ram, 0x10000 /* 64kiB */, engine);
+
+    /* the BDOS entry is left to the NOP at 0005, no console output */
+    i8080_load_memory (state, 0x0000, program);
+    i8080_set_pc (state, 0x0000);
+    i8080_set_instr_handler (state, instr_handler);
+
+    while ((rc = i8080_run (state, UINT64_MAX)) == I8080_RUN_BUDGET) {
+    }
+    if (rc != I8080_RUN_HALT) {
+        fprintf (stderr, "Error: %s did not run to HLT\n", program);
+        return 2;
+    }
+
+    if (out_file) {
+        FILE* fp = fopen (out_file, "w");
+
+        if (fp == NULL) {
+            fprintf (stderr, "Error: unable to open %s\n", out_file);
+            return 2;
+        }
+        write_table (fp, &counts);
+        fclose (fp);
+    } else if (nrefs == 0) {
+        write_table (stdout, &counts);
+    }
+
+    for (i = 0; i < nrefs; i++) {
+        struct table ref;
+
+        if (load_table (refs[i], &ref) < 0)
+            return 2;
+        if (compare (refs[i], &counts, &ref) && strict[i])
+            errors++;
+    }
+
+    i8080_destroy (state);
+    free (ram);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,195 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/* Run small programs that poke at the corners of the execution engines
+   (port handlers patching code or raising an interrupt in the middle of
+   a block, the PC wrapping at ffff) on every engine, with and without an
+   instruction handler, and check the registers each one ends with. Exit
+   status 1 if any run differs from the expected result. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "i8080.h"
+
+#define CODE_MAX_SIZEB 16
+
+struct check
+{
+    const char* name;
+    uint16_t origin;
+    uint8_t code[CODE_MAX_SIZEB];
+    int code_sizeb;
+    uint16_t isr;                  /* RST 1 handler, 0 = none */
+    uint8_t isr_code[CODE_MAX_SIZEB];
+    int isr_sizeb;
+    i8080_in_fn_t in_fn;
+    i8080_out_fn_t out_fn;
+    int rc;                        /* expected I8080_RUN_xxx */
+    uint8_t a;
+    uint8_t b;
+    uint16_t pc;
+};
+
+static const char* const engines[3] = { "switch", "threaded", "bbcache" };
+
+/* patch the operand of the MVI B following the OUT */
+static void out_patch (void* ctx, const uint8_t port, const uint8_t byte)
+{
+    (void)port;
+    i8080_write ((struct i8080_state*)ctx, 0x0005, byte);
+}
+
+/* RST 1 at the next instruction boundary */
+static void out_interrupt (void* ctx, const uint8_t port, const uint8_t byte)
+{
+    struct i8080_state* state = (struct i8080_state*)ctx;
+
+    (void)port;
+    (void)byte;
+    i8080_schedule_interrupt (state, state->cycles, 1);
+}
+
+/* patch the operand of the MVI B following the IN */
+static uint8_t in_patch (void* ctx, const uint8_t port)
+{
+    (void)port;
+    i8080_write ((struct i8080_state*)ctx, 0x0003, 0x44);
+    return 0x55;
+}
+
+static const struct check checks[] = {
+    {
+        "out patches code in its block", 0x0000,
+        { 0x3e, 0x22,       /* mvi a,22 */
+          0xd3, 0x01,       /* out 1 */
+          0x06, 0x11,       /* mvi b,11 */
+          0x76 }, 7,        /* hlt */
+        0, { 0 }, 0,
+        NULL, out_patch,
+        I8080_RUN_HALT, 0x22, 0x22, 0x0007
+    },
+    {
+        "out raises an interrupt", 0x0100,
+        { 0x31, 0x00, 0x10, /* lxi sp,1000 */
+          0xfb,             /* ei */
+          0xd3, 0x01,       /* out 1 */
+          0x06, 0x11,       /* mvi b,11 */
+          0x76 }, 9,        /* hlt */
+        0x0008,
+        { 0x06, 0x33,       /* mvi b,33 */
+          0x76 }, 3,        /* hlt */
+        NULL, out_interrupt,
+        I8080_RUN_HALT, 0x00, 0x33, 0x000b
+    },
+    {
+        "in patches code in its block", 0x0000,
+        { 0xdb, 0x01,       /* in 1 */
+          0x06, 0x11,       /* mvi b,11 */
+          0x76 }, 5,        /* hlt */
+        0, { 0 }, 0,
+        in_patch, NULL,
+        I8080_RUN_HALT, 0x55, 0x44, 0x0005
+    },
+    {
+        "pc wraps at ffff", 0xfffe,
+        { 0x00,             /* nop */
+          0x3e, 0x42,       /* mvi a,42 across ffff/0000 */
+          0x76 }, 4,        /* hlt */
+        0, { 0 }, 0,
+        NULL, NULL,
+        I8080_RUN_HALT, 0x42, 0x00, 0x0002
+    },
+};
+
+static int instr_handler (struct i8080_state* state)
+{
+    (void)state;
+    return 1;
+}
+
+static int run_check (const struct check* c, const int engine, const int with_handler)
+{
+    uint8_t* ram;
+    struct i8080_state* state;
+    int rc;
+    int i;
+
+    ram = (uint8_t*)malloc (0x10000 /* 64kiB */);
+    if (ram == NULL) {
+        fprintf (stderr, "Error: out of memory\n");
+        exit (2);
+    }
+    state = i8080_create_engine (ram, 0x10000 /* 64kiB */, engine);
+    if (state == NULL) {
+        fprintf (stderr, "Error: unable to create the %s engine\n", engines[engine]);
+        exit (2);
+    }
+
+    for (i = 0; i < c->code_sizeb; i++)
+        i8080_write (state, (uint16_t)(c->origin + i), c->code[i]);
+    for (i = 0; i < c->isr_sizeb; i++)
+        i8080_write (state, (uint16_t)(c->isr + i), c->isr_code[i]);
+    if (c->in_fn)
+        i8080_set_port_in (state, 0x01, c->in_fn, state);
+    if (c->out_fn)
+        i8080_set_port_out (state, 0x01, c->out_fn, state);
+    if (with_handler)
+        i8080_set_instr_handler (state, instr_handler);
+    i8080_set_pc (state, c->origin);
+
+    rc = i8080_run (state, 1000);
+
+    if (rc != c->rc || state->a != c->a || state->b != c->b || state->pc != c->pc) {
+        printf ("%s, %s%s: rc %d a %02x b %02x pc %04x, expected rc %d a %02x b %02x pc %04x\n",
+                c->name, engines[engine], with_handler ? " (instr handler)" : "",
+                rc, state->a, state->b, state->pc,
+                c->rc, c->a, c->b, c->pc);
+        rc = 1;
+    } else {
+        rc = 0;
+    }
+
+    i8080_destroy (state);
+    free (ram);
+    return rc;
+}
+
+int main (void)
+{
+    const int n = (int)(sizeof(checks) / sizeof(checks[0]));
+    int errors = 0;
+    int engine;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        for (engine = 0; engine < 3; engine++) {
+            errors += run_check (&checks[i], engine, 0);
+            errors += run_check (&checks[i], engine, 1);
+        }
+    }
+
+    printf ("%d of %d runs differ\n", errors, n * 3 * 2);
+    return (errors != 0);
+}
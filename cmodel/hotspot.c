@@ -0,0 +1,366 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/* Report where the guest spends its cycles from a PC histogram (i8080 -p
+   name writes name_pc.csv): the hottest routines, i.e. the cycles between
+   one symbol and the next, and the hottest instructions with their source
+   line. Symbols and source lines come from an assembler listing such as
+   tb/cpudiag.dis and/or a symbol map of "address name" lines (hex
+   addresses, '#' or ';' start a comment). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#define NAME_MAX_SIZEB 32
+#define LINE_MAX_SIZEB 256
+
+struct symbol
+{
+    uint16_t addr;
+    char name[NAME_MAX_SIZEB];
+};
+
+struct routine
+{
+    const struct symbol* sym; /* NULL = before the first symbol */
+    uint64_t count;
+    uint64_t cycles;
+};
+
+struct hist
+{
+    uint64_t count[0x10000];
+    uint64_t cycles[0x10000];
+    char* source[0x10000];   /* listing line per address, NULL = none */
+    struct symbol* sym;
+    int nsyms;
+    int max_syms;
+};
+
+static struct hist hist;
+
+static int add_symbol (const unsigned addr, const char* name, const size_t len)
+{
+    struct symbol* s;
+
+    if (hist.nsyms == hist.max_syms) {
+        hist.max_syms = hist.max_syms ? (hist.max_syms * 2) : 256;
+        s = realloc (hist.sym, hist.max_syms * sizeof(struct symbol));
+        if (s == NULL) {
+            fprintf (stderr, "Error: out of memory\n");
+            return -1;
+        }
+        hist.sym = s;
+    }
+    s = &hist.sym[hist.nsyms++];
+    s->addr = (addr & 0xffff);
+    snprintf (s->name, sizeof(s->name), "%.*s", (int)len, name);
+    return 0;
+}
+
+static int hex4 (const char* p, unsigned* val)
+{
+    int i;
+
+    *val = 0;
+    for (i = 0; i < 4; i++) {
+        if (!isxdigit ((unsigned char)p[i]))
+            return 0;
+        *val = (*val << 4) | (isdigit ((unsigned char)p[i]) ? (p[i] - '0') : ((p[i] | 0x20) - 'a' + 10));
+    }
+    return 1;
+}
+
+/* "AAAA<tab>XX XX XX   [LABEL:]<tab>OP<tab>ARGS ;comment" */
+static int load_listing (const char* filename)
+{
+    char line[LINE_MAX_SIZEB];
+    FILE* fp;
+
+    if (NULL == (fp = fopen (filename, "r"))) {
+        fprintf (stderr, "Error: unable to open %s\n", filename);
+        return -1;
+    }
+
+    while (fgets (line, sizeof(line), fp)) {
+        unsigned addr;
+        char* p = &line[5];
+        char* end;
+        size_t n;
+
+        if (!hex4 (line, &addr) || line[4] != '\t')
+            continue;
+
+        /* the object bytes */
+        while (isxdigit ((unsigned char)p[0]) && isxdigit ((unsigned char)p[1]) && (p[2] == ' ' || p[2] == '\t'))
+            p += 3;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        end = p + strlen (p);
+        while (end > p && isspace ((unsigned char)end[-1]))
+            *--end = '\0';
+        if (*p == '\0')
+            continue;
+
+        for (n = 0; isalnum ((unsigned char)p[n]) || p[n] == '_' || p[n] == '$'; n++)
+            ;
+        if (n && p[n] == ':' && add_symbol (addr, p, n) < 0)
+            break;
+
+        /* the first line of a DB/DS block keeps the address */
+        if (hist.source[addr] == NULL) {
+            char* t;
+
+            for (t = p; *t; t++) {
+                if (*t == '\t')
+                    *t = ' ';
+            }
+            hist.source[addr] = strdup (p);
+        }
+    }
+
+    fclose (fp);
+    return 0;
+}
+
+static int load_symbols (const char* filename)
+{
+    char line[LINE_MAX_SIZEB];
+    char name[NAME_MAX_SIZEB];
+    unsigned addr;
+    FILE* fp;
+
+    if (NULL == (fp = fopen (filename, "r"))) {
+        fprintf (stderr, "Error: unable to open %s\n", filename);
+        return -1;
+    }
+
+    while (fgets (line, sizeof(line), fp)) {
+        line[strcspn (line, "#;")] = '\0';
+        if (sscanf (line, "%x %31s", &addr, name) != 2)
+            continue;
+        if (add_symbol (addr, name, strlen (name)) < 0)
+            break;
+    }
+
+    fclose (fp);
+    return 0;
+}
+
+/* "pc,count,cycles" as written by i8080_profile_write_pc_csv() */
+static int load_histogram (const char* filename, uint64_t* total_count, uint64_t* total_cycles)
+{
+    char line[LINE_MAX_SIZEB];
+    unsigned pc;
+    unsigned long long count;
+    unsigned long long cycles;
+    FILE* fp;
+
+    if (NULL == (fp = fopen (filename, "r"))) {
+        fprintf (stderr, "Error: unable to open %s\n", filename);
+        return -1;
+    }
+
+    while (fgets (line, sizeof(line), fp)) {
+        if (sscanf (line, "%x,%llu,%llu", &pc, &count, &cycles) != 3 || pc > 0xffff)
+            continue;
+        hist.count[pc] += count;
+        hist.cycles[pc] += cycles;
+        *total_count += count;
+        *total_cycles += cycles;
+    }
+
+    fclose (fp);
+    return 0;
+}
+
+static int by_addr (const void* x, const void* y)
+{
+    const struct symbol* a = x;
+    const struct symbol* b = y;
+
+    return (a->addr < b->addr) ? -1 : (a->addr > b->addr);
+}
+
+/* most cycles first, ties on the larger count (routines) or the lower
+   address (instructions, which keep theirs in count) */
+static int by_cycles (const void* x, const void* y)
+{
+    const struct routine* a = x;
+    const struct routine* b = y;
+
+    if (a->cycles != b->cycles)
+        return (a->cycles < b->cycles) ? 1 : -1;
+    return (a->count < b->count) ? 1 : (a->count > b->count) ? -1 : 0;
+}
+
+static int by_pc_cycles (const void* x, const void* y)
+{
+    const struct routine* a = x;
+    const struct routine* b = y;
+
+    if (a->cycles != b->cycles)
+        return (a->cycles < b->cycles) ? 1 : -1;
+    return (a->count > b->count) ? 1 : (a->count < b->count) ? -1 : 0;
+}
+
+/* last symbol at or before addr, NULL if none */
+static const struct symbol* lookup (const unsigned addr)
+{
+    int lo = 0;
+    int hi = hist.nsyms;
+
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+
+        if (hist.sym[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo ? &hist.sym[lo - 1] : NULL;
+}
+
+static double percent (const uint64_t part, const uint64_t total)
+{
+    return total ? (100.0 * part / total) : 0.0;
+}
+
+static void usage (const char* prog)
+{
+    fprintf (stderr, "usage: %s [-l listing] [-s symbols] [-n count] name_pc.csv\n", prog);
+    fprintf (stderr, "  -l FILE : assembler listing for labels and source lines (e.g. tb/cpudiag.dis)\n");
+    fprintf (stderr, "  -s FILE : symbol map, \"address name\" per line\n");
+    fprintf (stderr, "  -n N    : routines and instructions listed (default 20)\n");
+}
+
+int main (int argc, char** argv)
+{
+    struct routine* routine;
+    struct routine* hot;
+    uint64_t total_count = 0;
+    uint64_t total_cycles = 0;
+    int nroutines = 0;
+    int nslots;
+    int top = 20;
+    int opt;
+    int i;
+    unsigned pc;
+
+    while ((opt = getopt (argc, argv, "l:s:n:h")) != -1) {
+        switch (opt) {
+            case 'l':
+                if (load_listing (optarg) < 0)
+                    return 2;
+                break;
+            case 's':
+                if (load_symbols (optarg) < 0)
+                    return 2;
+                break;
+            case 'n':
+                top = atoi (optarg);
+                break;
+            default:
+                usage (argv[0]);
+                return 2;
+        }
+    }
+    if ((argc - optind) != 1) {
+        usage (argv[0]);
+        return 2;
+    }
+    if (load_histogram (argv[optind], &total_count, &total_cycles) < 0)
+        return 2;
+
+    qsort (hist.sym, hist.nsyms, sizeof(struct symbol), by_addr);
+
+    /* one per symbol plus the one before the first, and later one per pc;
+       a symbol map may hold any number of lines, duplicates included */
+    nslots = (hist.nsyms + 1 > 0x10000) ? (hist.nsyms + 1) : 0x10000;
+    if (NULL == (routine = calloc (nslots, sizeof(struct routine)))) {
+        fprintf (stderr, "Error: out of memory\n");
+        return 2;
+    }
+
+    /* routine index 0 collects the addresses before the first symbol */
+    for (i = 0; i <= hist.nsyms; i++)
+        routine[i].sym = i ? &hist.sym[i - 1] : NULL;
+    for (pc = 0; pc < 0x10000; pc++) {
+        const struct symbol* s;
+
+        if (hist.count[pc] == 0)
+            continue;
+        s = lookup (pc);
+        hot = &routine[s ? (s - hist.sym) + 1 : 0];
+        hot->count += hist.count[pc];
+        hot->cycles += hist.cycles[pc];
+    }
+    nroutines = hist.nsyms + 1;
+    qsort (routine, nroutines, sizeof(struct routine), by_cycles);
+
+    printf ("%llu instructions, %llu cycles\n\n", (unsigned long long)total_count, (unsigned long long)total_cycles);
+
+    printf ("%-24s %12s %7s %12s\n", "routine", "cycles", "%", "instructions");
+    for (i = 0; i < nroutines && i < top && routine[i].cycles; i++) {
+        char name[NAME_MAX_SIZEB + 8];
+
+        if (routine[i].sym)
+            snprintf (name, sizeof(name), "%04x %s", routine[i].sym->addr, routine[i].sym->name);
+        else
+            snprintf (name, sizeof(name), "?");
+        printf ("%-24s %12llu %6.2f%% %12llu\n", name, (unsigned long long)routine[i].cycles,
+                percent (routine[i].cycles, total_cycles), (unsigned long long)routine[i].count);
+    }
+
+    /* the hottest instructions, reusing the routine array as pc list */
+    for (pc = 0, nroutines = 0; pc < 0x10000; pc++) {
+        if (hist.count[pc] == 0)
+            continue;
+        routine[nroutines].sym = NULL;
+        routine[nroutines].count = pc;
+        routine[nroutines].cycles = hist.cycles[pc];
+        nroutines++;
+    }
+    qsort (routine, nroutines, sizeof(struct routine), by_pc_cycles);
+
+    printf ("\n%-4s %12s %7s %12s  %-20s %s\n", "pc", "cycles", "%", "count", "location", "source");
+    for (i = 0; i < nroutines && i < top; i++) {
+        const unsigned addr = (unsigned)routine[i].count;
+        const struct symbol* s = lookup (addr);
+        char where[NAME_MAX_SIZEB + 16] = "";
+
+        if (s && s->addr == addr)
+            snprintf (where, sizeof(where), "%s", s->name);
+        else if (s)
+            snprintf (where, sizeof(where), "%s+%u", s->name, addr - s->addr);
+        printf ("%04x %12llu %6.2f%% %12llu  %-20s %s\n", addr, (unsigned long long)routine[i].cycles,
+                percent (routine[i].cycles, total_cycles), (unsigned long long)hist.count[addr],
+                where, hist.source[addr] ? hist.source[addr] : "");
+    }
+
+    free (routine);
+    return 0;
+}
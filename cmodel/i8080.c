@@ -29,6 +29,61 @@
 #include <errno.h>
 
 #include "i8080.h"
+#include "i8080_internal.h"
+
+/* T-states per opcode, from doc/cycle_counts_ref.txt; conditional CALL/RET
+   are listed as not taken, see I8080_CYCLES_TAKEN */
+const uint8_t i8080_cycles[256] = {
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, /* 00 */
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, /* 10 */
+     4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4, /* 20 */
+     4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4, /* 30 */
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, /* 40 */
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, /* 50 */
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, /* 60 */
+     7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5, /* 70 */
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, /* 80 */
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, /* 90 */
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, /* a0 */
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, /* b0 */
+     5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11, /* c0 */
+     5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11, /* d0 */
+     5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11, /* e0 */
+     5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11, /* f0 */
+};
+
+/* instruction length in bytes, unknown opcodes count as 1 */
+const uint8_t i8080_length[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, /* 00 */
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, /* 10 */
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, /* 20 */
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, /* 30 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 40 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 50 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 60 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 70 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 80 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 90 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* a0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* b0 */
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1, /* c0 */
+    1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 1, 2, 1, /* d0 */
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, /* e0 */
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, /* f0 */
+};
+
+#define SZP(v) ((((v) & 0x80) ? I8080_FLAG_S : 0) |                         \
+                (((v) == 0) ? I8080_FLAG_Z : 0) |                            \
+                (((((v) >> 0) ^ ((v) >> 1) ^ ((v) >> 2) ^ ((v) >> 3) ^       \
+                   ((v) >> 4) ^ ((v) >> 5) ^ ((v) >> 6) ^ ((v) >> 7)) & 1)   \
+                 ? 0 : I8080_FLAG_P))
+#define SZP4(v)   SZP(v), SZP(v + 1), SZP(v + 2), SZP(v + 3)
+#define SZP16(v)  SZP4(v), SZP4(v + 4), SZP4(v + 8), SZP4(v + 12)
+#define SZP64(v)  SZP16(v), SZP16(v + 16), SZP16(v + 32), SZP16(v + 48)
+
+const uint8_t i8080_szp[256] = {
+    SZP64(0x00), SZP64(0x40), SZP64(0x80), SZP64(0xc0)
+};
 
 #if defined(TRACE_I8080)
 #define i8080_TRACE(x) x; fprintf (state->log, "%s\n", s2str(state));
@@ -36,35 +91,168 @@
 #define i8080_TRACE(x)
 #endif
 
+static void rebuild_map (struct i8080_state* state);
+
 struct i8080_state* i8080_create (uint8_t* ram, const int sizeb)
+{
+    return i8080_create_engine (ram, sizeb, I8080_ENGINE_SWITCH);
+}
+
+struct i8080_state* i8080_create_engine (uint8_t* ram, const int sizeb, const int engine)
 {
     struct i8080_state* state;
+    int page;
 
     state = malloc (sizeof(struct i8080_state));
+    if (state == NULL)
+        return NULL;
 
-    if (state != NULL)
-        memset (state, 0, sizeof(struct i8080_state));
+    memset (state, 0, sizeof(struct i8080_state));
     state->mem = ram;
     state->mem_sizeb = sizeb;
     memset (state->mem, 0, sizeb);
 
+    state->f = I8080_FLAG_ONE;
+    state->engine = engine;
     state->log = stdout;
+    i8080_set_port_default (state, NULL, NULL, NULL);
+    memset (state->watch, I8080_WATCH_CLEAN, sizeof(state->watch));
+    for (page = 0; page < (sizeb >> 8) && page < 256; page++) {
+        state->page[page].host = &ram[page << 8];
+        state->page[page].perm = I8080_PAGE_RAM;
+    }
+    rebuild_map (state);
+
+    if (engine == I8080_ENGINE_BBCACHE) {
+        if (sizeb != 0x10000) {
+            fprintf (stderr, "Error: the block cache engine needs a 64kiB memory\n");
+            free (state);
+            return NULL;
+        }
+        if (NULL == (state->bbcache = i8080_bbcache_create ())) {
+            fprintf (stderr, "Error: unable to allocate the block cache\n");
+            free (state);
+            return NULL;
+        }
+    }
     return state;
 }
 
 void i8080_destroy (struct i8080_state* state)
 {
+    i8080_bbcache_destroy (state->bbcache);
     free (state);
 };
 
+void i8080_reset (struct i8080_state* state)
+{
+    int i;
+
+    for (i = 0; i < state->dirty_count; i++) {
+        const uint8_t page = state->dirty_page[i];
+
+        if (state->watch[page])
+            i8080_watch_write (state, (page << 8));
+        /* ROM keeps what the host loaded */
+        if (state->page[page].host && (state->page[page].perm & I8080_PAGE_WRITE))
+            memset (state->page[page].host, 0, 0x100);
+        i8080_watch_set (state, page, I8080_WATCH_CLEAN);
+    }
+    state->dirty_count = 0;
+
+    state->a = state->b = state->c = state->d = 0;
+    state->e = state->h = state->l = 0;
+    state->i = 0;
+    state->sp = 0;
+    state->pc = 0;
+    state->f = I8080_FLAG_ONE;
+    state->halted = 0;
+    state->stop = 0;
+    state->cycles = 0;
+    state->instructions = 0;
+    state->run_until = 0;
+    state->event_count = 0;
+    state->event_seq = 0;
+}
+
 void i8080_set_pc (struct i8080_state* state, uint16_t pc)
 {
     state->pc = pc;
 }
 
+/* no handler: IN leaves A unchanged, ctx is the state */
+static uint8_t port_in_none (void* ctx, const uint8_t port)
+{
+    (void)port;
+    return ((struct i8080_state*)ctx)->a;
+}
+
+static void port_out_none (void* ctx, const uint8_t port, const uint8_t byte)
+{
+    (void)ctx;
+    (void)port;
+    (void)byte;
+}
+
+/* i8080_set_io_handler() compatibility, ctx is the state */
+static uint8_t port_in_legacy (void* ctx, const uint8_t port)
+{
+    return ((struct i8080_state*)ctx)->io_handler (port, I8080_IO_IN_BYTE, DEVICE_IN);
+}
+
+static void port_out_legacy (void* ctx, const uint8_t port, const uint8_t byte)
+{
+    ((struct i8080_state*)ctx)->io_handler (port, byte, DEVICE_OUT);
+}
+
 void i8080_set_io_handler (struct i8080_state* state, i8080_io_fn_t io_func)
 {
     state->io_handler = io_func;
+    if (io_func)
+        i8080_set_port_default (state, port_in_legacy, port_out_legacy, state);
+    else
+        i8080_set_port_default (state, NULL, NULL, NULL);
+}
+
+void i8080_set_port_in (struct i8080_state* state, const uint8_t port, i8080_in_fn_t fn, void* ctx)
+{
+    if (fn) {
+        state->in_port[port].fn = fn;
+        state->in_port[port].ctx = ctx;
+        state->port_set[port] |= I8080_PORT_IN;
+    } else {
+        state->in_port[port] = state->in_default;
+        state->port_set[port] &= ~I8080_PORT_IN;
+    }
+}
+
+void i8080_set_port_out (struct i8080_state* state, const uint8_t port, i8080_out_fn_t fn, void* ctx)
+{
+    if (fn) {
+        state->out_port[port].fn = fn;
+        state->out_port[port].ctx = ctx;
+        state->port_set[port] |= I8080_PORT_OUT;
+    } else {
+        state->out_port[port] = state->out_default;
+        state->port_set[port] &= ~I8080_PORT_OUT;
+    }
+}
+
+void i8080_set_port_default (struct i8080_state* state, i8080_in_fn_t in_fn, i8080_out_fn_t out_fn, void* ctx)
+{
+    int port;
+
+    state->in_default.fn = in_fn ? in_fn : port_in_none;
+    state->in_default.ctx = in_fn ? ctx : state;
+    state->out_default.fn = out_fn ? out_fn : port_out_none;
+    state->out_default.ctx = ctx;
+
+    for (port = 0; port < 256; port++) {
+        if (!(state->port_set[port] & I8080_PORT_IN))
+            state->in_port[port] = state->in_default;
+        if (!(state->port_set[port] & I8080_PORT_OUT))
+            state->out_port[port] = state->out_default;
+    }
 }
 
 void i8080_set_instr_handler (struct i8080_state* state, i8080_instr_fn_t instr_func)
@@ -72,23 +260,31 @@ void i8080_set_instr_handler (struct i8080_state* state, i8080_instr_fn_t instr_
     state->instr_func = instr_func;
 }
 
-static inline int i8080_parity (int8_t val)
+void i8080_set_trace (struct i8080_state* state, struct i8080_trace* trace)
 {
-    int i;
-    int parity = 0;
-    for (i = 0; i < 8; i++)
-        parity += (val >> i);
-    parity = ((parity & 1) == 0) ? 1 : 0;
-    return parity;
+    state->trace = trace;
+}
+
+flags_t i8080_get_flags (const struct i8080_state* state)
+{
+    flags_t f;
+
+    f.s  = (state->f & I8080_FLAG_S)  ? 1 : 0;
+    f.z  = (state->f & I8080_FLAG_Z)  ? 1 : 0;
+    f.p  = (state->f & I8080_FLAG_P)  ? 1 : 0;
+    f.cy = (state->f & I8080_FLAG_CY) ? 1 : 0;
+    f.ac = (state->f & I8080_FLAG_AC) ? 1 : 0;
+    return f;
 }
 
-static inline void i8080_update_flags (struct i8080_state* state, uint16_t result, int8_t dst, int8_t src)
+void i8080_set_flags (struct i8080_state* state, const flags_t f)
 {
-    state->f.ac = ((dst ^ result ^ src) & 0x10) ? 1 : 0;
-    state->f.s =  ((result & 0x80) == 0) ? 0 : 1;
-    state->f.z =  ((result & 0xff) == 0) ? 1 : 0;
-    state->f.p = i8080_parity (result & 0xff);
-    state->f.cy =  ((result & 0x100) == 0) ? 0 : 1;
+    state->f = ((f.s  ? I8080_FLAG_S  : 0) |
+                (f.z  ? I8080_FLAG_Z  : 0) |
+                (f.p  ? I8080_FLAG_P  : 0) |
+                (f.cy ? I8080_FLAG_CY : 0) |
+                (f.ac ? I8080_FLAG_AC : 0) |
+                I8080_FLAG_ONE);
 }
 
 #if defined(TRACE_I8080)
@@ -98,8 +294,8 @@ static char* s2str (struct i8080_state* state)
 {
     sprintf (pbuf, "\t\t\t%02x %02x %02x %02x %02x %02x %02x %04x   %d,%d,%d,%d,%d (s,z,p,cy,ac) {0x%02x,0x%02x,0x%02x,0x%02x ...}",
              state->a&0xff,state->b&0xff,state->c&0xff,state->d&0xff,state->e&0xff,state->h&0xff,state->l&0xff,
-             state->sp, state->f.s,state->f.z,state->f.p,state->f.cy,state->f.ac,
-             state->mem[state->sp], state->mem[state->sp + 1], state->mem[state->sp + 2], state->mem[state->sp + 3]);
+             state->sp, (state->f >> 7) & 1, (state->f >> 6) & 1, (state->f >> 2) & 1, (state->f >> 0) & 1, (state->f >> 4) & 1,
+             i8080_rd (state, state->sp), i8080_rd (state, state->sp + 1), i8080_rd (state, state->sp + 2), i8080_rd (state, state->sp + 3));
     return pbuf;
 }
 #endif
@@ -139,7 +335,7 @@ static inline uint8_t* reg_ptr (struct i8080_state* state, uint8_t reg)
 
 static inline void movr2r (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t src_nr = (opcode & 0x7);
     const uint8_t dst_nr = ((opcode & 0x38) >> 3);
     uint8_t* src = reg_ptr (state, src_nr);
@@ -152,33 +348,33 @@ static inline void movr2r (struct i8080_state* state)
 
 static inline void movr2m (struct i8080_state* state, const uint16_t hl)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t src_nr = (opcode & 0x7);
     uint8_t* src = reg_ptr (state, src_nr);
 
     i8080_TRACE(fprintf (state->log, "0x%04x: mov m(0x%04x),%s", state->pc, hl, reg2str(state, src_nr)));
 
-    state->mem[hl] = *src;
+    i8080_wr (state, hl, *src);
     state->pc++;
 }
 
 static inline void movm2r (struct i8080_state* state, const uint16_t hl)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t dst_nr = ((opcode & 0x38) >> 3);
     uint8_t* dst = reg_ptr (state, dst_nr);
 
     i8080_TRACE(fprintf (state->log, "0x%04x: mov %s,m(0x%04x)", state->pc, reg2str(state, dst_nr), hl));
 
-    *dst = state->mem[hl];
+    *dst = i8080_rd (state, hl);
     state->pc++;
 }
 
 static inline void mvi (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t dst_nr = ((opcode & 0x38) >> 3);
-    const uint8_t byte = state->mem[state->pc+1];
+    const uint8_t byte = i8080_rd (state, state->pc+1);
     uint8_t* dst = reg_ptr (state, dst_nr);
 
     i8080_TRACE(fprintf (state->log, "0x%04x: mvi %s,0x%02x", state->pc, reg2str(state, dst_nr), byte));
@@ -189,7 +385,7 @@ static inline void mvi (struct i8080_state* state)
 
 static inline void add (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t src_nr = (opcode & 0x7);
     uint8_t* src = reg_ptr (state, src_nr);
     uint16_t result;
@@ -203,21 +399,21 @@ static inline void add (struct i8080_state* state)
 
 static inline void adc (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t src_nr = (opcode & 0x7);
     uint8_t* src = reg_ptr (state, src_nr);
     uint16_t result;
 
     i8080_TRACE(fprintf (state->log, "0x%04x: adc %s", state->pc, reg2str(state, src_nr)));
-    result = state->a + *src + state->f.cy;
-    i8080_update_flags (state, result, state->a, (*src+state->f.cy));
+    result = state->a + *src + I8080_CY(state);
+    i8080_update_flags (state, result, state->a, (*src+I8080_CY(state)));
     state->a = (result & 0xff);
     state->pc++;
 }
 
 static inline void sub (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t src_nr = (opcode & 0x7);
     uint8_t* src = reg_ptr (state, src_nr);
     uint16_t result;
@@ -231,7 +427,7 @@ static inline void sub (struct i8080_state* state)
 
 static inline void cmp (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t src_nr = (opcode & 0x7);
     uint8_t* src = reg_ptr (state, src_nr);
     uint16_t result;
@@ -244,79 +440,79 @@ static inline void cmp (struct i8080_state* state)
 
 static inline void sbb (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t src_nr = (opcode & 0x7);
     uint8_t* src = reg_ptr (state, src_nr);
     uint16_t result;
 
     i8080_TRACE(fprintf (state->log, "0x%04x: sbb %s", state->pc, reg2str(state, src_nr)));
-    result = state->a - *src - state->f.cy;
-    i8080_update_flags (state, result, state->a, (*src + state->f.cy));
+    result = state->a - *src - I8080_CY(state);
+    i8080_update_flags (state, result, state->a, (*src + I8080_CY(state)));
     state->a = (result & 0xff);
     state->pc++;
 }
 
 static inline void inr (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t dst_nr = ((opcode & 0x38) >> 3);
     uint8_t* dst = reg_ptr (state, dst_nr);
-    uint8_t cy = state->f.cy;
+    uint8_t cy = I8080_CY(state);
     uint16_t result;
 
     i8080_TRACE(fprintf (state->log, "0x%04x: inr %s", state->pc, reg2str(state, dst_nr)));
     result = *dst + 1;
     i8080_update_flags (state, result, *dst, 1);
-    state->f.cy = cy;
+    i8080_set_flag (state, I8080_FLAG_CY, cy);
     *dst = (result & 0xff);
     state->pc++;
 }
 
 static inline void dcr (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t dst_nr = ((opcode & 0x38) >> 3);
     uint8_t* dst = reg_ptr (state, dst_nr);
-    uint8_t cy = state->f.cy;
+    uint8_t cy = I8080_CY(state);
     uint16_t result;
 
     i8080_TRACE(fprintf (state->log, "0x%04x: dcr %s", state->pc, reg2str(state, dst_nr)));
     result = *dst - 1;
     i8080_update_flags (state, result, *dst, 1);
-    state->f.cy = cy;
+    i8080_set_flag (state, I8080_FLAG_CY, cy);
     *dst = (result & 0xff);
     state->pc++;
 }
 
 static inline void call (struct i8080_state* state, uint16_t address)
 {
-    state->mem[state->sp - 1] = (((state->pc + 3) & 0xff00 ) >> 8);
-    state->mem[state->sp - 2] = (((state->pc + 3) & 0x00ff ) >> 0);
+    i8080_wr (state, state->sp - 1, (((state->pc + 3) & 0xff00 ) >> 8));
+    i8080_wr (state, state->sp - 2, (((state->pc + 3) & 0x00ff ) >> 0));
     state->sp -= 2;
     state->pc = address;
 }
 
 static inline void rst (struct i8080_state* state)
 {
-    uint8_t nnn = ((state->mem[state->pc] >> 3) & 0x7);
+    uint8_t nnn = ((i8080_rd (state, state->pc) >> 3) & 0x7);
 
     i8080_TRACE(fprintf (state->log, "0x%04x: rst %d", state->pc, nnn));
 
-    state->mem[state->sp - 1] = (((state->pc + 1) & 0xff00 ) >> 8);
-    state->mem[state->sp - 2] = (((state->pc + 1) & 0x00ff ) >> 0);
+    i8080_wr (state, state->sp - 1, (((state->pc + 1) & 0xff00 ) >> 8));
+    i8080_wr (state, state->sp - 2, (((state->pc + 1) & 0x00ff ) >> 0));
     state->sp -= 2;
     state->pc = (nnn * 8);
 }
 
 static inline void ret (struct i8080_state* state)
 {
-    state->pc = ((state->mem[state->sp + 1] << 8) | state->mem[state->sp]);
+    state->pc = ((i8080_rd (state, state->sp + 1) << 8) | i8080_rd (state, state->sp));
     state->sp += 2;
 }
 
 static inline void ana (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t src_nr = (opcode & 0x7);
     uint8_t* src = reg_ptr (state, src_nr);
     uint16_t result;
@@ -325,13 +521,13 @@ static inline void ana (struct i8080_state* state)
     result = state->a & *src;
     i8080_update_flags (state, result, state->a, *src);
     state->a = (result & 0xff);
-    state->f.cy = 0;
+    i8080_set_flag (state, I8080_FLAG_CY, 0);
     state->pc++;
 }
 
 static inline void xra (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t src_nr = (opcode & 0x7);
     uint8_t* src = reg_ptr (state, src_nr);
     uint16_t result;
@@ -340,14 +536,14 @@ static inline void xra (struct i8080_state* state)
     result = state->a ^ *src;
     i8080_update_flags (state, result, state->a, *src);
     state->a = (result & 0xff);
-    state->f.cy = 0;
-    state->f.ac = 0;
+    i8080_set_flag (state, I8080_FLAG_CY, 0);
+    i8080_set_flag (state, I8080_FLAG_AC, 0);
     state->pc++;
 }
 
 static inline void ora (struct i8080_state* state)
 {
-    const uint8_t opcode = state->mem[state->pc];
+    const uint8_t opcode = i8080_rd (state, state->pc);
     const uint8_t src_nr = (opcode & 0x7);
     uint8_t* src = reg_ptr (state, src_nr);
     uint16_t result;
@@ -356,41 +552,41 @@ static inline void ora (struct i8080_state* state)
     result = state->a | *src;
     i8080_update_flags (state, result, state->a, *src);
     state->a = (result & 0xff);
-    state->f.cy = 0;
-    state->f.ac = 0;
+    i8080_set_flag (state, I8080_FLAG_CY, 0);
+    i8080_set_flag (state, I8080_FLAG_AC, 0);
     state->pc++;
 }
 
-#define TRACE_I8080_STATE
-#if defined(TRACE_I8080_STATE)
-static void state_trace (struct i8080_state* state)
-{
-    printf ("{%d %d %d %d %d} ", state->f.cy,state->f.ac,state->f.z,state->f.p,state->f.s);
-    printf ("%02x %02x %02x %02x %02x %02x ",state->b,state->c,state->d,state->e,state->h,state->l);
-    printf ("%02x ",state->a);
-    printf ("%02x %02x ",(state->sp >> 8)&0xff, (state->sp >> 0)&0xff);
-    printf ("%02x %02x\n",(state->pc >> 8)&0xff, (state->pc >> 0)&0xff);
-}
-#endif
-
-int i8080_exec (struct i8080_state* state)
+static int i8080_exec_switch (struct i8080_state* state)
 {
     uint16_t bc = ((uint8_t)state->b << 8 | (uint8_t)state->c);
     uint16_t de = ((uint8_t)state->d << 8 | (uint8_t)state->e);
     uint16_t hl = ((uint8_t)state->h << 8 | (uint8_t)state->l);
+    uint16_t pc;
+    uint64_t cycles;
+    uint8_t opcode;
+    int rc = 0;
 
-#if defined(TRACE_I8080_STATE)
-    state_trace (state);
-#endif
+    if (i8080_unlikely (state->trace != NULL))
+        i8080_trace_state (state->trace, state);
 
-    if (state->pc >= (state->mem_sizeb - 1))
+    /* a 64kiB map wraps like the CPU does (operands through i8080_fetch()),
+       the same as the inner loops of the threaded and block cache engines */
+    if (state->mem_sizeb < 0x10000 && state->pc >= (state->mem_sizeb - 1))
         return -1;
 
     /* check for special handling of this PC value */
     if (state->instr_func && !state->instr_func (state))
         return 0;
 
-    switch (state->mem[state->pc]) {
+    /* read once, the opcode may come from MMIO */
+    opcode = i8080_rd (state, state->pc);
+    pc = state->pc;
+    cycles = state->cycles;
+    state->cycles += i8080_cycles[opcode];
+    state->instructions++;
+
+    switch (opcode) {
         case 0x7f: case 0x78: case 0x79:
         case 0x7a: case 0x7b: case 0x7c:
         case 0x7d: {
@@ -400,7 +596,7 @@ int i8080_exec (struct i8080_state* state)
         case 0x7e: movm2r (state, hl); break;
         case 0x0a: {
             i8080_TRACE(fprintf (state->log, "0x%04x: ldax b(%04x)", state->pc, bc));
-            state->a = state->mem[bc];
+            state->a = i8080_rd (state, bc);
             state->pc++;
             break;
         }
@@ -409,7 +605,7 @@ int i8080_exec (struct i8080_state* state)
             i8080_TRACE(fprintf (state->log, "0x%04x: rlc", state->pc));
             state->a <<= 1;
             state->a |= b7;
-            state->f.cy = b7;
+            i8080_set_flag (state, I8080_FLAG_CY, b7);
             state->pc++;
             break;
         }
@@ -418,7 +614,7 @@ int i8080_exec (struct i8080_state* state)
             i8080_TRACE(fprintf (state->log, "0x%04x: rrc", state->pc));
             state->a >>= 1;
             state->a |= (b0 << 7);
-            state->f.cy = b0;
+            i8080_set_flag (state, I8080_FLAG_CY, b0);
             state->pc++;
             break;
         }
@@ -426,8 +622,8 @@ int i8080_exec (struct i8080_state* state)
             uint8_t b7 = state->a >> 7;
             i8080_TRACE(fprintf (state->log, "0x%04x: ral", state->pc));
             state->a <<= 1;
-            state->a |= state->f.cy;
-            state->f.cy = b7;
+            state->a |= I8080_CY(state);
+            i8080_set_flag (state, I8080_FLAG_CY, b7);
             state->pc++;
             break;
         }
@@ -435,21 +631,21 @@ int i8080_exec (struct i8080_state* state)
             uint8_t b0 = state->a & 1;
             i8080_TRACE(fprintf (state->log, "0x%04x: rar", state->pc));
             state->a >>= 1;
-            state->a |= (state->f.cy << 7);
-            state->f.cy = b0;
+            state->a |= (I8080_CY(state) << 7);
+            i8080_set_flag (state, I8080_FLAG_CY, b0);
             state->pc++;
             break;
         }
         case 0x1a: {
             i8080_TRACE(fprintf (state->log, "0x%04x: ldax d(%04x)", state->pc, de));
-            state->a = state->mem[de];
+            state->a = i8080_rd (state, de);
             state->pc++;
             break;
         }
         case 0x3a: {
-            uint16_t word = (state->mem[state->pc+1] | state->mem[state->pc+2]<<8);
+            uint16_t word = (i8080_rd (state, state->pc+1) | i8080_rd (state, state->pc+2)<<8);
             i8080_TRACE(fprintf (state->log, "0x%04x: lda 0x%04x", state->pc, word));
-            state->a = state->mem[word];
+            state->a = i8080_rd (state, word);
             state->pc += 3;
             break;
         }
@@ -508,33 +704,33 @@ int i8080_exec (struct i8080_state* state)
             break;
         }
         case 0x36: {
-            uint8_t byte = state->mem[state->pc+1];
+            uint8_t byte = i8080_rd (state, state->pc+1);
             i8080_TRACE(fprintf (state->log, "0x%04x: mvi m,0x%02x", state->pc, byte));
-            state->mem[hl] = byte;
+            i8080_wr (state, hl, byte);
             state->pc += 2;
             break;
         }
         case 0x02: {
             i8080_TRACE(fprintf (state->log, "0x%04x: stax b", state->pc));
-            state->mem[bc] = state->a;
+            i8080_wr (state, bc, state->a);
             state->pc++;
             break;
         }
         case 0x12: {
             i8080_TRACE(fprintf (state->log, "0x%04x: stax d", state->pc));
-            state->mem[de] = state->a;
+            i8080_wr (state, de, state->a);
             state->pc++;
             break;
         }
         case 0x32: {
-            uint16_t word = (state->mem[state->pc+1] | state->mem[state->pc+2]<<8);
+            uint16_t word = (i8080_rd (state, state->pc+1) | i8080_rd (state, state->pc+2)<<8);
             i8080_TRACE(fprintf (state->log, "0x%04x: sta 0x%04x", state->pc, word));
-            state->mem[word] = state->a;
+            i8080_wr (state, word, state->a);
             state->pc += 3;
             break;
         }
         case 0x01: {
-            uint16_t word = (state->mem[state->pc+1] | state->mem[state->pc+2]<<8);
+            uint16_t word = (i8080_rd (state, state->pc+1) | i8080_rd (state, state->pc+2)<<8);
             i8080_TRACE(fprintf (state->log, "0x%04x: lxi b,0x%04x", state->pc, word));
             state->b = (word >> 8);
             state->c = (word & 0xff);
@@ -542,7 +738,7 @@ int i8080_exec (struct i8080_state* state)
             break;
         }
         case 0x11: {
-            uint16_t word = (state->mem[state->pc+1] | state->mem[state->pc+2]<<8);
+            uint16_t word = (i8080_rd (state, state->pc+1) | i8080_rd (state, state->pc+2)<<8);
             i8080_TRACE(fprintf (state->log, "0x%04x: lxi d,0x%04x", state->pc, word));
             state->d = (word >> 8);
             state->e = (word & 0xff);
@@ -550,7 +746,7 @@ int i8080_exec (struct i8080_state* state)
             break;
         }
         case 0x21: {
-            uint16_t word = (state->mem[state->pc+1] | state->mem[state->pc+2]<<8);
+            uint16_t word = (i8080_rd (state, state->pc+1) | i8080_rd (state, state->pc+2)<<8);
             i8080_TRACE(fprintf (state->log, "0x%04x: lxi h,0x%04x", state->pc, word));
             state->h = (word >> 8);
             state->l = (word & 0xff);
@@ -558,25 +754,25 @@ int i8080_exec (struct i8080_state* state)
             break;
         }
         case 0x31: {
-            uint16_t word = (state->mem[state->pc+1] | state->mem[state->pc+2]<<8);
+            uint16_t word = (i8080_rd (state, state->pc+1) | i8080_rd (state, state->pc+2)<<8);
             i8080_TRACE(fprintf (state->log, "0x%04x: lxi sp,0x%04x", state->pc, word));
             state->sp = word;
             state->pc += 3;
             break;
         }
         case 0x2a: {
-            uint16_t addr = (state->mem[state->pc+1] | state->mem[state->pc+2]<<8);
+            uint16_t addr = (i8080_rd (state, state->pc+1) | i8080_rd (state, state->pc+2)<<8);
             i8080_TRACE(fprintf (state->log, "0x%04x: lhld 0x%04x", state->pc, addr));
-            state->l = state->mem[addr+0];
-            state->h = state->mem[addr+1];
+            state->l = i8080_rd (state, addr+0);
+            state->h = i8080_rd (state, addr+1);
             state->pc += 3;
             break;
         }
         case 0x22: {
-            uint16_t addr = (state->mem[state->pc+1] | state->mem[state->pc+2]<<8);
+            uint16_t addr = (i8080_rd (state, state->pc+1) | i8080_rd (state, state->pc+2)<<8);
             i8080_TRACE(fprintf (state->log, "0x%04x: shld 0x%04x", state->pc, addr));
-            state->mem[addr+0] = state->l;
-            state->mem[addr+1] = state->h;
+            i8080_wr (state, addr+0, state->l);
+            i8080_wr (state, addr+1, state->h);
             state->pc += 3;
             break;
         }
@@ -597,10 +793,10 @@ int i8080_exec (struct i8080_state* state)
         }
         case 0xe3: {
             i8080_TRACE(fprintf (state->log, "0x%04x: xthl ", state->pc));
-            state->h = state->mem[state->sp+1];
-            state->l = state->mem[state->sp];
-            state->mem[state->sp+1] = (hl >> 8);
-            state->mem[state->sp] = (hl & 0xff);
+            state->h = i8080_rd (state, state->sp+1);
+            state->l = i8080_rd (state, state->sp);
+            i8080_wr (state, state->sp+1, (hl >> 8));
+            i8080_wr (state, state->sp, (hl & 0xff));
             state->pc++;
             break;
         }
@@ -613,17 +809,17 @@ int i8080_exec (struct i8080_state* state)
         case 0x86: {
             uint16_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: add m", state->pc));
-            result = state->a + state->mem[hl];
-            i8080_update_flags (state, result, state->a, state->mem[hl]);
+            result = state->a + i8080_rd (state, hl);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, hl));
             state->a = result & 0xff;
             state->pc++;
             break;
         }
         case 0xc6: {
             uint16_t result;
-            i8080_TRACE(fprintf (state->log, "0x%04x: adi 0x%02x", state->pc, state->mem[state->pc+1]));
-            result = state->a + state->mem[state->pc+1];
-            i8080_update_flags (state, result, state->a, state->mem[state->pc+1]);
+            i8080_TRACE(fprintf (state->log, "0x%04x: adi 0x%02x", state->pc, i8080_rd (state, state->pc+1)));
+            result = state->a + i8080_rd (state, state->pc+1);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, state->pc+1));
             state->a = result & 0xff;
             state->pc += 2;
             break;
@@ -637,17 +833,17 @@ int i8080_exec (struct i8080_state* state)
         case 0x8e: {
             uint16_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: adc m", state->pc));
-            result = state->a + state->mem[hl] + state->f.cy;
-            i8080_update_flags (state, result, state->a, (state->mem[hl] + state->f.cy));
+            result = state->a + i8080_rd (state, hl) + I8080_CY(state);
+            i8080_update_flags (state, result, state->a, (i8080_rd (state, hl) + I8080_CY(state)));
             state->a = result & 0xff;
             state->pc++;
             break;
         }
         case 0xce: {
             uint16_t result;
-            i8080_TRACE(fprintf (state->log, "0x%04x: aci 0x%02x", state->pc, state->mem[state->pc+1]));
-            result = state->a + state->mem[state->pc+1] + state->f.cy;
-            i8080_update_flags (state, result, state->a, (state->mem[state->pc+1] + state->f.cy));
+            i8080_TRACE(fprintf (state->log, "0x%04x: aci 0x%02x", state->pc, i8080_rd (state, state->pc+1)));
+            result = state->a + i8080_rd (state, state->pc+1) + I8080_CY(state);
+            i8080_update_flags (state, result, state->a, (i8080_rd (state, state->pc+1) + I8080_CY(state)));
             state->a = result & 0xff;
             state->pc += 2;
             break;
@@ -661,17 +857,17 @@ int i8080_exec (struct i8080_state* state)
         case 0x96: {
             uint16_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: sub m", state->pc));
-            result = state->a - state->mem[hl];
-            i8080_update_flags (state, result, state->a, state->mem[hl]);
+            result = state->a - i8080_rd (state, hl);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, hl));
             state->a = result & 0xff;
             state->pc++;
             break;
         }
         case 0xd6: {
             uint16_t result;
-            i8080_TRACE(fprintf (state->log, "0x%04x: sui 0x%02x", state->pc, state->mem[state->pc+1]));
-            result = state->a - state->mem[state->pc+1];
-            i8080_update_flags (state, result, state->a, state->mem[state->pc+1]);
+            i8080_TRACE(fprintf (state->log, "0x%04x: sui 0x%02x", state->pc, i8080_rd (state, state->pc+1)));
+            result = state->a - i8080_rd (state, state->pc+1);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, state->pc+1));
             state->a = result & 0xff;
             state->pc += 2;
             break;
@@ -685,17 +881,17 @@ int i8080_exec (struct i8080_state* state)
         case 0x9e: {
             uint16_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: sbb m", state->pc));
-            result = state->a - state->mem[hl] - state->f.cy;
-            i8080_update_flags (state, result, state->a, (state->mem[hl] - state->f.cy));
+            result = state->a - i8080_rd (state, hl) - I8080_CY(state);
+            i8080_update_flags (state, result, state->a, (i8080_rd (state, hl) - I8080_CY(state)));
             state->a = result & 0xff;
             state->pc++;
             break;
         }
         case 0xde: {
             uint16_t result;
-            i8080_TRACE(fprintf (state->log, "0x%04x: sbi 0x%02x", state->pc, state->mem[state->pc+1]));
-            result = state->a - state->mem[state->pc+1] - state->f.cy;
-            i8080_update_flags (state, result, state->a, (state->mem[state->pc+1] - state->f.cy));
+            i8080_TRACE(fprintf (state->log, "0x%04x: sbi 0x%02x", state->pc, i8080_rd (state, state->pc+1)));
+            result = state->a - i8080_rd (state, state->pc+1) - I8080_CY(state);
+            i8080_update_flags (state, result, state->a, (i8080_rd (state, state->pc+1) - I8080_CY(state)));
             state->a = result & 0xff;
             state->pc += 2;
             break;
@@ -704,7 +900,7 @@ int i8080_exec (struct i8080_state* state)
             int32_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: dad b", state->pc));
             result = hl + bc;
-            state->f.cy = ((result & 0x10000) == 0) ? 0 : 1;
+            i8080_set_flag (state, I8080_FLAG_CY, ((result & 0x10000) == 0) ? 0 : 1);
             state->h = ((result & 0xff00) >> 8);
             state->l = ((result & 0x00ff) >> 0);
             state->pc++;
@@ -714,7 +910,7 @@ int i8080_exec (struct i8080_state* state)
             int32_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: dad d", state->pc));
             result = hl + de;
-            state->f.cy = ((result & 0x10000) == 0) ? 0 : 1;
+            i8080_set_flag (state, I8080_FLAG_CY, ((result & 0x10000) == 0) ? 0 : 1);
             state->h = ((result & 0xff00) >> 8);
             state->l = ((result & 0x00ff) >> 0);
             state->pc++;
@@ -724,7 +920,7 @@ int i8080_exec (struct i8080_state* state)
             int32_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: dad h", state->pc));
             result = hl + hl;
-            state->f.cy = ((result & 0x10000) == 0) ? 0 : 1;
+            i8080_set_flag (state, I8080_FLAG_CY, ((result & 0x10000) == 0) ? 0 : 1);
             state->h = ((result & 0xff00) >> 8);
             state->l = ((result & 0x00ff) >> 0);
             state->pc++;
@@ -734,7 +930,7 @@ int i8080_exec (struct i8080_state* state)
             int32_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: dad sp", state->pc));
             result = hl + state->sp;
-            state->f.cy = ((result & 0x10000) == 0) ? 0 : 1;
+            i8080_set_flag (state, I8080_FLAG_CY, ((result & 0x10000) == 0) ? 0 : 1);
             state->h = ((result & 0xff00) >> 8);
             state->l = ((result & 0x00ff) >> 0);
             state->pc++;
@@ -759,11 +955,9 @@ int i8080_exec (struct i8080_state* state)
         }
         case 0x76: {
             i8080_TRACE(fprintf (state->log, "0x%04x: hlt ", state->pc));
-#if !defined(TRACE_I8080_STATE)
-            printf ("HLT\n");
-#endif
-            exit(0);
+            state->halted = 1;
             state->pc++;
+            rc = 1;
             break;
         }
         case 0x3c: case 0x04: case 0x0c:
@@ -774,12 +968,12 @@ int i8080_exec (struct i8080_state* state)
         }
         case 0x34: {
             uint16_t result;
-            uint8_t cy = state->f.cy;
+            uint8_t cy = I8080_CY(state);
             i8080_TRACE(fprintf (state->log, "0x%04x: inr m", state->pc));
-            result = state->mem[hl] + 1;
-            i8080_update_flags (state, result, state->mem[hl], 1);
-            state->f.cy = cy;
-            state->mem[hl] = result & 0xff;
+            result = i8080_rd (state, hl) + 1;
+            i8080_update_flags (state, result, i8080_rd (state, hl), 1);
+            i8080_set_flag (state, I8080_FLAG_CY, cy);
+            i8080_wr (state, hl, result & 0xff);
             state->pc++;
             break;
         }
@@ -791,12 +985,12 @@ int i8080_exec (struct i8080_state* state)
         }
         case 0x35: {
             uint16_t result;
-            uint8_t cy = state->f.cy;
+            uint8_t cy = I8080_CY(state);
             i8080_TRACE(fprintf (state->log, "0x%04x: dcr m", state->pc));
-            result = state->mem[hl] - 1;
-            i8080_update_flags (state, result, state->mem[hl], 1);
-            state->f.cy = cy;
-            state->mem[hl] = result & 0xff;
+            result = i8080_rd (state, hl) - 1;
+            i8080_update_flags (state, result, i8080_rd (state, hl), 1);
+            i8080_set_flag (state, I8080_FLAG_CY, cy);
+            i8080_wr (state, hl, result & 0xff);
             state->pc++;
             break;
         }
@@ -849,32 +1043,32 @@ int i8080_exec (struct i8080_state* state)
         case 0x27: {
             uint8_t lnibble;
             uint8_t hnibble;
-            int cy = state->f.cy;
+            int cy = I8080_CY(state);
             int ac;
 
             i8080_TRACE(fprintf (state->log, "0x%04x: daa", state->pc));
 
             lnibble = (state->a & 0xf);
-            if ((lnibble > 9) || state->f.ac) {
+            if ((lnibble > 9) || (state->f & I8080_FLAG_AC)) {
                 uint16_t result = (state->a + 6) & 0xff;
                 i8080_update_flags (state, result, state->a, 6);
-                state->f.ac = 1;
+                i8080_set_flag (state, I8080_FLAG_AC, 1);
                 state->a = (result & 0xff);
             } else {
-                state->f.ac = 0;
+                i8080_set_flag (state, I8080_FLAG_AC, 0);
             }
-            ac = state->f.ac;
+            ac = (state->f & I8080_FLAG_AC);
 
             hnibble = ((state->a >> 4) & 0xf);
             if ((hnibble > 9) || cy) {
                 uint16_t result = (state->a + 0x60);
                 i8080_update_flags (state, result, state->a, 0x60);
-                state->f.cy = 1;
+                i8080_set_flag (state, I8080_FLAG_CY, 1);
                 state->a = (result & 0xff);
             } else {
-                state->f.cy = 0;
+                i8080_set_flag (state, I8080_FLAG_CY, 0);
             }
-            state->f.ac = ac;
+            i8080_set_flag (state, I8080_FLAG_AC, ac);
 
             state->pc++;
             break;
@@ -901,13 +1095,13 @@ int i8080_exec (struct i8080_state* state)
         }
         case 0x37: {
             i8080_TRACE(fprintf (state->log, "0x%04x: stc ", state->pc));
-            state->f.cy = 1;
+            i8080_set_flag (state, I8080_FLAG_CY, 1);
             state->pc++;
             break;
         }
         case 0x3f: {
             i8080_TRACE(fprintf (state->log, "0x%04x: cmc ", state->pc));
-            state->f.cy = (~state->f.cy & 1);
+            state->f ^= I8080_FLAG_CY;
             state->pc++;
             break;
         }
@@ -920,21 +1114,21 @@ int i8080_exec (struct i8080_state* state)
         case 0xa6: {
             uint16_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: ana m(0x%04x)", state->pc, hl));
-            result = state->a & state->mem[hl];
-            i8080_update_flags (state, result, state->a, state->mem[hl]);
+            result = state->a & i8080_rd (state, hl);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, hl));
             state->a = (result & 0xff);
-            state->f.cy = 0;
+            i8080_set_flag (state, I8080_FLAG_CY, 0);
             state->pc++;
             break;
         }
         case 0xe6: {
             uint16_t result;
-            i8080_TRACE(fprintf (state->log, "0x%04x: ani 0x%02x", state->pc, state->mem[state->pc+1]));
-            result = state->a & state->mem[state->pc+1];
-            i8080_update_flags (state, result, state->a, state->mem[state->pc+1]);
+            i8080_TRACE(fprintf (state->log, "0x%04x: ani 0x%02x", state->pc, i8080_rd (state, state->pc+1)));
+            result = state->a & i8080_rd (state, state->pc+1);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, state->pc+1));
             state->a = (result & 0xff);
-            state->f.cy = 0;
-            state->f.ac = 0;
+            i8080_set_flag (state, I8080_FLAG_CY, 0);
+            i8080_set_flag (state, I8080_FLAG_AC, 0);
             state->pc += 2;
             break;
         }
@@ -947,22 +1141,22 @@ int i8080_exec (struct i8080_state* state)
         case 0xae: {
             uint16_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: xra m(0x%04x)", state->pc, hl));
-            result = state->a ^ state->mem[hl];
-            i8080_update_flags (state, result, state->a, state->mem[hl]);
+            result = state->a ^ i8080_rd (state, hl);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, hl));
             state->a = (result & 0xff);
-            state->f.cy = 0;
-            state->f.ac = 0;
+            i8080_set_flag (state, I8080_FLAG_CY, 0);
+            i8080_set_flag (state, I8080_FLAG_AC, 0);
             state->pc++;
             break;
         }
         case 0xee: {
             uint16_t result;
-            i8080_TRACE(fprintf (state->log, "0x%04x: xri 0x%02x", state->pc, state->mem[state->pc+1]));
-            result = state->a ^ state->mem[state->pc+1];
-            i8080_update_flags (state, result, state->a, state->mem[state->pc+1]);
+            i8080_TRACE(fprintf (state->log, "0x%04x: xri 0x%02x", state->pc, i8080_rd (state, state->pc+1)));
+            result = state->a ^ i8080_rd (state, state->pc+1);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, state->pc+1));
             state->a = (result & 0xff);
-            state->f.cy = 0;
-            state->f.ac = 0;
+            i8080_set_flag (state, I8080_FLAG_CY, 0);
+            i8080_set_flag (state, I8080_FLAG_AC, 0);
             state->pc += 2;
             break;
         }
@@ -975,22 +1169,22 @@ int i8080_exec (struct i8080_state* state)
         case 0xb6: {
             uint16_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: ora m(0x%04x)", state->pc, hl));
-            result = state->a | state->mem[hl];
-            i8080_update_flags (state, result, state->a, state->mem[hl]);
+            result = state->a | i8080_rd (state, hl);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, hl));
             state->a = (result & 0xff);
-            state->f.cy = 0;
-            state->f.ac = 0;
+            i8080_set_flag (state, I8080_FLAG_CY, 0);
+            i8080_set_flag (state, I8080_FLAG_AC, 0);
             state->pc++;
             break;
         }
         case 0xf6: {
             uint16_t result;
-            i8080_TRACE(fprintf (state->log, "0x%04x: ori 0x%02x", state->pc, state->mem[state->pc+1]));
-            result = state->a | state->mem[state->pc+1];
-            i8080_update_flags (state, result, state->a, state->mem[state->pc+1]);
+            i8080_TRACE(fprintf (state->log, "0x%04x: ori 0x%02x", state->pc, i8080_rd (state, state->pc+1)));
+            result = state->a | i8080_rd (state, state->pc+1);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, state->pc+1));
             state->a = (result & 0xff);
-            state->f.cy = 0;
-            state->f.ac = 0;
+            i8080_set_flag (state, I8080_FLAG_CY, 0);
+            i8080_set_flag (state, I8080_FLAG_AC, 0);
             state->pc += 2;
             break;
         }
@@ -1003,92 +1197,92 @@ int i8080_exec (struct i8080_state* state)
         case 0xbe: {
             uint16_t result;
             i8080_TRACE(fprintf (state->log, "0x%04x: cmp m(%04x)", state->pc, hl));
-            result = state->a - state->mem[hl];
-            i8080_update_flags (state, result, state->a, state->mem[hl]);
+            result = state->a - i8080_rd (state, hl);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, hl));
             state->pc++;
             break;
         }
         case 0xfe: {
             uint16_t result;
-            i8080_TRACE(fprintf (state->log, "0x%04x: cpi 0x%02x", state->pc, state->mem[state->pc+1]));
-            result = state->a - state->mem[state->pc+1];
-            i8080_update_flags (state, result, state->a, state->mem[state->pc+1]);
+            i8080_TRACE(fprintf (state->log, "0x%04x: cpi 0x%02x", state->pc, i8080_rd (state, state->pc+1)));
+            result = state->a - i8080_rd (state, state->pc+1);
+            i8080_update_flags (state, result, state->a, i8080_rd (state, state->pc+1));
             state->pc += 2;
             break;
         }
         case 0xc3: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: jmp 0x%04x", state->pc, address));
             state->pc = address;
             break;
         }
         case 0xc2: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: jnz 0x%04x", state->pc, address));
-            if (state->f.z == 0)
+            if ((state->f & I8080_FLAG_Z) == 0)
                 state->pc = address;
             else
                 state->pc += 3;
             break;
         }
         case 0xca: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: jz 0x%04x", state->pc, address));
-            if (state->f.z == 1)
+            if ((state->f & I8080_FLAG_Z) != 0)
                 state->pc = address;
             else
                 state->pc += 3;
             break;
         }
         case 0xd2: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: jnc 0x%04x", state->pc, address));
-            if (state->f.cy == 0)
+            if ((state->f & I8080_FLAG_CY) == 0)
                 state->pc = address;
             else
                 state->pc += 3;
             break;
         }
         case 0xda: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: jc 0x%04x", state->pc, address));
-            if (state->f.cy == 1)
+            if ((state->f & I8080_FLAG_CY) != 0)
                 state->pc = address;
             else
                 state->pc += 3;
             break;
         }
         case 0xe2: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: jpo 0x%04x", state->pc, address));
-            if (state->f.p == 0)
+            if ((state->f & I8080_FLAG_P) == 0)
                 state->pc = address;
             else
                 state->pc += 3;
             break;
         }
         case 0xea: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: jpe 0x%04x", state->pc, address));
-            if (state->f.p == 1)
+            if ((state->f & I8080_FLAG_P) != 0)
                 state->pc = address;
             else
                 state->pc += 3;
             break;
         }
         case 0xf2: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: jp 0x%04x", state->pc, address));
-            if (state->f.s == 0)
+            if ((state->f & I8080_FLAG_S) == 0)
                 state->pc = address;
             else
                 state->pc += 3;
             break;
         }
         case 0xfa: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: jm 0x%04x", state->pc, address));
-            if (state->f.s == 1)
+            if ((state->f & I8080_FLAG_S) != 0)
                 state->pc = address;
             else
                 state->pc += 3;
@@ -1100,81 +1294,97 @@ int i8080_exec (struct i8080_state* state)
             break;
         }
         case 0xcd: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: call 0x%04x", state->pc, address));
             call (state, address);
             break;
         }
         case 0xc4: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: cnz 0x%04x", state->pc, address));
-            if (state->f.z == 0)
+            if ((state->f & I8080_FLAG_Z) == 0) {
                 call (state, address);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc += 3;
+            }
             break;
         }
         case 0xcc: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: cz 0x%04x", state->pc, address));
-            if (state->f.z == 1)
+            if ((state->f & I8080_FLAG_Z) != 0) {
                 call (state, address);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc += 3;
+            }
             break;
         }
         case 0xd4: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: cnc 0x%04x", state->pc, address));
-            if (state->f.cy == 0)
+            if ((state->f & I8080_FLAG_CY) == 0) {
                 call (state, address);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc += 3;
+            }
             break;
         }
         case 0xdc: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: cc 0x%04x", state->pc, address));
-            if (state->f.cy == 1)
+            if ((state->f & I8080_FLAG_CY) != 0) {
                 call (state, address);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc += 3;
+            }
             break;
         }
         case 0xe4: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: cpo 0x%04x", state->pc, address));
-            if (state->f.p == 0)
+            if ((state->f & I8080_FLAG_P) == 0) {
                 call (state, address);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc += 3;
+            }
             break;
         }
         case 0xec: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: cpe 0x%04x", state->pc, address));
-            if (state->f.p == 1)
+            if ((state->f & I8080_FLAG_P) != 0) {
                 call (state, address);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc += 3;
+            }
             break;
         }
         case 0xf4: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: cp 0x%04x", state->pc, address));
-            if (state->f.s == 0)
+            if ((state->f & I8080_FLAG_S) == 0) {
                 call (state, address);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc += 3;
+            }
             break;
         }
         case 0xfc: {
-            uint16_t address = (state->mem[state->pc+1] | (state->mem[state->pc+2] << 8));
+            uint16_t address = (i8080_rd (state, state->pc+1) | (i8080_rd (state, state->pc+2) << 8));
             i8080_TRACE(fprintf (state->log, "0x%04x: cm 0x%04x", state->pc, address));
-            if (state->f.s == 1)
+            if ((state->f & I8080_FLAG_S) != 0) {
                 call (state, address);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc += 3;
+            }
             break;
         }
         case 0xc9: {
@@ -1184,66 +1394,82 @@ int i8080_exec (struct i8080_state* state)
         }
         case 0xc0: {
             i8080_TRACE(fprintf (state->log, "0x%04x: rnz ", state->pc));
-            if (state->f.z == 0)
+            if ((state->f & I8080_FLAG_Z) == 0) {
                 ret (state);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc++;
+            }
             break;
         }
         case 0xc8: {
             i8080_TRACE(fprintf (state->log, "0x%04x: rz ", state->pc));
-            if (state->f.z == 1)
+            if ((state->f & I8080_FLAG_Z) != 0) {
                 ret (state);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc++;
+            }
             break;
         }
         case 0xd0: {
             i8080_TRACE(fprintf (state->log, "0x%04x: rnc ", state->pc));
-            if (state->f.cy == 0)
+            if ((state->f & I8080_FLAG_CY) == 0) {
                 ret (state);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc++;
+            }
             break;
         }
         case 0xd8: {
             i8080_TRACE(fprintf (state->log, "0x%04x: rc ", state->pc));
-            if (state->f.cy == 1)
+            if ((state->f & I8080_FLAG_CY) != 0) {
                 ret (state);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc++;
+            }
             break;
         }
         case 0xe0: {
             i8080_TRACE(fprintf (state->log, "0x%04x: rpo ", state->pc));
-            if (state->f.p == 0)
+            if ((state->f & I8080_FLAG_P) == 0) {
                 ret (state);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc++;
+            }
             break;
         }
         case 0xe8: {
             i8080_TRACE(fprintf (state->log, "0x%04x: rpe ", state->pc));
-            if (state->f.p == 1)
+            if ((state->f & I8080_FLAG_P) != 0) {
                 ret (state);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc++;
+            }
             break;
         }
         case 0xf0: {
             i8080_TRACE(fprintf (state->log, "0x%04x: rp ", state->pc));
-            if (state->f.s == 0)
+            if ((state->f & I8080_FLAG_S) == 0) {
                 ret (state);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc++;
+            }
             break;
         }
         case 0xf8: {
             i8080_TRACE(fprintf (state->log, "0x%04x: rm ", state->pc));
-            if (state->f.s == 1)
+            if ((state->f & I8080_FLAG_S) != 0) {
                 ret (state);
-            else
+                state->cycles += I8080_CYCLES_TAKEN;
+            } else {
                 state->pc++;
+            }
             break;
         }
         case 0xc7: case 0xcf: case 0xd7:
@@ -1254,104 +1480,166 @@ int i8080_exec (struct i8080_state* state)
         }
         case 0xc5: {
             i8080_TRACE(fprintf (state->log, "0x%04x: push b", state->pc));
-            state->mem[state->sp - 1] = state->b;
-            state->mem[state->sp - 2] = state->c;
+            i8080_wr (state, state->sp - 1, state->b);
+            i8080_wr (state, state->sp - 2, state->c);
             state->sp -= 2;
             state->pc++;
             break;
         }
         case 0xd5: {
             i8080_TRACE(fprintf (state->log, "0x%04x: push d", state->pc));
-            state->mem[state->sp - 1] = state->d;
-            state->mem[state->sp - 2] = state->e;
+            i8080_wr (state, state->sp - 1, state->d);
+            i8080_wr (state, state->sp - 2, state->e);
             state->sp -= 2;
             state->pc++;
             break;
         }
         case 0xe5: {
             i8080_TRACE(fprintf (state->log, "0x%04x: push h", state->pc));
-            state->mem[state->sp - 1] = state->h;
-            state->mem[state->sp - 2] = state->l;
+            i8080_wr (state, state->sp - 1, state->h);
+            i8080_wr (state, state->sp - 2, state->l);
             state->sp -= 2;
             state->pc++;
             break;
         }
         case 0xf5: {
             i8080_TRACE(fprintf (state->log, "0x%04x: push psw", state->pc));
-            state->mem[state->sp - 1] = state->a;
-            state->mem[state->sp - 2] = ((state->f.cy << 0) | (1 << 1) |
-                                         (state->f.p  << 2) | (0 << 3) |
-                                         (state->f.ac << 4) | (0 << 5) |
-                                         (state->f.z  << 6) | (state->f.s << 7));
+            i8080_wr (state, state->sp - 1, state->a);
+            i8080_wr (state, state->sp - 2, state->f);
             state->sp -= 2;
             state->pc++;
             break;
         }
         case 0xc1: {
             i8080_TRACE(fprintf (state->log, "0x%04x: pop b", state->pc));
-            state->c = state->mem[state->sp];
-            state->b = state->mem[state->sp + 1];
+            state->c = i8080_rd (state, state->sp);
+            state->b = i8080_rd (state, state->sp + 1);
             state->sp += 2;
             state->pc++;
             break;
         }
         case 0xd1: {
             i8080_TRACE(fprintf (state->log, "0x%04x: pop d", state->pc));
-            state->e = state->mem[state->sp];
-            state->d = state->mem[state->sp + 1];
+            state->e = i8080_rd (state, state->sp);
+            state->d = i8080_rd (state, state->sp + 1);
             state->sp += 2;
             state->pc++;
             break;
         }
         case 0xe1: {
             i8080_TRACE(fprintf (state->log, "0x%04x: pop h", state->pc));
-            state->l = state->mem[state->sp];
-            state->h = state->mem[state->sp + 1];
+            state->l = i8080_rd (state, state->sp);
+            state->h = i8080_rd (state, state->sp + 1);
             state->sp += 2;
             state->pc++;
             break;
         }
         case 0xf1: {
             i8080_TRACE(fprintf (state->log, "0x%04x: pop psw", state->pc));
-            state->a = state->mem[state->sp + 1];
-            state->f.cy = ((state->mem[state->sp] >> 0) & 1);
-            state->f.p  = ((state->mem[state->sp] >> 2) & 1);
-            state->f.ac = ((state->mem[state->sp] >> 4) & 1);
-            state->f.z  = ((state->mem[state->sp] >> 6) & 1);
-            state->f.s  = ((state->mem[state->sp] >> 7) & 1);
+            state->a = i8080_rd (state, state->sp + 1);
+            state->f = ((i8080_rd (state, state->sp) & I8080_FLAG_MASK) | I8080_FLAG_ONE);
             state->sp += 2;
             state->pc++;
             break;
         }
         case 0xdb: {
-            uint8_t port = state->mem[state->pc+1];
+            uint8_t port = i8080_rd (state, state->pc+1);
             i8080_TRACE(fprintf (state->log, "0x%04x: in 0x%02x", state->pc, port));
 
-            if (state->io_handler) {
-                state->a = state->io_handler (port, 0xee, DEVICE_IN);
-            }
+            state->a = i8080_in (state, port);
 
             state->pc += 2;
             break;
         }
         case 0xd3: {
-            uint8_t port = state->mem[state->pc+1];
+            uint8_t port = i8080_rd (state, state->pc+1);
             i8080_TRACE(fprintf (state->log, "0x%04x: out 0x%02x", state->pc, port));
 
-            if (state->io_handler) {
-                state->io_handler (port, state->a, DEVICE_OUT);
-            }
+            i8080_out (state, port, state->a);
 
             state->pc += 2;
             break;
         }
         default: {
-            fprintf (state->log, "0x%04x: 0x%02x [unknown opcode]\n", state->pc, state->mem[state->pc]);
+            fprintf (state->log, "0x%04x: 0x%02x [unknown opcode]\n", state->pc, i8080_rd (state, state->pc));
             return -1;
         }
     }
 
-    return 0;
+    if (i8080_unlikely (state->profile != NULL))
+        i8080_profile_count (state, opcode, pc, cycles);
+    return rc;
+}
+
+int i8080_exec (struct i8080_state* state)
+{
+    if (state->halted)
+        return 1;
+
+    /* single steps of the block cache engine go through the same handlers */
+    if (state->engine == I8080_ENGINE_THREADED || state->engine == I8080_ENGINE_BBCACHE)
+        return i8080_exec_threaded (state);
+
+    return i8080_exec_switch (state);
+}
+
+/* one slice up to state->run_until with the engine's inner loop */
+static int run_slice (struct i8080_state* state)
+{
+    int rc = 0;
+
+    if (state->engine == I8080_ENGINE_BBCACHE)
+        return i8080_run_bbcache (state);
+    if (state->engine == I8080_ENGINE_THREADED && state->mem_sizeb == 0x10000)
+        return i8080_run_threaded (state);
+
+    while (state->cycles < state->run_until) {
+        if ((rc = i8080_exec (state)) != 0)
+            break;
+    }
+    return rc;
+}
+
+int i8080_run (struct i8080_state* state, const uint64_t max_cycles)
+{
+    const uint64_t end = ((state->cycles + max_cycles) < state->cycles) ? UINT64_MAX : (state->cycles + max_cycles);
+    int rc;
+
+    state->stop = 0;
+
+    for (;;) {
+        /* events are only looked at when a slice ends at their deadline */
+        i8080_run_events (state);
+        if (state->stop)
+            return I8080_RUN_STOP;
+        if (state->cycles >= end)
+            return I8080_RUN_BUDGET;
+
+        state->run_until = (i8080_next_event (state) < end) ? i8080_next_event (state) : end;
+
+        if (state->halted) {
+            /* time passes until an interrupt wakes the CPU up */
+            state->cycles = state->run_until;
+            if (state->run_until == end)
+                return I8080_RUN_HALT;
+            continue;
+        }
+
+        rc = run_slice (state);
+        if (rc < 0)
+            return I8080_RUN_ERROR;
+        if (state->stop)
+            return I8080_RUN_STOP;
+        /* HLT, idle on if an event before the end may end it */
+        if (rc > 0 && i8080_next_event (state) >= end)
+            return I8080_RUN_HALT;
+    }
+}
+
+void i8080_stop (struct i8080_state* state)
+{
+    state->stop = 1;
+    state->run_until = 0;
 }
 
 void i8080_interrupt (struct i8080_state* state, uint8_t nnn)
@@ -1359,12 +1647,17 @@ void i8080_interrupt (struct i8080_state* state, uint8_t nnn)
     if (state->i) {
         i8080_TRACE(fprintf (state->log, "0x%04x: <interrupt> 0x%02x", state->pc, nnn));
 
+        if (i8080_unlikely (state->replay != NULL))
+            i8080_replay_interrupt (state, nnn);
+
         /* same as RST instruction */
-        state->mem[state->sp - 1] = ((state->pc & 0xff00 ) >> 8);
-        state->mem[state->sp - 2] = ((state->pc & 0x00ff ) >> 0);
+        i8080_wr (state, state->sp - 1, ((state->pc & 0xff00 ) >> 8));
+        i8080_wr (state, state->sp - 2, ((state->pc & 0x00ff ) >> 0));
         state->i = 0; /* disable interrupts */
         state->sp -= 2;
         state->pc = (nnn * 8);
+        state->halted = 0;
+        state->cycles += 11;
     }
 }
 
@@ -1380,6 +1673,7 @@ void i8080_load_memory (struct i8080_state* state, const int offset, const char*
 
         fsize = (fsize > state->mem_sizeb) ? state->mem_sizeb : fsize;
 
+        i8080_invalidate (state, offset, fsize);
         fread(&state->mem[offset], fsize, 1, f);
         fclose(f);
     } else {
@@ -1387,3 +1681,190 @@ void i8080_load_memory (struct i8080_state* state, const int offset, const char*
         exit(-1);
     }
 }
+
+/*----------------------------------------------------------------------------*/
+/* Memory map                                                                 */
+/*----------------------------------------------------------------------------*/
+/* recompute the store fast path of every guest page mapping the host page
+   of canonical page canon */
+static void update_wr (struct i8080_state* state, const uint8_t canon)
+{
+    uint8_t page = canon;
+
+    do {
+        const struct i8080_page* p = &state->page[page];
+
+        if (p->host && (p->perm & I8080_PAGE_WRITE) && !state->watch[canon])
+            state->wr[page] = p->host;
+        else
+            state->wr[page] = NULL;
+        page = state->alias_next[page];
+    } while (page != canon);
+}
+
+static void rebuild_map (struct i8080_state* state)
+{
+    int i;
+    int j;
+
+    for (i = 0; i < 256; i++) {
+        const struct i8080_page* p = &state->page[i];
+
+        state->canon[i] = i;
+        state->alias_next[i] = i;
+        state->rd[i] = (p->host && (p->perm & I8080_PAGE_READ)) ? p->host : NULL;
+
+        for (j = 0; p->host && j < i; j++) {
+            if (state->page[j].host == p->host) {
+                state->canon[i] = j;
+                state->alias_next[i] = state->alias_next[j];
+                state->alias_next[j] = i;
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < 256; i++) {
+        if (state->canon[i] == i)
+            update_wr (state, i);
+    }
+}
+
+static int map_range_ok (const uint16_t addr, const int len)
+{
+    if ((addr & 0xff) || (len & 0xff) || len <= 0 || (addr + len) > 0x10000) {
+        fprintf (stderr, "Error: memory map range 0x%04x+0x%x is not page aligned\n", addr, len);
+        return 0;
+    }
+    return 1;
+}
+
+static void map_pages (struct i8080_state* state, const uint16_t addr, const int len, const struct i8080_page* tmpl)
+{
+    int i;
+
+    for (i = 0; i < (len >> 8); i++) {
+        const uint8_t page = (addr >> 8) + i;
+        struct i8080_page* p = &state->page[page];
+
+        /* code translated from the old mapping is gone */
+        if (state->watch[state->canon[page]] & I8080_WATCH_CODE)
+            i8080_bbcache_invalidate_page (state, state->canon[page]);
+
+        *p = *tmpl;
+        if (tmpl->host)
+            p->host = &tmpl->host[i << 8];
+    }
+
+    /* canonical pages may have moved, the next snapshot copies everything */
+    state->snapshot = NULL;
+    rebuild_map (state);
+}
+
+void i8080_map (struct i8080_state* state, const uint16_t addr, const int len, uint8_t* host, const int perm)
+{
+    struct i8080_page tmpl;
+
+    if (!map_range_ok (addr, len))
+        return;
+
+    memset (&tmpl, 0, sizeof(tmpl));
+    tmpl.host = host;
+    tmpl.perm = perm;
+    map_pages (state, addr, len, &tmpl);
+}
+
+void i8080_map_mmio (struct i8080_state* state, const uint16_t addr, const int len,
+                     i8080_mmio_rd_fn_t rd, i8080_mmio_wr_fn_t wr, void* ctx)
+{
+    struct i8080_page tmpl;
+
+    if (!map_range_ok (addr, len))
+        return;
+
+    memset (&tmpl, 0, sizeof(tmpl));
+    tmpl.mmio_rd = rd;
+    tmpl.mmio_wr = wr;
+    tmpl.ctx = ctx;
+    map_pages (state, addr, len, &tmpl);
+}
+
+uint8_t i8080_read_slow (struct i8080_state* state, const uint16_t addr)
+{
+    const struct i8080_page* p = &state->page[addr >> 8];
+
+    if (p->host == NULL && p->mmio_rd)
+        return p->mmio_rd (p->ctx, addr);
+    return 0xff;
+}
+
+void i8080_write_slow (struct i8080_state* state, const uint16_t addr, const uint8_t val)
+{
+    const struct i8080_page* p = &state->page[addr >> 8];
+
+    if (p->host) {
+        if (p->perm & I8080_PAGE_WRITE) {
+            i8080_watch_write (state, addr);
+            p->host[addr & 0xff] = val;
+        }
+    } else if (p->mmio_wr) {
+        p->mmio_wr (p->ctx, addr, val);
+    }
+}
+
+uint8_t i8080_read (struct i8080_state* state, const uint16_t addr)
+{
+    return i8080_rd (state, addr);
+}
+
+void i8080_write (struct i8080_state* state, const uint16_t addr, const uint8_t byte)
+{
+    i8080_wr (state, addr, byte);
+}
+
+void i8080_watch_set (struct i8080_state* state, const uint8_t page, const uint8_t bits)
+{
+    const uint8_t canon = state->canon[page];
+
+    if ((state->watch[canon] & bits) != bits) {
+        state->watch[canon] |= bits;
+        update_wr (state, canon);
+    }
+}
+
+void i8080_watch_clear (struct i8080_state* state, const uint8_t page, const uint8_t bits)
+{
+    const uint8_t canon = state->canon[page];
+
+    if (state->watch[canon] & bits) {
+        state->watch[canon] &= ~bits;
+        update_wr (state, canon);
+    }
+}
+
+void i8080_watch_write (struct i8080_state* state, const uint16_t addr)
+{
+    const uint8_t page = state->canon[addr >> 8];
+    const uint8_t bits = state->watch[page];
+
+    if (bits & I8080_WATCH_CLEAN)
+        state->dirty_page[state->dirty_count++] = page;
+    if (bits & I8080_WATCH_SNAP)
+        state->snap_page[state->snap_count++] = page;
+    if (bits & I8080_WATCH_CODE)
+        i8080_bbcache_invalidate_page (state, page);
+    i8080_watch_clear (state, page, I8080_WATCH_CLEAN | I8080_WATCH_SNAP);
+}
+
+void i8080_invalidate (struct i8080_state* state, const uint16_t addr, const int len)
+{
+    int page;
+
+    if (len <= 0)
+        return;
+
+    for (page = (addr >> 8); page <= ((addr + len - 1) >> 8); page++) {
+        if (state->watch[state->canon[page & 0xff]])
+            i8080_watch_write (state, (page & 0xff) << 8);
+    }
+}
@@ -32,14 +32,117 @@ extern "C" {
 #define DEVICE_IN  0
 #define DEVICE_OUT 1
 
+/* i8080_run() results */
+#define I8080_RUN_ERROR  -1 /* unknown opcode or PC out of range */
+#define I8080_RUN_BUDGET  0 /* cycle budget used up */
+#define I8080_RUN_HALT    1 /* HLT executed, or still halted */
+#define I8080_RUN_STOP    2 /* i8080_stop() called from a handler */
+
+/* execution engines, selected at create time */
+#define I8080_ENGINE_SWITCH   0 /* reference interpreter, one big switch */
+#define I8080_ENGINE_THREADED 1 /* 256-entry handler table, operands resolved per opcode */
+#define I8080_ENGINE_BBCACHE  2 /* threaded handlers replayed from cached basic blocks */
+
 struct i8080_state;
+struct i8080_trace;
+struct i8080_bbcache;
+struct i8080_snapshot;
+struct i8080_replay;
 
+/* legacy single I/O callback, IN passes I8080_IO_IN_BYTE as byte */
 typedef uint8_t (*i8080_io_fn_t)(const uint8_t port, const uint8_t byte, const int direction);
 typedef int (*i8080_instr_fn_t)(struct i8080_state* state);
 
+#define I8080_IO_IN_BYTE 0xee
+
+/* per port I/O handlers, IN returns the byte loaded into A */
+typedef uint8_t (*i8080_in_fn_t)(void* ctx, const uint8_t port);
+typedef void (*i8080_out_fn_t)(void* ctx, const uint8_t port, const uint8_t byte);
+
+struct i8080_in_port
+{
+    i8080_in_fn_t fn;
+    void* ctx;
+};
+
+struct i8080_out_port
+{
+    i8080_out_fn_t fn;
+    void* ctx;
+};
+
+/* Events run by i8080_run() at the first instruction boundary at or after
+   their cycle time; events due at the same time run in the order they
+   were scheduled. */
+typedef void (*i8080_event_fn_t)(struct i8080_state* state, void* ctx, const uint64_t when);
+
+#define I8080_EVENTS_MAX 32
+
+struct i8080_event
+{
+    uint64_t when;
+    uint64_t seq;
+    i8080_event_fn_t fn;
+    void* ctx;
+};
+
+/* Per opcode counters, updated after every instruction while a profile is
+   set. taken counts the instructions that left the PC anywhere but the
+   next instruction, i.e. taken jumps, calls, returns and RSTs. The dumps
+   only report taken and not_taken (count - taken) for the conditional
+   branches Jcc, Ccc and Rcc; for every other opcode the CSV leaves both
+   fields empty and the JSON leaves them out. */
+struct i8080_profile_entry
+{
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t taken;
+    uint64_t reserved;
+};
+
+/* per guest address, see i8080_profile_enable_pc() */
+struct i8080_profile_pc
+{
+    uint64_t count;
+    uint64_t cycles;
+};
+
+struct i8080_profile
+{
+    struct i8080_profile_entry op[256];
+    struct i8080_profile_pc* pc; /* 64K entries, NULL = no PC histogram */
+} __attribute__((aligned(64)));
+
+/* memory map, 256 pages of 256 bytes */
+#define I8080_PAGE_READ  0x01
+#define I8080_PAGE_WRITE 0x02
+#define I8080_PAGE_ROM   (I8080_PAGE_READ)
+#define I8080_PAGE_RAM   (I8080_PAGE_READ | I8080_PAGE_WRITE)
+
+typedef uint8_t (*i8080_mmio_rd_fn_t)(void* ctx, const uint16_t addr);
+typedef void (*i8080_mmio_wr_fn_t)(void* ctx, const uint16_t addr, const uint8_t byte);
+
+struct i8080_page
+{
+    uint8_t* host;              /* 256 bytes behind the page, NULL = MMIO/unmapped */
+    int perm;                   /* I8080_PAGE_READ | I8080_PAGE_WRITE */
+    i8080_mmio_rd_fn_t mmio_rd; /* NULL = reads 0xff */
+    i8080_mmio_wr_fn_t mmio_wr; /* NULL = writes ignored */
+    void* ctx;
+};
+
 /* 7 6 5 4 3 2 1 0
    S Z I H - P - C
 */
+#define I8080_FLAG_CY   0x01 /* =1 if result had a carry */
+#define I8080_FLAG_ONE  0x02 /* always 1 */
+#define I8080_FLAG_P    0x04 /* =1 if result has even parity */
+#define I8080_FLAG_AC   0x10 /* =1 if result[3:0] had a carry */
+#define I8080_FLAG_Z    0x40 /* =1 if result is zero */
+#define I8080_FLAG_S    0x80 /* =1 if result MSbit is set */
+#define I8080_FLAG_MASK (I8080_FLAG_S | I8080_FLAG_Z | I8080_FLAG_AC | I8080_FLAG_P | I8080_FLAG_CY)
+
+/* unpacked view of the flags, see i8080_get_flags() */
 typedef struct
 {
     unsigned s:1;  /* =1 if result MSbit is set */
@@ -61,24 +164,133 @@ struct i8080_state
     uint8_t i; /* interrupt enable */
     uint16_t sp;
     uint16_t pc;
-    flags_t f;
+    uint8_t f;        /* flags packed as pushed by PUSH PSW, I8080_FLAG_xxx */
+    uint8_t halted;   /* =1 after HLT until the next interrupt */
+    uint8_t stop;     /* set by i8080_stop(), ends i8080_run() */
+    uint64_t cycles;  /* T-states executed, conditional CALL/RET counted as taken/not taken */
+    uint64_t instructions;
+    uint64_t run_until;
     uint8_t* mem;
     int mem_sizeb;
+    uint8_t* rd[256];              /* host page per guest page, NULL = i8080_read_slow() */
+    uint8_t* wr[256];              /* NULL for ROM, MMIO and watched pages */
+    struct i8080_page page[256];
+    uint8_t canon[256];            /* lowest guest page mapping the same host page */
+    uint8_t alias_next[256];       /* ring of guest pages mapping the same host page */
+    struct i8080_in_port in_port[256];   /* never NULL, unset ports hold the default */
+    struct i8080_out_port out_port[256];
+    struct i8080_in_port in_default;
+    struct i8080_out_port out_default;
+    uint8_t port_set[256];               /* I8080_PORT_IN/OUT: port has its own handler */
     i8080_io_fn_t io_handler;
     i8080_instr_fn_t instr_func;
+    int engine;
+    struct i8080_bbcache* bbcache; /* I8080_ENGINE_BBCACHE only */
+    uint8_t watch[256];            /* per canonical page, non-zero = stores need extra work */
+    uint8_t dirty_page[256];       /* pages written since the last i8080_reset() */
+    int dirty_count;
+    struct i8080_snapshot* snapshot; /* last snapshot taken or restored */
+    uint64_t snapshot_serial;
+    uint8_t snap_page[256];          /* pages written since then */
+    int snap_count;
+    struct i8080_event event[I8080_EVENTS_MAX]; /* min-heap on (when, seq) */
+    int event_count;
+    uint64_t event_seq;
+    struct i8080_trace* trace; /* NULL = tracing off */
+    struct i8080_profile* profile; /* NULL = profiling off */
+    struct i8080_replay* replay;   /* NULL = not recording or replaying, see i8080_replay.h */
     FILE* log;
 };
 
 struct i8080_state* i8080_create (uint8_t* ram, const int sizeb);
+struct i8080_state* i8080_create_engine (uint8_t* ram, const int sizeb, const int engine);
 void i8080_destroy (struct i8080_state* state);
+
+/* back to the state i8080_create() returned (registers, counters and zeroed
+   memory) while keeping the handlers, trace and engine; only the pages
+   written since the last reset are cleared */
+void i8080_reset (struct i8080_state* state);
+
+/* execute one instruction: 0 = ok, 1 = HLT, -1 = error; with a memory
+   smaller than 64kiB an instruction at the last byte is an error, a full
+   64kiB memory wraps on every engine */
 int i8080_exec (struct i8080_state* state);
 
+/* execute until max_cycles T-states have elapsed, HLT, an error or
+   i8080_stop(); returns one of I8080_RUN_xxx */
+int i8080_run (struct i8080_state* state, const uint64_t max_cycles);
+void i8080_stop (struct i8080_state* state);
+
 void i8080_set_pc (struct i8080_state* state, uint16_t pc);
 void i8080_set_io_handler (struct i8080_state* state, i8080_io_fn_t io_func);
+
+/* Handler for one port, fn = NULL hands the port back to the default. The
+   default handles every port without its own handler; without one IN
+   leaves A unchanged and OUT is ignored. i8080_set_io_handler() installs
+   a default that calls the legacy callback. */
+void i8080_set_port_in (struct i8080_state* state, const uint8_t port, i8080_in_fn_t fn, void* ctx);
+void i8080_set_port_out (struct i8080_state* state, const uint8_t port, i8080_out_fn_t fn, void* ctx);
+void i8080_set_port_default (struct i8080_state* state, i8080_in_fn_t in_fn, i8080_out_fn_t out_fn, void* ctx);
 void i8080_set_instr_handler (struct i8080_state* state, i8080_instr_fn_t instr_func);
+void i8080_set_trace (struct i8080_state* state, struct i8080_trace* trace);
+flags_t i8080_get_flags (const struct i8080_state* state);
+void i8080_set_flags (struct i8080_state* state, const flags_t f);
 void i8080_load_memory (struct i8080_state* state, const int offset, const char* const filename);
+
+/* call before the host writes guest memory directly (loading or patching code) */
+void i8080_invalidate (struct i8080_state* state, const uint16_t addr, const int len);
+
+/* Map len bytes of guest memory at addr (both multiples of 256) to host
+   memory, or to MMIO handlers. Pages mapping the same host memory (e.g.
+   mirrors) are tracked as one. i8080_create() maps state->mem as RAM;
+   the map is meant to be set up before running. */
+void i8080_map (struct i8080_state* state, const uint16_t addr, const int len, uint8_t* host, const int perm);
+void i8080_map_mmio (struct i8080_state* state, const uint16_t addr, const int len,
+                     i8080_mmio_rd_fn_t rd, i8080_mmio_wr_fn_t wr, void* ctx);
+
+/* guest memory access through the map, for hosts */
+uint8_t i8080_read (struct i8080_state* state, const uint16_t addr);
+void i8080_write (struct i8080_state* state, const uint16_t addr, const uint8_t byte);
+
+/* Opcode profile, counted by every engine while set (NULL = off, which
+   costs nothing per instruction); the dumps list the opcodes executed at
+   least once and return 0, or -1 if the file cannot be written. */
+struct i8080_profile* i8080_profile_create (void);
+void i8080_profile_destroy (struct i8080_profile* profile);
+void i8080_profile_reset (struct i8080_profile* profile);
+void i8080_set_profile (struct i8080_state* state, struct i8080_profile* profile);
+int i8080_profile_write_csv (const struct i8080_profile* profile, const char* const filename);
+int i8080_profile_write_json (const struct i8080_profile* profile, const char* const filename);
+
+/* Also count instructions and cycles per PC of the instruction; -1 if out
+   of memory. The CSV dump ("pc,count,cycles") is what cmodel/hotspot
+   reads. */
+int i8080_profile_enable_pc (struct i8080_profile* profile);
+int i8080_profile_write_pc_csv (const struct i8080_profile* profile, const char* const filename);
+
+/* Snapshots of the registers, counters, memory and event queue. Taking or restoring the
+   snapshot that was last taken or restored only copies the 256 byte pages
+   written since; switching to a different snapshot copies all memory. */
+struct i8080_snapshot* i8080_snapshot_create (const struct i8080_state* state);
+void i8080_snapshot_destroy (struct i8080_snapshot* snap);
+void i8080_snapshot (struct i8080_state* state, struct i8080_snapshot* snap);
+void i8080_restore (struct i8080_state* state, struct i8080_snapshot* snap);
 void i8080_interrupt (struct i8080_state* state, uint8_t nnn);
 
+/* Schedule fn (or RST nnn) at absolute cycle time when, a time in the past
+   runs at the next instruction boundary. An interrupt that arrives while
+   interrupts are disabled is dropped, as with i8080_interrupt(). Both
+   return 0, or -1 if I8080_EVENTS_MAX events are pending already. The
+   queue is cleared by i8080_reset() and saved in snapshots. */
+int i8080_schedule (struct i8080_state* state, const uint64_t when, i8080_event_fn_t fn, void* ctx);
+int i8080_schedule_interrupt (struct i8080_state* state, const uint64_t when, const uint8_t nnn);
+
+/* remove the pending events calling fn with ctx, returns how many */
+int i8080_cancel (struct i8080_state* state, i8080_event_fn_t fn, void* ctx);
+
+/* cycle time of the next event, UINT64_MAX if none is pending */
+uint64_t i8080_next_event (const struct i8080_state* state);
+
 #ifdef __cplusplus
 }
 #endif
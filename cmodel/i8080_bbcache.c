@@ -0,0 +1,344 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Basic block cache engine (I8080_ENGINE_BBCACHE).
+
+  Straight-line runs of guest code are decoded once into blocks of
+  {handler, operand, cycles} entries, keyed by the entry PC, and replayed
+  with the handlers of the threaded engine. A block ends at the first
+  jump, call, return, RST, PCHL, HLT or unknown opcode, or after
+  BB_MAX_INSTR instructions, so it covers at most two 256 byte pages.
+
+  Every page that holds translated code is marked in state->watch[]; a
+  store to such a page (from any handler, an interrupt or
+  i8080_invalidate()), or through any mirror of it, drops all blocks that
+  overlap it. A block that invalidates itself is left right after the
+  offending store, so self modifying code behaves exactly as under
+  i8080_exec(). Code is only translated from readable host pages, an
+  instruction fetched from MMIO is executed one at a time.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "i8080_internal.h"
+
+#define BB_MAX_INSTR    32
+#define BB_ARENA_SIZEB  (1024*1024)
+
+/* per opcode decode info */
+#define BB_END          0x04 /* last instruction of a block */
+#define BB_WRITES       0x08 /* may store to memory */
+
+struct bb_entry
+{
+    i8080_op_fn_t fn;
+    uint16_t arg;
+    uint8_t cycles;
+    uint8_t flags;
+    uint8_t opcode;
+};
+
+struct bb_block
+{
+    struct bb_block* next; /* blocks starting on the same page */
+    uint16_t pc;           /* entry point */
+    uint16_t sizeb;        /* bytes of guest code covered */
+    uint8_t valid;
+    uint8_t count;
+    struct bb_entry e[];
+};
+
+struct i8080_bbcache
+{
+    struct bb_block* map[0x10000]; /* entry PC -> block */
+    struct bb_block* page[256];    /* blocks by start page */
+    uint8_t info[256];
+    uint8_t* arena;
+    size_t used;
+};
+
+static uint8_t op_info (const uint8_t op)
+{
+    switch (op) {
+        /* unknown opcodes, the handler reports the error */
+        case 0x08: case 0x10: case 0x18: case 0x20:
+        case 0x28: case 0x30: case 0x38: case 0xcb:
+        case 0xd9: case 0xdd: case 0xed: case 0xfd:
+            return BB_END;
+        case 0x76: /* hlt */
+        case 0xc9: /* ret */
+        case 0xe9: /* pchl */
+        case 0xc3: /* jmp */
+        case 0xcd: /* call */
+            return BB_END;
+        /* port handlers may patch memory, invalidate blocks or raise an
+           interrupt that moves the PC, so the next block is looked up */
+        case 0xd3: /* out */
+        case 0xdb: /* in */
+            return BB_END;
+        case 0x02: case 0x12: /* stax */
+        case 0x34: case 0x35: /* inr m, dcr m */
+        case 0xe3:            /* xthl */
+        case 0xc5: case 0xd5: case 0xe5: case 0xf5: /* push */
+        case 0x36:            /* mvi m */
+        case 0x22: case 0x32: /* shld, sta */
+            return BB_WRITES;
+    }
+
+    if ((op & 0xf8) == 0x70) /* mov m,r */
+        return BB_WRITES;
+    if ((op & 0xc7) == 0xc2) /* jcc */
+        return BB_END;
+    if ((op & 0xc7) == 0xc4) /* ccc */
+        return BB_END;
+    if ((op & 0xc7) == 0xc0) /* rcc */
+        return BB_END;
+    if ((op & 0xc7) == 0xc7) /* rst */
+        return BB_END;
+    return 0;
+}
+
+struct i8080_bbcache* i8080_bbcache_create (void)
+{
+    struct i8080_bbcache* cache;
+    int op;
+
+    cache = malloc (sizeof(struct i8080_bbcache));
+    if (cache == NULL)
+        return NULL;
+    memset (cache, 0, sizeof(struct i8080_bbcache));
+
+    cache->arena = malloc (BB_ARENA_SIZEB);
+    if (cache->arena == NULL) {
+        free (cache);
+        return NULL;
+    }
+
+    for (op = 0; op < 256; op++)
+        cache->info[op] = op_info (op);
+
+    return cache;
+}
+
+void i8080_bbcache_destroy (struct i8080_bbcache* cache)
+{
+    if (cache) {
+        free (cache->arena);
+        free (cache);
+    }
+}
+
+/* drop every block starting on start_page that covers page */
+static void drop_blocks (struct i8080_bbcache* cache, const uint8_t start_page, const uint8_t page)
+{
+    struct bb_block** link = &cache->page[start_page];
+
+    while (*link) {
+        struct bb_block* blk = *link;
+        const uint8_t last_page = ((blk->pc + blk->sizeb - 1) >> 8);
+
+        if (start_page == page || last_page == page) {
+            blk->valid = 0;
+            cache->map[blk->pc] = NULL;
+            *link = blk->next;
+        } else {
+            link = &blk->next;
+        }
+    }
+}
+
+/* page is a canonical page, blocks are keyed by guest address so every
+   mirror of it is dropped as well */
+void i8080_bbcache_invalidate_page (struct i8080_state* state, const uint8_t page)
+{
+    struct i8080_bbcache* cache = state->bbcache;
+    uint8_t guest = page;
+
+    if (cache) {
+        do {
+            drop_blocks (cache, guest, guest);
+            drop_blocks (cache, (uint8_t)(guest - 1), guest);
+            guest = state->alias_next[guest];
+        } while (guest != page);
+    }
+    i8080_watch_clear (state, page, I8080_WATCH_CODE);
+}
+
+/* arena full: throw away all blocks, only done between blocks */
+static void flush (struct i8080_state* state)
+{
+    struct i8080_bbcache* cache = state->bbcache;
+    int page;
+
+    for (page = 0; page < 256; page++) {
+        if (state->canon[page] == page)
+            i8080_bbcache_invalidate_page (state, page);
+    }
+    cache->used = 0;
+}
+
+/* byte at addr if it lives in a readable host page */
+static inline int code_byte (const struct i8080_state* state, const uint16_t addr)
+{
+    const uint8_t* const p = state->rd[addr >> 8];
+
+    return p ? p[addr & 0xff] : -1;
+}
+
+/* NULL if the first instruction is not entirely in readable host pages */
+static struct bb_block* translate (struct i8080_state* state, const uint16_t pc)
+{
+    struct i8080_bbcache* cache = state->bbcache;
+    struct bb_block* blk;
+    uint16_t addr = pc;
+    uint8_t info;
+    int page;
+    int n = 0;
+
+    if (cache->used + sizeof(struct bb_block) + (BB_MAX_INSTR * sizeof(struct bb_entry)) > BB_ARENA_SIZEB)
+        flush (state);
+    blk = (struct bb_block*)&cache->arena[cache->used];
+
+    do {
+        const int opcode = code_byte (state, addr);
+        int lo = 0;
+        int hi = 0;
+        struct bb_entry* e;
+
+        if (opcode < 0)
+            break;
+        if (i8080_length[opcode] > 1 && (lo = code_byte (state, addr + 1)) < 0)
+            break;
+        if (i8080_length[opcode] > 2 && (hi = code_byte (state, addr + 2)) < 0)
+            break;
+
+        e = &blk->e[n++];
+        info = cache->info[opcode];
+        e->fn = i8080_op_table[opcode];
+        e->arg = (lo | (hi << 8));
+        e->cycles = i8080_cycles[opcode];
+        e->opcode = opcode;
+        e->flags = (info & BB_WRITES);
+        addr += i8080_length[opcode];
+    } while (!(info & BB_END) && n < BB_MAX_INSTR);
+
+    if (n == 0)
+        return NULL;
+
+    blk->pc = pc;
+    blk->sizeb = (uint16_t)(addr - pc);
+    blk->valid = 1;
+    blk->count = n;
+    cache->used += sizeof(struct bb_block) + (n * sizeof(struct bb_entry));
+
+    blk->next = cache->page[pc >> 8];
+    cache->page[pc >> 8] = blk;
+    cache->map[pc] = blk;
+
+    for (page = (pc >> 8); page <= ((pc + blk->sizeb - 1) >> 8); page++)
+        i8080_watch_set (state, (page & 0xff), I8080_WATCH_CODE);
+
+    return blk;
+}
+
+/* Same contract as the inner loop of the threaded engine: the cycle budget,
+   trace and instr_func callback are still checked before every instruction,
+   only the fetch and decode are taken from the cache. */
+static inline __attribute__((always_inline)) int run_loop (struct i8080_state* state, const int check_instr_func, const int trace,
+                                                           const int profile)
+{
+    struct i8080_bbcache* const cache = state->bbcache;
+
+    while (state->cycles < state->run_until) {
+        struct bb_block* blk = cache->map[state->pc];
+        const struct bb_entry* e;
+        const struct bb_entry* end;
+
+        if (i8080_unlikely (blk == NULL)) {
+            blk = translate (state, state->pc);
+
+            /* code in MMIO, does its own trace and instr_func */
+            if (blk == NULL) {
+                const int rc = i8080_exec_threaded (state);
+
+                if (rc != 0)
+                    return rc;
+                continue;
+            }
+        }
+
+        for (e = blk->e, end = &blk->e[blk->count]; e != end; e++) {
+            uint16_t pc;
+            uint64_t cycles;
+            int rc;
+
+            if (i8080_unlikely (state->cycles >= state->run_until))
+                return 0;
+
+            if (trace)
+                i8080_trace_state (state->trace, state);
+
+            /* the callback may have moved the PC, look the block up again */
+            if (check_instr_func && !state->instr_func (state))
+                break;
+
+            pc = state->pc;
+            cycles = state->cycles;
+            state->cycles += e->cycles;
+            state->instructions++;
+
+            rc = e->fn (state, e->arg);
+            if (profile)
+                i8080_profile_count (state, e->opcode, pc, cycles);
+            if (i8080_unlikely (rc != 0))
+                return rc;
+
+            /* the block just overwrote itself, continue from the new bytes */
+            if ((e->flags & BB_WRITES) && i8080_unlikely (!blk->valid))
+                break;
+        }
+    }
+
+    return 0;
+}
+
+int i8080_run_bbcache (struct i8080_state* state)
+{
+    if (state->profile)
+        return run_loop (state, (state->instr_func != NULL), (state->trace != NULL), 1);
+
+    if (state->trace) {
+        if (state->instr_func)
+            return run_loop (state, 1, 1, 0);
+        return run_loop (state, 0, 1, 0);
+    }
+
+    if (state->instr_func)
+        return run_loop (state, 1, 0, 0);
+    return run_loop (state, 0, 0, 0);
+}
@@ -0,0 +1,159 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Event queue.
+
+  A binary min-heap in state->event[] ordered on (when, seq), seq being a
+  per state counter so that events due at the same cycle run in the order
+  they were scheduled. i8080_run() only ends its inner loops at the next
+  deadline (state->run_until), so the queue costs nothing per
+  instruction.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "i8080_internal.h"
+
+static int before (const struct i8080_event* a, const struct i8080_event* b)
+{
+    return (a->when < b->when) || (a->when == b->when && a->seq < b->seq);
+}
+
+static void sift_up (struct i8080_state* state, int i)
+{
+    struct i8080_event ev = state->event[i];
+
+    while (i > 0) {
+        const int parent = (i - 1) / 2;
+
+        if (!before (&ev, &state->event[parent]))
+            break;
+        state->event[i] = state->event[parent];
+        i = parent;
+    }
+    state->event[i] = ev;
+}
+
+static void sift_down (struct i8080_state* state, int i)
+{
+    struct i8080_event ev = state->event[i];
+
+    for (;;) {
+        int child = (2 * i) + 1;
+
+        if (child >= state->event_count)
+            break;
+        if ((child + 1) < state->event_count && before (&state->event[child + 1], &state->event[child]))
+            child++;
+        if (!before (&state->event[child], &ev))
+            break;
+        state->event[i] = state->event[child];
+        i = child;
+    }
+    state->event[i] = ev;
+}
+
+/* remove event i, keeping the heap order */
+static void remove_at (struct i8080_state* state, const int i)
+{
+    state->event_count--;
+    if (i == state->event_count)
+        return;
+
+    state->event[i] = state->event[state->event_count];
+    if (i > 0 && before (&state->event[i], &state->event[(i - 1) / 2]))
+        sift_up (state, i);
+    else
+        sift_down (state, i);
+}
+
+int i8080_schedule (struct i8080_state* state, const uint64_t when, i8080_event_fn_t fn, void* ctx)
+{
+    struct i8080_event* ev;
+
+    if (state->event_count == I8080_EVENTS_MAX) {
+        fprintf (stderr, "Error: event queue full\n");
+        return -1;
+    }
+
+    ev = &state->event[state->event_count];
+    ev->when = when;
+    ev->seq = state->event_seq++;
+    ev->fn = fn;
+    ev->ctx = ctx;
+    sift_up (state, state->event_count++);
+
+    /* an i8080_run() in progress has to end its inner loop earlier */
+    if (when < state->run_until)
+        state->run_until = when;
+    return 0;
+}
+
+static void event_interrupt (struct i8080_state* state, void* ctx, const uint64_t when)
+{
+    (void)when;
+    i8080_interrupt (state, (uint8_t)(uintptr_t)ctx);
+}
+
+int i8080_schedule_interrupt (struct i8080_state* state, const uint64_t when, const uint8_t nnn)
+{
+    return i8080_schedule (state, when, event_interrupt, (void*)(uintptr_t)nnn);
+}
+
+int i8080_cancel (struct i8080_state* state, i8080_event_fn_t fn, void* ctx)
+{
+    int removed = 0;
+    int i = 0;
+
+    while (i < state->event_count) {
+        if (state->event[i].fn == fn && state->event[i].ctx == ctx) {
+            remove_at (state, i);
+            removed++;
+            /* the moved event may have sifted to an index below i */
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    return removed;
+}
+
+uint64_t i8080_next_event (const struct i8080_state* state)
+{
+    return state->event_count ? state->event[0].when : UINT64_MAX;
+}
+
+void i8080_run_events (struct i8080_state* state)
+{
+    while (state->event_count && state->event[0].when <= state->cycles) {
+        const struct i8080_event ev = state->event[0];
+
+        /* off the queue before the callback, which may reschedule itself */
+        remove_at (state, 0);
+        ev.fn (state, ev.ctx, ev.when);
+    }
+}
@@ -0,0 +1,208 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/* Helpers shared by the execution engines, not part of the public API. */
+
+#ifndef __I8080_INTERNAL_H__
+#define __I8080_INTERNAL_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "i8080.h"
+#include "i8080_trace.h"
+
+#if defined(__GNUC__)
+#define i8080_likely(x)   __builtin_expect(!!(x), 1)
+#define i8080_unlikely(x) __builtin_expect(!!(x), 0)
+#else
+#define i8080_likely(x)   (x)
+#define i8080_unlikely(x) (x)
+#endif
+
+/* handler for one opcode, arg holds the (up to) two bytes following the opcode */
+typedef int (*i8080_op_fn_t)(struct i8080_state* state, const uint16_t arg);
+
+/* T-states per opcode, conditional CALL/RET as not taken */
+extern const uint8_t i8080_cycles[256];
+
+/* extra T-states of a taken conditional CALL (11 -> 17) or RET (5 -> 11) */
+#define I8080_CYCLES_TAKEN 6
+
+/* handlers of the threaded engine, also replayed by the block cache */
+extern const i8080_op_fn_t i8080_op_table[256];
+
+int i8080_exec_threaded (struct i8080_state* state);
+int i8080_run_threaded (struct i8080_state* state);
+
+/* block cache engine, see i8080_bbcache.c */
+struct i8080_bbcache* i8080_bbcache_create (void);
+void i8080_bbcache_destroy (struct i8080_bbcache* cache);
+void i8080_bbcache_invalidate_page (struct i8080_state* state, const uint8_t page);
+int i8080_run_bbcache (struct i8080_state* state);
+
+/* run the events due at state->cycles, see i8080_event.c */
+void i8080_run_events (struct i8080_state* state);
+
+/* an interrupt delivered while state->replay is set, see i8080_replay.c */
+void i8080_replay_interrupt (struct i8080_state* state, const uint8_t nnn);
+
+/* state->watch[] bits, kept on the canonical page (state->canon[]) of
+   each host page; a store to a page with any bit set takes the slow path */
+#define I8080_WATCH_CODE  0x01 /* page holds translated code */
+#define I8080_WATCH_CLEAN 0x02 /* page not written since the last i8080_reset() */
+#define I8080_WATCH_SNAP  0x04 /* page unchanged since the last snapshot or restore */
+
+void i8080_watch_write (struct i8080_state* state, const uint16_t addr);
+void i8080_watch_set (struct i8080_state* state, const uint8_t page, const uint8_t bits);
+void i8080_watch_clear (struct i8080_state* state, const uint8_t page, const uint8_t bits);
+
+uint8_t i8080_read_slow (struct i8080_state* state, const uint16_t addr);
+void i8080_write_slow (struct i8080_state* state, const uint16_t addr, const uint8_t val);
+
+/* guest load and store through the memory map; the fast path is one page
+   table lookup, MMIO, ROM and watched pages take the slow path (which
+   runs before the byte changes) */
+static inline uint8_t i8080_rd (struct i8080_state* state, const uint16_t addr)
+{
+    const uint8_t* const p = state->rd[addr >> 8];
+
+    if (i8080_likely (p != NULL))
+        return p[addr & 0xff];
+    return i8080_read_slow (state, addr);
+}
+
+static inline void i8080_wr (struct i8080_state* state, const uint16_t addr, const uint8_t val)
+{
+    uint8_t* const p = state->wr[addr >> 8];
+
+    if (i8080_likely (p != NULL))
+        p[addr & 0xff] = val;
+    else
+        i8080_write_slow (state, addr, val);
+}
+
+/* i8080_state.port_set[] bits */
+#define I8080_PORT_IN  0x01
+#define I8080_PORT_OUT 0x02
+
+/* IN and OUT, one indirect call through the port table */
+static inline uint8_t i8080_in (struct i8080_state* state, const uint8_t port)
+{
+    const struct i8080_in_port* const p = &state->in_port[port];
+
+    return p->fn (p->ctx, port);
+}
+
+static inline void i8080_out (struct i8080_state* state, const uint8_t port, const uint8_t byte)
+{
+    const struct i8080_out_port* const p = &state->out_port[port];
+
+    p->fn (p->ctx, port, byte);
+}
+
+/* instruction length in bytes, per opcode */
+extern const uint8_t i8080_length[256];
+
+/* Opcode at the PC plus its operand bytes in *arg. An instruction that
+   lies within one readable page is read straight from the host page,
+   otherwise only the bytes the instruction has go through i8080_rd(), so
+   MMIO behind the last byte is never touched. */
+static inline uint8_t i8080_fetch (struct i8080_state* state, uint16_t* arg)
+{
+    const uint16_t pc = state->pc;
+    const uint8_t* const p = state->rd[pc >> 8];
+    uint8_t opcode;
+
+    if (i8080_likely (p != NULL && (pc & 0xff) < 0xfe)) {
+        const uint8_t* const op = &p[pc & 0xff];
+
+        *arg = (op[1] | (op[2] << 8));
+        return op[0];
+    }
+
+    opcode = i8080_rd (state, pc);
+    *arg = 0;
+    if (i8080_length[opcode] > 1)
+        *arg |= i8080_rd (state, pc + 1);
+    if (i8080_length[opcode] > 2)
+        *arg |= (i8080_rd (state, pc + 2) << 8);
+    return opcode;
+}
+
+/* count the instruction that started at pc with the given cycle count */
+static inline void i8080_profile_count (struct i8080_state* state, const uint8_t opcode,
+                                        const uint16_t pc, const uint64_t cycles)
+{
+    struct i8080_profile_entry* const e = &state->profile->op[opcode];
+    struct i8080_profile_pc* const hist = state->profile->pc;
+
+    e->count++;
+    e->cycles += (state->cycles - cycles);
+    e->taken += (state->pc != (uint16_t)(pc + i8080_length[opcode]));
+
+    if (hist) {
+        hist[pc].count++;
+        hist[pc].cycles += (state->cycles - cycles);
+    }
+}
+
+/* S, Z and P for every 8-bit result, see i8080.c */
+extern const uint8_t i8080_szp[256];
+
+#define I8080_CY(state) ((state)->f & I8080_FLAG_CY)
+
+/* AC and CY land on their PSW bit positions straight from the operands:
+   bit 4 of (dst ^ result ^ src) is the carry into bit 4, and bit 8 of the
+   16-bit result is the carry (or borrow) out of bit 7 */
+static inline void i8080_update_flags (struct i8080_state* state, uint16_t result, int8_t dst, int8_t src)
+{
+    state->f = (i8080_szp[result & 0xff] |
+                ((dst ^ result ^ src) & I8080_FLAG_AC) |
+                ((result >> 8) & I8080_FLAG_CY) |
+                I8080_FLAG_ONE);
+}
+
+static inline void i8080_set_flag (struct i8080_state* state, const uint8_t flag, const int set)
+{
+    if (set)
+        state->f |= flag;
+    else
+        state->f &= ~flag;
+}
+
+static inline uint16_t i8080_bc (const struct i8080_state* state)
+{
+    return ((uint16_t)state->b << 8) | state->c;
+}
+
+static inline uint16_t i8080_de (const struct i8080_state* state)
+{
+    return ((uint16_t)state->d << 8) | state->e;
+}
+
+static inline uint16_t i8080_hl (const struct i8080_state* state)
+{
+    return ((uint16_t)state->h << 8) | state->l;
+}
+
+#endif /*  __I8080_INTERNAL_H__ */
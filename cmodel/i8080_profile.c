@@ -0,0 +1,226 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Opcode profile.
+
+  The engines add to state->profile->op[opcode] (and the PC histogram if
+  enabled) after every instruction while a profile is set; their inner
+  loops are instantiated with and without the counting, so an unset
+  profile costs nothing per instruction.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "i8080.h"
+#include "i8080_internal.h"
+
+static const char* const mnemonic[256] = {
+    "nop",     "lxi b",   "stax b",  "inx b",   "inr b",   "dcr b",   "mvi b",   "rlc",     /* 00 */
+    "-",       "dad b",   "ldax b",  "dcx b",   "inr c",   "dcr c",   "mvi c",   "rrc",
+    "-",       "lxi d",   "stax d",  "inx d",   "inr d",   "dcr d",   "mvi d",   "ral",     /* 10 */
+    "-",       "dad d",   "ldax d",  "dcx d",   "inr e",   "dcr e",   "mvi e",   "rar",
+    "-",       "lxi h",   "shld",    "inx h",   "inr h",   "dcr h",   "mvi h",   "daa",     /* 20 */
+    "-",       "dad h",   "lhld",    "dcx h",   "inr l",   "dcr l",   "mvi l",   "cma",
+    "-",       "lxi sp",  "sta",     "inx sp",  "inr m",   "dcr m",   "mvi m",   "stc",     /* 30 */
+    "-",       "dad sp",  "lda",     "dcx sp",  "inr a",   "dcr a",   "mvi a",   "cmc",
+    "mov b,b", "mov b,c", "mov b,d", "mov b,e", "mov b,h", "mov b,l", "mov b,m", "mov b,a", /* 40 */
+    "mov c,b", "mov c,c", "mov c,d", "mov c,e", "mov c,h", "mov c,l", "mov c,m", "mov c,a",
+    "mov d,b", "mov d,c", "mov d,d", "mov d,e", "mov d,h", "mov d,l", "mov d,m", "mov d,a", /* 50 */
+    "mov e,b", "mov e,c", "mov e,d", "mov e,e", "mov e,h", "mov e,l", "mov e,m", "mov e,a",
+    "mov h,b", "mov h,c", "mov h,d", "mov h,e", "mov h,h", "mov h,l", "mov h,m", "mov h,a", /* 60 */
+    "mov l,b", "mov l,c", "mov l,d", "mov l,e", "mov l,h", "mov l,l", "mov l,m", "mov l,a",
+    "mov m,b", "mov m,c", "mov m,d", "mov m,e", "mov m,h", "mov m,l", "hlt",     "mov m,a", /* 70 */
+    "mov a,b", "mov a,c", "mov a,d", "mov a,e", "mov a,h", "mov a,l", "mov a,m", "mov a,a",
+    "add b",   "add c",   "add d",   "add e",   "add h",   "add l",   "add m",   "add a",   /* 80 */
+    "adc b",   "adc c",   "adc d",   "adc e",   "adc h",   "adc l",   "adc m",   "adc a",
+    "sub b",   "sub c",   "sub d",   "sub e",   "sub h",   "sub l",   "sub m",   "sub a",   /* 90 */
+    "sbb b",   "sbb c",   "sbb d",   "sbb e",   "sbb h",   "sbb l",   "sbb m",   "sbb a",
+    "ana b",   "ana c",   "ana d",   "ana e",   "ana h",   "ana l",   "ana m",   "ana a",   /* a0 */
+    "xra b",   "xra c",   "xra d",   "xra e",   "xra h",   "xra l",   "xra m",   "xra a",
+    "ora b",   "ora c",   "ora d",   "ora e",   "ora h",   "ora l",   "ora m",   "ora a",   /* b0 */
+    "cmp b",   "cmp c",   "cmp d",   "cmp e",   "cmp h",   "cmp l",   "cmp m",   "cmp a",
+    "rnz",     "pop b",   "jnz",     "jmp",     "cnz",     "push b",  "adi",     "rst 0",   /* c0 */
+    "rz",      "ret",     "jz",      "-",       "cz",      "call",    "aci",     "rst 1",
+    "rnc",     "pop d",   "jnc",     "out",     "cnc",     "push d",  "sui",     "rst 2",   /* d0 */
+    "rc",      "-",       "jc",      "in",      "cc",      "-",       "sbi",     "rst 3",
+    "rpo",     "pop h",   "jpo",     "xthl",    "cpo",     "push h",  "ani",     "rst 4",   /* e0 */
+    "rpe",     "pchl",    "jpe",     "xchg",    "cpe",     "-",       "xri",     "rst 5",
+    "rp",      "pop psw", "jp",      "di",      "cp",      "push psw","ori",     "rst 6",   /* f0 */
+    "rm",      "sphl",    "jm",      "ei",      "cm",      "-",       "cpi",     "rst 7",
+};
+
+struct i8080_profile* i8080_profile_create (void)
+{
+    struct i8080_profile* profile;
+
+    profile = aligned_alloc (64, sizeof(struct i8080_profile));
+    if (profile == NULL)
+        return NULL;
+    profile->pc = NULL;
+    i8080_profile_reset (profile);
+    return profile;
+}
+
+void i8080_profile_destroy (struct i8080_profile* profile)
+{
+    if (profile) {
+        free (profile->pc);
+        free (profile);
+    }
+}
+
+void i8080_profile_reset (struct i8080_profile* profile)
+{
+    memset (profile->op, 0, sizeof(profile->op));
+    if (profile->pc)
+        memset (profile->pc, 0, 0x10000 * sizeof(struct i8080_profile_pc));
+}
+
+int i8080_profile_enable_pc (struct i8080_profile* profile)
+{
+    if (profile->pc == NULL) {
+        profile->pc = calloc (0x10000, sizeof(struct i8080_profile_pc));
+        if (profile->pc == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+void i8080_set_profile (struct i8080_state* state, struct i8080_profile* profile)
+{
+    state->profile = profile;
+}
+
+/* Jcc, Ccc and Rcc, the opcodes with a taken and a not taken path */
+static int conditional (const int op)
+{
+    return ((op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4 || (op & 0xc7) == 0xc0);
+}
+
+static FILE* open_dump (const char* const filename)
+{
+    FILE* fp = fopen (filename, "w");
+
+    if (fp == NULL)
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+    return fp;
+}
+
+static int close_dump (FILE* fp, const char* const filename)
+{
+    if (ferror (fp) | fclose (fp)) {
+        fprintf (stderr, "Error: unable to write %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+int i8080_profile_write_csv (const struct i8080_profile* profile, const char* const filename)
+{
+    FILE* fp;
+    int i;
+
+    if (NULL == (fp = open_dump (filename)))
+        return -1;
+
+    fprintf (fp, "opcode,mnemonic,count,cycles,taken,not_taken\n");
+    for (i = 0; i < 256; i++) {
+        const struct i8080_profile_entry* e = &profile->op[i];
+
+        if (e->count == 0)
+            continue;
+        fprintf (fp, "0x%02x,%s,%llu,%llu,", i, mnemonic[i],
+                 (unsigned long long)e->count, (unsigned long long)e->cycles);
+        if (conditional (i))
+            fprintf (fp, "%llu,%llu\n", (unsigned long long)e->taken, (unsigned long long)(e->count - e->taken));
+        else
+            fprintf (fp, ",\n");
+    }
+
+    return close_dump (fp, filename);
+}
+
+int i8080_profile_write_json (const struct i8080_profile* profile, const char* const filename)
+{
+    uint64_t count = 0;
+    uint64_t cycles = 0;
+    const char* sep = "";
+    FILE* fp;
+    int i;
+
+    if (NULL == (fp = open_dump (filename)))
+        return -1;
+
+    for (i = 0; i < 256; i++) {
+        count += profile->op[i].count;
+        cycles += profile->op[i].cycles;
+    }
+
+    fprintf (fp, "{\n  \"instructions\": %llu,\n  \"cycles\": %llu,\n  \"opcodes\": [",
+             (unsigned long long)count, (unsigned long long)cycles);
+    for (i = 0; i < 256; i++) {
+        const struct i8080_profile_entry* e = &profile->op[i];
+
+        if (e->count == 0)
+            continue;
+        fprintf (fp, "%s\n    { \"opcode\": %d, \"mnemonic\": \"%s\", \"count\": %llu, \"cycles\": %llu",
+                 sep, i, mnemonic[i], (unsigned long long)e->count, (unsigned long long)e->cycles);
+        if (conditional (i))
+            fprintf (fp, ", \"taken\": %llu, \"not_taken\": %llu",
+                     (unsigned long long)e->taken, (unsigned long long)(e->count - e->taken));
+        fprintf (fp, " }");
+        sep = ",";
+    }
+    fprintf (fp, "\n  ]\n}\n");
+
+    return close_dump (fp, filename);
+}
+
+int i8080_profile_write_pc_csv (const struct i8080_profile* profile, const char* const filename)
+{
+    FILE* fp;
+    int i;
+
+    if (profile->pc == NULL) {
+        fprintf (stderr, "Error: PC histogram not enabled\n");
+        return -1;
+    }
+    if (NULL == (fp = open_dump (filename)))
+        return -1;
+
+    fprintf (fp, "pc,count,cycles\n");
+    for (i = 0; i < 0x10000; i++) {
+        const struct i8080_profile_pc* e = &profile->pc[i];
+
+        if (e->count == 0)
+            continue;
+        fprintf (fp, "0x%04x,%llu,%llu\n", i, (unsigned long long)e->count, (unsigned long long)e->cycles);
+    }
+
+    return close_dump (fp, filename);
+}
@@ -0,0 +1,488 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Record and replay of IN values and interrupts, see i8080_replay.h.
+
+  Recording wraps the IN port table (the wrapped handlers are kept in the
+  replay) and i8080_interrupt() calls i8080_replay_interrupt() while
+  state->replay is set, so neither costs anything per instruction. Playing
+  answers every port from the log and keeps the next interrupt of the log
+  on the event queue.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "i8080.h"
+#include "i8080_internal.h"
+#include "i8080_replay.h"
+
+#define REPLAY_BUFFER_SIZEB (1024*1024)
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME  0x100000001b3ull
+
+static void put_le (uint8_t* p, uint64_t val, const int sizeb)
+{
+    int i;
+
+    for (i = 0; i < sizeb; i++, val >>= 8)
+        p[i] = (val & 0xff);
+}
+
+static uint64_t get_le (const uint8_t* p, const int sizeb)
+{
+    uint64_t val = 0;
+    int i;
+
+    for (i = sizeb - 1; i >= 0; i--)
+        val = ((val << 8) | p[i]);
+    return val;
+}
+
+static uint64_t fnv (uint64_t hash, const uint8_t* p, const size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    return hash;
+}
+
+uint64_t i8080_replay_hash (struct i8080_state* state)
+{
+    const uint8_t regs[14] = {
+        state->a, state->b, state->c, state->d, state->e, state->h, state->l,
+        state->i, state->f, state->halted,
+        state->sp >> 8, state->sp & 0xff, state->pc >> 8, state->pc & 0xff
+    };
+    uint64_t hash = fnv (FNV_OFFSET, regs, sizeof(regs));
+    int page;
+
+    /* MMIO is left out, reading it may have side effects */
+    for (page = 0; page < 256; page++) {
+        const struct i8080_page* p = &state->page[page];
+        const uint8_t mapped = (p->host && (p->perm & I8080_PAGE_READ));
+
+        hash = fnv (hash, &mapped, 1);
+        if (mapped)
+            hash = fnv (hash, p->host, 0x100);
+    }
+    return hash;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Log file                                                                   */
+/*----------------------------------------------------------------------------*/
+static int write_header (FILE* fp, const struct i8080_replay_header* h)
+{
+    uint8_t p[I8080_REPLAY_HEADER_SIZEB];
+
+    memset (p, 0, sizeof(p));
+    memcpy (p, I8080_REPLAY_MAGIC, 4);
+    put_le (&p[4], I8080_REPLAY_VERSION, 4);
+    memcpy (&p[8], h->machine, I8080_REPLAY_MACHINE_SIZEB);
+    put_le (&p[24], h->start_instructions, 8);
+    put_le (&p[32], h->start_cycles, 8);
+    put_le (&p[40], h->start_hash, 8);
+    put_le (&p[48], h->end_instructions, 8);
+    put_le (&p[56], h->end_cycles, 8);
+    put_le (&p[64], h->end_hash, 8);
+    put_le (&p[72], h->items, 8);
+    return (fwrite (p, sizeof(p), 1, fp) == 1) ? 0 : -1;
+}
+
+static int read_header (FILE* fp, const char* const filename, struct i8080_replay_header* h)
+{
+    uint8_t p[I8080_REPLAY_HEADER_SIZEB];
+
+    if (fread (p, sizeof(p), 1, fp) != 1 || memcmp (p, I8080_REPLAY_MAGIC, 4)) {
+        fprintf (stderr, "Error: %s is not a replay log\n", filename);
+        return -1;
+    }
+    if (get_le (&p[4], 4) != I8080_REPLAY_VERSION) {
+        fprintf (stderr, "Error: %s has replay log version %u\n", filename, (unsigned)get_le (&p[4], 4));
+        return -1;
+    }
+    memcpy (h->machine, &p[8], I8080_REPLAY_MACHINE_SIZEB);
+    h->machine[I8080_REPLAY_MACHINE_SIZEB - 1] = '\0';
+    h->start_instructions = get_le (&p[24], 8);
+    h->start_cycles = get_le (&p[32], 8);
+    h->start_hash = get_le (&p[40], 8);
+    h->end_instructions = get_le (&p[48], 8);
+    h->end_cycles = get_le (&p[56], 8);
+    h->end_hash = get_le (&p[64], 8);
+    h->items = get_le (&p[72], 8);
+    return 0;
+}
+
+int i8080_replay_info (const char* const filename, struct i8080_replay_header* header)
+{
+    FILE* fp;
+    int rc;
+
+    if (NULL == (fp = fopen (filename, "rb"))) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+        return -1;
+    }
+    rc = read_header (fp, filename, header);
+    fclose (fp);
+    return rc;
+}
+
+static size_t put_varint (uint8_t* p, uint64_t val)
+{
+    size_t n = 0;
+
+    while (val >= 0x80) {
+        p[n++] = (val & 0x7f) | 0x80;
+        val >>= 7;
+    }
+    p[n++] = val;
+    return n;
+}
+
+static int get_varint (FILE* fp, uint64_t* val)
+{
+    int shift;
+    int ch;
+
+    *val = 0;
+    for (shift = 0; shift < 64; shift += 7) {
+        if ((ch = getc (fp)) == EOF)
+            return -1;
+        *val |= (uint64_t)(ch & 0x7f) << shift;
+        if (!(ch & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Record                                                                     */
+/*----------------------------------------------------------------------------*/
+static void write_item (struct i8080_replay* replay, const int kind, const uint8_t x, const uint8_t y)
+{
+    struct i8080_state* const state = replay->state;
+    uint8_t p[24];
+    size_t n = 0;
+
+    p[n++] = kind;
+    n += put_varint (&p[n], state->instructions - replay->instructions);
+    if (kind == I8080_REPLAY_INTERRUPT) {
+        n += put_varint (&p[n], state->cycles - replay->cycles);
+        replay->cycles = state->cycles;
+    }
+    p[n++] = x;
+    if (kind == I8080_REPLAY_IN)
+        p[n++] = y;
+    fwrite (p, n, 1, replay->fp);
+
+    replay->instructions = state->instructions;
+    replay->items++;
+}
+
+static uint8_t record_in (void* ctx, const uint8_t port)
+{
+    struct i8080_replay* replay = ctx;
+    const struct i8080_in_port* const p = &replay->in_port[port];
+    const uint8_t value = p->fn (p->ctx, port);
+
+    write_item (replay, I8080_REPLAY_IN, port, value);
+    return value;
+}
+
+struct i8080_replay* i8080_replay_record (struct i8080_state* state, const char* const filename,
+                                          const char* const machine)
+{
+    struct i8080_replay* replay;
+    int port;
+
+    if (state->replay) {
+        fprintf (stderr, "Error: state is already recording or replaying\n");
+        return NULL;
+    }
+    if (NULL == (replay = calloc (1, sizeof(struct i8080_replay))))
+        return NULL;
+    if (NULL == (replay->fp = fopen (filename, "wb"))) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+        free (replay);
+        return NULL;
+    }
+    setvbuf (replay->fp, NULL, _IOFBF, REPLAY_BUFFER_SIZEB);
+
+    replay->state = state;
+    replay->mode = I8080_REPLAY_RECORD;
+    strncpy (replay->header.machine, machine, I8080_REPLAY_MACHINE_SIZEB - 1);
+    replay->header.start_instructions = state->instructions;
+    replay->header.start_cycles = state->cycles;
+    replay->header.start_hash = i8080_replay_hash (state);
+    replay->instructions = state->instructions;
+    replay->cycles = state->cycles;
+
+    /* end fields 0 until i8080_replay_close() rewrites the header */
+    if (write_header (replay->fp, &replay->header) < 0) {
+        fprintf (stderr, "Error: replay log write failed : %s\n", strerror(errno));
+        fclose (replay->fp);
+        free (replay);
+        return NULL;
+    }
+
+    for (port = 0; port < 256; port++) {
+        replay->in_port[port] = state->in_port[port];
+        state->in_port[port].fn = record_in;
+        state->in_port[port].ctx = replay;
+    }
+    state->replay = replay;
+    return replay;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Play                                                                       */
+/*----------------------------------------------------------------------------*/
+static void diverge (struct i8080_replay* replay, const char* const what)
+{
+    struct i8080_state* const state = replay->state;
+
+    if (replay->diverged)
+        return;
+    replay->diverged = 1;
+
+    fprintf (stderr, "Error: replay diverged at instruction %llu cycle %llu, %s; ",
+             (unsigned long long)state->instructions, (unsigned long long)state->cycles, what);
+    if (replay->kind == I8080_REPLAY_IN)
+        fprintf (stderr, "the log has IN %02xh at instruction %llu\n", replay->next_port,
+                 (unsigned long long)replay->next_instructions);
+    else if (replay->kind == I8080_REPLAY_INTERRUPT)
+        fprintf (stderr, "the log has RST %d at instruction %llu cycle %llu\n", replay->next_value,
+                 (unsigned long long)replay->next_instructions, (unsigned long long)replay->next_cycles);
+    else
+        fprintf (stderr, "the log has ended\n");
+    i8080_stop (state);
+}
+
+static void replay_event (struct i8080_state* state, void* ctx, const uint64_t when);
+
+/* read the next item, an interrupt goes on the event queue */
+static void next_item (struct i8080_replay* replay)
+{
+    uint64_t delta;
+    int kind;
+    int port = 0;
+    int value;
+
+    replay->kind = 0;
+    if ((kind = getc (replay->fp)) == EOF)
+        return;
+    if ((kind != I8080_REPLAY_IN && kind != I8080_REPLAY_INTERRUPT) || get_varint (replay->fp, &delta) < 0)
+        goto malformed;
+    replay->next_instructions = replay->instructions + delta;
+    if (kind == I8080_REPLAY_INTERRUPT) {
+        if (get_varint (replay->fp, &delta) < 0)
+            goto malformed;
+        replay->next_cycles = replay->cycles + delta;
+    }
+    if (kind == I8080_REPLAY_IN && (port = getc (replay->fp)) == EOF)
+        goto malformed;
+    if ((value = getc (replay->fp)) == EOF)
+        goto malformed;
+    replay->next_port = port;
+    replay->next_value = value;
+    replay->kind = kind;
+
+    if (kind == I8080_REPLAY_INTERRUPT &&
+        i8080_schedule (replay->state, replay->next_cycles, replay_event, replay) < 0)
+        diverge (replay, "no room on the event queue");
+    return;
+
+malformed:
+    fprintf (stderr, "Error: replay log is truncated or malformed after %llu items\n",
+             (unsigned long long)replay->items);
+    diverge (replay, "log read failed");
+}
+
+static void consume (struct i8080_replay* replay)
+{
+    replay->instructions = replay->next_instructions;
+    if (replay->kind == I8080_REPLAY_INTERRUPT)
+        replay->cycles = replay->next_cycles;
+    replay->items++;
+    next_item (replay);
+}
+
+static uint8_t replay_in (void* ctx, const uint8_t port)
+{
+    struct i8080_replay* replay = ctx;
+    const uint8_t value = replay->next_value;
+
+    if (replay->diverged)
+        return 0xff;
+    if (replay->kind != I8080_REPLAY_IN || replay->next_instructions != replay->state->instructions ||
+        replay->next_port != port) {
+        char what[32];
+
+        snprintf (what, sizeof(what), "IN %02xh", port);
+        diverge (replay, what);
+        return 0xff;
+    }
+    consume (replay);
+    return value;
+}
+
+static void replay_event (struct i8080_state* state, void* ctx, const uint64_t when)
+{
+    struct i8080_replay* replay = ctx;
+    const uint8_t nnn = replay->next_value;
+
+    (void)when;
+    if (replay->diverged)
+        return;
+    if (state->instructions != replay->next_instructions || state->cycles != replay->next_cycles || !state->i) {
+        diverge (replay, state->i ? "RST due" : "RST due with interrupts disabled");
+        return;
+    }
+    /* the next interrupt may be due at this cycle as well, it is
+       scheduled behind this one */
+    consume (replay);
+    replay->delivering = 1;
+    i8080_interrupt (state, nnn);
+    replay->delivering = 0;
+}
+
+struct i8080_replay* i8080_replay_play (struct i8080_state* state, const char* const filename)
+{
+    struct i8080_replay* replay;
+    int port;
+
+    if (state->replay) {
+        fprintf (stderr, "Error: state is already recording or replaying\n");
+        return NULL;
+    }
+    if (NULL == (replay = calloc (1, sizeof(struct i8080_replay))))
+        return NULL;
+    if (NULL == (replay->fp = fopen (filename, "rb"))) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+        free (replay);
+        return NULL;
+    }
+    setvbuf (replay->fp, NULL, _IOFBF, REPLAY_BUFFER_SIZEB);
+
+    if (read_header (replay->fp, filename, &replay->header) < 0)
+        goto fail;
+    if (state->instructions != replay->header.start_instructions || state->cycles != replay->header.start_cycles ||
+        i8080_replay_hash (state) != replay->header.start_hash) {
+        fprintf (stderr, "Error: the state differs from the start of %s (a %s log)\n", filename,
+                 replay->header.machine);
+        goto fail;
+    }
+
+    replay->state = state;
+    replay->mode = I8080_REPLAY_PLAY;
+    replay->instructions = state->instructions;
+    replay->cycles = state->cycles;
+    for (port = 0; port < 256; port++) {
+        replay->in_port[port] = state->in_port[port];
+        state->in_port[port].fn = replay_in;
+        state->in_port[port].ctx = replay;
+    }
+    state->replay = replay;
+    next_item (replay);
+    return replay;
+
+fail:
+    fclose (replay->fp);
+    free (replay);
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Both                                                                       */
+/*----------------------------------------------------------------------------*/
+void i8080_replay_interrupt (struct i8080_state* state, const uint8_t nnn)
+{
+    struct i8080_replay* const replay = state->replay;
+
+    if (replay->mode == I8080_REPLAY_RECORD)
+        write_item (replay, I8080_REPLAY_INTERRUPT, nnn, 0);
+    else if (!replay->delivering)
+        diverge (replay, "RST from outside the log");
+}
+
+int i8080_replay_close (struct i8080_replay* replay)
+{
+    struct i8080_state* state;
+    int rc = 0;
+    int port;
+
+    if (replay == NULL)
+        return 0;
+
+    state = replay->state;
+    for (port = 0; port < 256; port++)
+        state->in_port[port] = replay->in_port[port];
+    state->replay = NULL;
+
+    if (replay->mode == I8080_REPLAY_RECORD) {
+        replay->header.end_instructions = state->instructions;
+        replay->header.end_cycles = state->cycles;
+        replay->header.end_hash = i8080_replay_hash (state);
+        replay->header.items = replay->items;
+        if (fflush (replay->fp) != 0 || fseek (replay->fp, 0, SEEK_SET) != 0 ||
+            write_header (replay->fp, &replay->header) < 0) {
+            fprintf (stderr, "Error: replay log write failed : %s\n", strerror(errno));
+            rc = -1;
+        }
+    } else {
+        const struct i8080_replay_header* h = &replay->header;
+
+        i8080_cancel (state, replay_event, replay);
+        if (replay->diverged) {
+            rc = -1;
+        } else if (replay->kind != 0) {
+            fprintf (stderr, "Error: replay ended at instruction %llu with %llu of %llu items replayed\n",
+                     (unsigned long long)state->instructions, (unsigned long long)replay->items,
+                     (unsigned long long)h->items);
+            rc = -1;
+        } else if (h->end_instructions &&
+                   (state->instructions != h->end_instructions || state->cycles != h->end_cycles ||
+                    i8080_replay_hash (state) != h->end_hash)) {
+            fprintf (stderr, "Error: replay ended at instruction %llu cycle %llu, the recording at "
+                     "instruction %llu cycle %llu%s\n", (unsigned long long)state->instructions,
+                     (unsigned long long)state->cycles, (unsigned long long)h->end_instructions,
+                     (unsigned long long)h->end_cycles,
+                     (state->instructions == h->end_instructions && state->cycles == h->end_cycles) ?
+                     " with a different state" : "");
+            rc = -1;
+        }
+    }
+
+    if (fclose (replay->fp) != 0 && rc == 0) {
+        fprintf (stderr, "Error: replay log write failed : %s\n", strerror(errno));
+        rc = -1;
+    }
+    free (replay);
+    return rc;
+}
@@ -0,0 +1,144 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Record and replay of the machine inputs.
+
+  While recording, every value an IN handler returns and every interrupt
+  i8080_interrupt() delivers is appended to a log, stamped with the
+  instruction count (and, for interrupts, the cycle count) at which it
+  happened. Everything else the cmodel does is deterministic, so a replay
+  from the same start state with the IN handlers answered from the log and
+  the interrupts delivered at the logged cycle reproduces the run bit for
+  bit, without any device attached.
+
+  File layout: an 80 byte header of little endian fields
+
+     0 "I8RP", version (32-bit)
+     8 machine name, 16 bytes NUL padded (e.g. "invaders")
+    24 start instructions, start cycles, start state hash (64-bit each)
+    48 end instructions, end cycles, end state hash
+    72 number of items
+
+  followed by the items, instruction counts as LEB128 deltas to the
+  previous item and cycle counts as deltas to the previous interrupt:
+
+    IN        : 'i', instructions, port, value
+    interrupt : 'r', instructions, cycles, nnn
+
+  The end fields are filled in by i8080_replay_close(); a log that was
+  never closed (end instructions 0) replays until its items run out. The
+  state hash covers the registers and every readable mapped page.
+
+  Interrupts raised from inside an instruction (an OUT handler calling
+  i8080_interrupt()) are logged at the cycle count the handler saw and
+  replay at the next instruction boundary, so they only replay exactly
+  when the recording host delivers interrupts between instructions (from
+  events or between i8080_run() calls), as the machine models do.
+*/
+
+#ifndef __I8080_REPLAY_H__
+#define __I8080_REPLAY_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "i8080.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define I8080_REPLAY_MAGIC         "I8RP"
+#define I8080_REPLAY_VERSION       1
+#define I8080_REPLAY_HEADER_SIZEB  80
+#define I8080_REPLAY_MACHINE_SIZEB 16
+#define I8080_REPLAY_IN            'i'
+#define I8080_REPLAY_INTERRUPT     'r'
+
+#define I8080_REPLAY_RECORD 0
+#define I8080_REPLAY_PLAY   1
+
+struct i8080_replay_header
+{
+    char machine[I8080_REPLAY_MACHINE_SIZEB];
+    uint64_t start_instructions;
+    uint64_t start_cycles;
+    uint64_t start_hash;
+    uint64_t end_instructions;  /* 0 = log not closed */
+    uint64_t end_cycles;
+    uint64_t end_hash;
+    uint64_t items;
+};
+
+struct i8080_replay
+{
+    struct i8080_state* state;
+    FILE* fp;
+    int mode;                          /* I8080_REPLAY_RECORD or _PLAY */
+    struct i8080_replay_header header;
+    struct i8080_in_port in_port[256]; /* the handlers replaced */
+    uint64_t instructions;             /* of the last item */
+    uint64_t cycles;                   /* of the last interrupt */
+    uint64_t items;
+
+    /* play: the next item, kind 0 = none left */
+    int kind;
+    uint64_t next_instructions;
+    uint64_t next_cycles;
+    uint8_t next_port;
+    uint8_t next_value;  /* IN value or RST number */
+    int delivering;      /* inside the i8080_interrupt() of an item */
+    int diverged;
+};
+
+/* Start logging the IN values and interrupts of state. The IN handlers
+   installed at this point are wrapped, so set the ports up first and do
+   not change them while recording. NULL if the file cannot be written. */
+struct i8080_replay* i8080_replay_record (struct i8080_state* state, const char* const filename,
+                                          const char* const machine);
+
+/* Replay a log into state, which has to be in the logged start state
+   (same memory map and contents, registers and counters). Every IN port
+   is answered from the log and the interrupts are scheduled as events.
+   NULL if the file is not a log or the start state differs. A divergence
+   (an IN or interrupt the log does not have at that instruction) is
+   reported, stops i8080_run() and makes i8080_replay_close() fail. */
+struct i8080_replay* i8080_replay_play (struct i8080_state* state, const char* const filename);
+
+/* header of a log without replaying it, 0 or -1 */
+int i8080_replay_info (const char* const filename, struct i8080_replay_header* header);
+
+/* Record: write the end of the log, -1 if the file could not be written.
+   Play: 0 if the log replayed completely and the state matches the end of
+   the recording, -1 otherwise. Both hand the IN ports back. */
+int i8080_replay_close (struct i8080_replay* replay);
+
+/* the state hash stored in the header */
+uint64_t i8080_replay_hash (struct i8080_state* state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __I8080_REPLAY_H__ */
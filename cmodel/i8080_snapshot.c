@@ -0,0 +1,214 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Snapshot and restore.
+
+  After a snapshot is taken or restored, every page carries the
+  I8080_WATCH_SNAP bit; the first store to a page clears it and records
+  the page in state->snap_page[]. Those are the only pages in which the
+  memory and the snapshot differ, so taking the same snapshot again or
+  rolling back to it copies just them.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "i8080_internal.h"
+
+struct i8080_snapshot
+{
+    const struct i8080_state* state; /* machine last synced with, only compared */
+    uint64_t serial;                 /* 0 = never taken */
+
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+    uint8_t d;
+    uint8_t e;
+    uint8_t h;
+    uint8_t l;
+    uint8_t i;
+    uint8_t f;
+    uint8_t halted;
+    uint16_t sp;
+    uint16_t pc;
+    uint64_t cycles;
+    uint64_t instructions;
+
+    struct i8080_event event[I8080_EVENTS_MAX];
+    int event_count;
+    uint64_t event_seq;
+
+    uint8_t* mem; /* 64kiB, indexed by canonical page */
+};
+
+struct i8080_snapshot* i8080_snapshot_create (const struct i8080_state* state)
+{
+    struct i8080_snapshot* snap;
+
+    (void)state;
+
+    snap = malloc (sizeof(struct i8080_snapshot));
+    if (snap == NULL)
+        return NULL;
+    memset (snap, 0, sizeof(struct i8080_snapshot));
+
+    snap->mem = malloc (0x10000);
+    if (snap->mem == NULL) {
+        free (snap);
+        return NULL;
+    }
+
+    return snap;
+}
+
+void i8080_snapshot_destroy (struct i8080_snapshot* snap)
+{
+    if (snap) {
+        free (snap->mem);
+        free (snap);
+    }
+}
+
+static int in_sync (const struct i8080_state* state, const struct i8080_snapshot* snap)
+{
+    return (snap->state == state && state->snapshot == snap && snap->serial == state->snapshot_serial);
+}
+
+/* host memory of a canonical RAM page, NULL for ROM, MMIO and mirrors */
+static uint8_t* page_host (const struct i8080_state* state, const int page)
+{
+    const struct i8080_page* p = &state->page[page];
+
+    if (state->canon[page] != page || !(p->perm & I8080_PAGE_WRITE))
+        return NULL;
+    return p->host;
+}
+
+/* memory and snap are identical from here on */
+static void sync (struct i8080_state* state, struct i8080_snapshot* snap, const int all_pages)
+{
+    int i;
+
+    if (all_pages) {
+        for (i = 0; i < 256; i++) {
+            if (page_host (state, i))
+                i8080_watch_set (state, i, I8080_WATCH_SNAP);
+        }
+    } else {
+        for (i = 0; i < state->snap_count; i++) {
+            if (page_host (state, state->snap_page[i]))
+                i8080_watch_set (state, state->snap_page[i], I8080_WATCH_SNAP);
+        }
+    }
+    state->snap_count = 0;
+
+    state->snapshot = snap;
+    state->snapshot_serial++;
+    snap->state = state;
+    snap->serial = state->snapshot_serial;
+}
+
+void i8080_snapshot (struct i8080_state* state, struct i8080_snapshot* snap)
+{
+    const int all_pages = !in_sync (state, snap);
+    const int count = all_pages ? 256 : state->snap_count;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        const int page = all_pages ? i : state->snap_page[i];
+        const uint8_t* const host = page_host (state, page);
+
+        if (host)
+            memcpy (&snap->mem[page << 8], host, 0x100);
+    }
+    sync (state, snap, all_pages);
+
+    snap->a = state->a;
+    snap->b = state->b;
+    snap->c = state->c;
+    snap->d = state->d;
+    snap->e = state->e;
+    snap->h = state->h;
+    snap->l = state->l;
+    snap->i = state->i;
+    snap->f = state->f;
+    snap->halted = state->halted;
+    snap->sp = state->sp;
+    snap->pc = state->pc;
+    snap->cycles = state->cycles;
+    snap->instructions = state->instructions;
+    memcpy (snap->event, state->event, sizeof(snap->event));
+    snap->event_count = state->event_count;
+    snap->event_seq = state->event_seq;
+}
+
+void i8080_restore (struct i8080_state* state, struct i8080_snapshot* snap)
+{
+    int all_pages;
+    int count;
+    int i;
+
+    if (snap->serial == 0) {
+        fprintf (stderr, "Error: snapshot was never taken\n");
+        return;
+    }
+
+    /* the pages about to change still have to reach the code cache and
+       the i8080_reset() bookkeeping */
+    all_pages = !in_sync (state, snap);
+    count = all_pages ? 256 : state->snap_count;
+    for (i = 0; i < count; i++) {
+        const int page = all_pages ? i : state->snap_page[i];
+        uint8_t* const host = page_host (state, page);
+
+        if (host == NULL)
+            continue;
+        if (state->watch[page])
+            i8080_watch_write (state, (page << 8));
+        memcpy (host, &snap->mem[page << 8], 0x100);
+    }
+    sync (state, snap, all_pages);
+
+    state->a = snap->a;
+    state->b = snap->b;
+    state->c = snap->c;
+    state->d = snap->d;
+    state->e = snap->e;
+    state->h = snap->h;
+    state->l = snap->l;
+    state->i = snap->i;
+    state->f = snap->f;
+    state->halted = snap->halted;
+    state->sp = snap->sp;
+    state->pc = snap->pc;
+    state->cycles = snap->cycles;
+    state->instructions = snap->instructions;
+    memcpy (state->event, snap->event, sizeof(state->event));
+    state->event_count = snap->event_count;
+    state->event_seq = snap->event_seq;
+}
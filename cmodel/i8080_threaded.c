@@ -0,0 +1,812 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Table driven engine (I8080_ENGINE_THREADED).
+
+  Every opcode has its own handler with the register operands baked in at
+  compile time, so there is no reg_ptr() lookup and register pairs are only
+  assembled by the instructions that use them. The semantics (including the
+  flag quirks the RTL traces depend on) mirror the switch engine in i8080.c.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "i8080.h"
+#include "i8080_internal.h"
+
+#define OP(name) static int op_##name (struct i8080_state* state, const uint16_t arg __attribute__((unused)))
+
+#define COND_nz ((state->f & I8080_FLAG_Z) == 0)
+#define COND_z  ((state->f & I8080_FLAG_Z) != 0)
+#define COND_nc ((state->f & I8080_FLAG_CY) == 0)
+#define COND_c  ((state->f & I8080_FLAG_CY) != 0)
+#define COND_po ((state->f & I8080_FLAG_P) == 0)
+#define COND_pe ((state->f & I8080_FLAG_P) != 0)
+#define COND_p  ((state->f & I8080_FLAG_S) == 0)
+#define COND_m  ((state->f & I8080_FLAG_S) != 0)
+
+/*----------------------------------------------------------------------------*/
+/* ALU helpers                                                                */
+/*----------------------------------------------------------------------------*/
+static inline void alu_add (struct i8080_state* state, const uint8_t val)
+{
+    uint16_t result = state->a + val;
+    i8080_update_flags (state, result, state->a, val);
+    state->a = (result & 0xff);
+}
+
+static inline void alu_adc (struct i8080_state* state, const uint8_t val)
+{
+    uint16_t result = state->a + val + I8080_CY(state);
+    i8080_update_flags (state, result, state->a, (val + I8080_CY(state)));
+    state->a = (result & 0xff);
+}
+
+static inline void alu_sub (struct i8080_state* state, const uint8_t val)
+{
+    uint16_t result = state->a - val;
+    i8080_update_flags (state, result, state->a, val);
+    state->a = (result & 0xff);
+}
+
+/* the register form feeds (src + cy) to the AC calculation, the memory and
+   immediate forms feed (src - cy); both are kept to match the RTL */
+static inline void alu_sbb (struct i8080_state* state, const uint8_t val, const int8_t ac_src)
+{
+    uint16_t result = state->a - val - I8080_CY(state);
+    i8080_update_flags (state, result, state->a, ac_src);
+    state->a = (result & 0xff);
+}
+
+static inline void alu_ana (struct i8080_state* state, const uint8_t val)
+{
+    uint16_t result = state->a & val;
+    i8080_update_flags (state, result, state->a, val);
+    state->a = (result & 0xff);
+    state->f &= ~I8080_FLAG_CY;
+}
+
+static inline void alu_xra (struct i8080_state* state, const uint8_t val)
+{
+    state->a ^= val;
+    state->f = i8080_szp[state->a] | I8080_FLAG_ONE;
+}
+
+static inline void alu_ora (struct i8080_state* state, const uint8_t val)
+{
+    state->a |= val;
+    state->f = i8080_szp[state->a] | I8080_FLAG_ONE;
+}
+
+static inline void alu_cmp (struct i8080_state* state, const uint8_t val)
+{
+    uint16_t result = state->a - val;
+    i8080_update_flags (state, result, state->a, val);
+}
+
+static inline uint8_t alu_inr (struct i8080_state* state, const uint8_t val)
+{
+    uint8_t cy = I8080_CY(state);
+    uint16_t result = val + 1;
+    i8080_update_flags (state, result, val, 1);
+    state->f = (state->f & ~I8080_FLAG_CY) | cy;
+    return (result & 0xff);
+}
+
+static inline uint8_t alu_dcr (struct i8080_state* state, const uint8_t val)
+{
+    uint8_t cy = I8080_CY(state);
+    uint16_t result = val - 1;
+    i8080_update_flags (state, result, val, 1);
+    state->f = (state->f & ~I8080_FLAG_CY) | cy;
+    return (result & 0xff);
+}
+
+static inline void alu_dad (struct i8080_state* state, const uint16_t val)
+{
+    int32_t result = i8080_hl (state) + val;
+    state->f = (state->f & ~I8080_FLAG_CY) | ((result >> 16) & I8080_FLAG_CY);
+    state->h = ((result & 0xff00) >> 8);
+    state->l = ((result & 0x00ff) >> 0);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Stack helpers                                                              */
+/*----------------------------------------------------------------------------*/
+static inline void push16 (struct i8080_state* state, const uint16_t val)
+{
+    i8080_wr (state, state->sp - 1, (val >> 8));
+    i8080_wr (state, state->sp - 2, (val & 0xff));
+    state->sp -= 2;
+}
+
+static inline uint16_t pop16 (struct i8080_state* state)
+{
+    uint16_t val = ((i8080_rd (state, (uint16_t)(state->sp + 1)) << 8) | i8080_rd (state, state->sp));
+    state->sp += 2;
+    return val;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Data transfer                                                              */
+/*----------------------------------------------------------------------------*/
+#define MOV_R_R(dst, src)                                   \
+    OP(mov_##dst##_##src) {                                 \
+        state->dst = state->src;                            \
+        state->pc++;                                        \
+        return 0;                                           \
+    }
+
+#define MOV_R_ALL(dst)                                      \
+    MOV_R_R(dst, b) MOV_R_R(dst, c) MOV_R_R(dst, d)         \
+    MOV_R_R(dst, e) MOV_R_R(dst, h) MOV_R_R(dst, l)         \
+    MOV_R_R(dst, a)
+
+MOV_R_ALL(b) MOV_R_ALL(c) MOV_R_ALL(d) MOV_R_ALL(e)
+MOV_R_ALL(h) MOV_R_ALL(l) MOV_R_ALL(a)
+
+#define MOV_R_M(dst)                                        \
+    OP(mov_##dst##_m) {                                     \
+        state->dst = i8080_rd (state, i8080_hl (state));    \
+        state->pc++;                                        \
+        return 0;                                           \
+    }
+
+#define MOV_M_R(src)                                        \
+    OP(mov_m_##src) {                                       \
+        i8080_wr (state, i8080_hl (state), state->src);     \
+        state->pc++;                                        \
+        return 0;                                           \
+    }
+
+#define MVI_R(dst)                                          \
+    OP(mvi_##dst) {                                         \
+        state->dst = (arg & 0xff);                          \
+        state->pc += 2;                                     \
+        return 0;                                           \
+    }
+
+MOV_R_M(b) MOV_R_M(c) MOV_R_M(d) MOV_R_M(e) MOV_R_M(h) MOV_R_M(l) MOV_R_M(a)
+MOV_M_R(b) MOV_M_R(c) MOV_M_R(d) MOV_M_R(e) MOV_M_R(h) MOV_M_R(l) MOV_M_R(a)
+MVI_R(b) MVI_R(c) MVI_R(d) MVI_R(e) MVI_R(h) MVI_R(l) MVI_R(a)
+
+OP(mvi_m) {
+    i8080_wr (state, i8080_hl (state), (arg & 0xff));
+    state->pc += 2;
+    return 0;
+}
+
+#define LXI_RP(rp, hi, lo)                                  \
+    OP(lxi_##rp) {                                          \
+        state->hi = (arg >> 8);                             \
+        state->lo = (arg & 0xff);                           \
+        state->pc += 3;                                     \
+        return 0;                                           \
+    }
+
+LXI_RP(b, b, c) LXI_RP(d, d, e) LXI_RP(h, h, l)
+
+OP(lxi_sp) {
+    state->sp = arg;
+    state->pc += 3;
+    return 0;
+}
+
+OP(ldax_b) {
+    state->a = i8080_rd (state, i8080_bc (state));
+    state->pc++;
+    return 0;
+}
+
+OP(ldax_d) {
+    state->a = i8080_rd (state, i8080_de (state));
+    state->pc++;
+    return 0;
+}
+
+OP(stax_b) {
+    i8080_wr (state, i8080_bc (state), state->a);
+    state->pc++;
+    return 0;
+}
+
+OP(stax_d) {
+    i8080_wr (state, i8080_de (state), state->a);
+    state->pc++;
+    return 0;
+}
+
+OP(lda) {
+    state->a = i8080_rd (state, arg);
+    state->pc += 3;
+    return 0;
+}
+
+OP(sta) {
+    i8080_wr (state, arg, state->a);
+    state->pc += 3;
+    return 0;
+}
+
+OP(lhld) {
+    state->l = i8080_rd (state, arg);
+    state->h = i8080_rd (state, (uint16_t)(arg + 1));
+    state->pc += 3;
+    return 0;
+}
+
+OP(shld) {
+    i8080_wr (state, arg, state->l);
+    i8080_wr (state, arg + 1, state->h);
+    state->pc += 3;
+    return 0;
+}
+
+OP(sphl) {
+    state->sp = i8080_hl (state);
+    state->pc++;
+    return 0;
+}
+
+OP(xchg) {
+    uint8_t d = state->d;
+    uint8_t e = state->e;
+    state->d = state->h;
+    state->e = state->l;
+    state->h = d;
+    state->l = e;
+    state->pc++;
+    return 0;
+}
+
+OP(xthl) {
+    uint8_t h = state->h;
+    uint8_t l = state->l;
+    state->h = i8080_rd (state, (uint16_t)(state->sp + 1));
+    state->l = i8080_rd (state, state->sp);
+    i8080_wr (state, state->sp + 1, h);
+    i8080_wr (state, state->sp, l);
+    state->pc++;
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Arithmetic and logic                                                       */
+/*----------------------------------------------------------------------------*/
+#define ALU_R(op, src)                                      \
+    OP(op##_##src) {                                        \
+        alu_##op (state, state->src);                       \
+        state->pc++;                                        \
+        return 0;                                           \
+    }
+
+#define ALU_ALL(op)                                         \
+    ALU_R(op, b) ALU_R(op, c) ALU_R(op, d) ALU_R(op, e)     \
+    ALU_R(op, h) ALU_R(op, l) ALU_R(op, a)                  \
+    OP(op##_m) {                                            \
+        uint8_t m = i8080_rd (state, i8080_hl (state));     \
+        alu_##op (state, m);                                \
+        state->pc++;                                        \
+        return 0;                                           \
+    }
+
+ALU_ALL(add) ALU_ALL(adc) ALU_ALL(sub) ALU_ALL(ana)
+ALU_ALL(xra) ALU_ALL(ora) ALU_ALL(cmp)
+
+#define SBB_R(src)                                          \
+    OP(sbb_##src) {                                         \
+        alu_sbb (state, state->src,                         \
+                 state->src + I8080_CY(state));             \
+        state->pc++;                                        \
+        return 0;                                           \
+    }
+
+SBB_R(b) SBB_R(c) SBB_R(d) SBB_R(e) SBB_R(h) SBB_R(l) SBB_R(a)
+
+OP(sbb_m) {
+    uint8_t val = i8080_rd (state, i8080_hl (state));
+    alu_sbb (state, val, val - I8080_CY(state));
+    state->pc++;
+    return 0;
+}
+
+#define ALU_I(name, op)                                     \
+    OP(name) {                                              \
+        alu_##op (state, (arg & 0xff));                     \
+        state->pc += 2;                                     \
+        return 0;                                           \
+    }
+
+ALU_I(adi, add) ALU_I(aci, adc) ALU_I(sui, sub)
+ALU_I(xri, xra) ALU_I(ori, ora) ALU_I(cpi, cmp)
+
+OP(ani) {
+    alu_ana (state, (arg & 0xff));
+    state->f &= ~I8080_FLAG_AC;
+    state->pc += 2;
+    return 0;
+}
+
+OP(sbi) {
+    uint8_t val = (arg & 0xff);
+    alu_sbb (state, val, val - I8080_CY(state));
+    state->pc += 2;
+    return 0;
+}
+
+#define INR_DCR_R(reg)                                      \
+    OP(inr_##reg) {                                         \
+        state->reg = alu_inr (state, state->reg);           \
+        state->pc++;                                        \
+        return 0;                                           \
+    }                                                       \
+    OP(dcr_##reg) {                                         \
+        state->reg = alu_dcr (state, state->reg);           \
+        state->pc++;                                        \
+        return 0;                                           \
+    }
+
+INR_DCR_R(b) INR_DCR_R(c) INR_DCR_R(d) INR_DCR_R(e)
+INR_DCR_R(h) INR_DCR_R(l) INR_DCR_R(a)
+
+OP(inr_m) {
+    const uint16_t hl = i8080_hl (state);
+    i8080_wr (state, hl, alu_inr (state, i8080_rd (state, hl)));
+    state->pc++;
+    return 0;
+}
+
+OP(dcr_m) {
+    const uint16_t hl = i8080_hl (state);
+    i8080_wr (state, hl, alu_dcr (state, i8080_rd (state, hl)));
+    state->pc++;
+    return 0;
+}
+
+#define INX_DCX_RP(rp, hi, lo)                              \
+    OP(inx_##rp) {                                          \
+        uint16_t val = ((state->hi << 8) | state->lo) + 1;  \
+        state->hi = (val >> 8);                             \
+        state->lo = (val & 0xff);                           \
+        state->pc++;                                        \
+        return 0;                                           \
+    }                                                       \
+    OP(dcx_##rp) {                                          \
+        uint16_t val = ((state->hi << 8) | state->lo) - 1;  \
+        state->hi = (val >> 8);                             \
+        state->lo = (val & 0xff);                           \
+        state->pc++;                                        \
+        return 0;                                           \
+    }
+
+INX_DCX_RP(b, b, c) INX_DCX_RP(d, d, e) INX_DCX_RP(h, h, l)
+
+OP(inx_sp) {
+    state->sp++;
+    state->pc++;
+    return 0;
+}
+
+OP(dcx_sp) {
+    state->sp--;
+    state->pc++;
+    return 0;
+}
+
+OP(dad_b) {
+    alu_dad (state, i8080_bc (state));
+    state->pc++;
+    return 0;
+}
+
+OP(dad_d) {
+    alu_dad (state, i8080_de (state));
+    state->pc++;
+    return 0;
+}
+
+OP(dad_h) {
+    alu_dad (state, i8080_hl (state));
+    state->pc++;
+    return 0;
+}
+
+OP(dad_sp) {
+    alu_dad (state, state->sp);
+    state->pc++;
+    return 0;
+}
+
+OP(daa) {
+    int cy = I8080_CY(state);
+    uint8_t ac;
+
+    if (((state->a & 0xf) > 9) || (state->f & I8080_FLAG_AC)) {
+        uint16_t result = (state->a + 6) & 0xff;
+        i8080_update_flags (state, result, state->a, 6);
+        state->f |= I8080_FLAG_AC;
+        state->a = (result & 0xff);
+    } else {
+        state->f &= ~I8080_FLAG_AC;
+    }
+    ac = (state->f & I8080_FLAG_AC);
+
+    if ((((state->a >> 4) & 0xf) > 9) || cy) {
+        uint16_t result = (state->a + 0x60);
+        i8080_update_flags (state, result, state->a, 0x60);
+        state->f |= I8080_FLAG_CY;
+        state->a = (result & 0xff);
+    } else {
+        state->f &= ~I8080_FLAG_CY;
+    }
+    state->f = (state->f & ~I8080_FLAG_AC) | ac;
+
+    state->pc++;
+    return 0;
+}
+
+OP(rlc) {
+    uint8_t b7 = state->a >> 7;
+    state->a = (state->a << 1) | b7;
+    state->f = (state->f & ~I8080_FLAG_CY) | b7;
+    state->pc++;
+    return 0;
+}
+
+OP(rrc) {
+    uint8_t b0 = state->a & 1;
+    state->a = (state->a >> 1) | (b0 << 7);
+    state->f = (state->f & ~I8080_FLAG_CY) | b0;
+    state->pc++;
+    return 0;
+}
+
+OP(ral) {
+    uint8_t b7 = state->a >> 7;
+    state->a = (state->a << 1) | I8080_CY(state);
+    state->f = (state->f & ~I8080_FLAG_CY) | b7;
+    state->pc++;
+    return 0;
+}
+
+OP(rar) {
+    uint8_t b0 = state->a & 1;
+    state->a = (state->a >> 1) | (I8080_CY(state) << 7);
+    state->f = (state->f & ~I8080_FLAG_CY) | b0;
+    state->pc++;
+    return 0;
+}
+
+OP(cma) {
+    state->a = ~state->a;
+    state->pc++;
+    return 0;
+}
+
+OP(stc) {
+    state->f |= I8080_FLAG_CY;
+    state->pc++;
+    return 0;
+}
+
+OP(cmc) {
+    state->f ^= I8080_FLAG_CY;
+    state->pc++;
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Branch                                                                     */
+/*----------------------------------------------------------------------------*/
+OP(jmp) {
+    state->pc = arg;
+    return 0;
+}
+
+OP(pchl) {
+    state->pc = i8080_hl (state);
+    return 0;
+}
+
+OP(call) {
+    push16 (state, state->pc + 3);
+    state->pc = arg;
+    return 0;
+}
+
+OP(ret) {
+    state->pc = pop16 (state);
+    return 0;
+}
+
+#define BRANCH_CC(cc)                                       \
+    OP(j##cc) {                                             \
+        if (COND_##cc)                                      \
+            state->pc = arg;                                \
+        else                                                \
+            state->pc += 3;                                 \
+        return 0;                                           \
+    }                                                       \
+    OP(c##cc) {                                             \
+        if (COND_##cc) {                                    \
+            push16 (state, state->pc + 3);                  \
+            state->pc = arg;                                \
+            state->cycles += I8080_CYCLES_TAKEN;            \
+        } else {                                            \
+            state->pc += 3;                                 \
+        }                                                   \
+        return 0;                                           \
+    }                                                       \
+    OP(r##cc) {                                             \
+        if (COND_##cc) {                                    \
+            state->pc = pop16 (state);                      \
+            state->cycles += I8080_CYCLES_TAKEN;            \
+        } else {                                            \
+            state->pc++;                                    \
+        }                                                   \
+        return 0;                                           \
+    }
+
+BRANCH_CC(nz) BRANCH_CC(z) BRANCH_CC(nc) BRANCH_CC(c)
+BRANCH_CC(po) BRANCH_CC(pe) BRANCH_CC(p) BRANCH_CC(m)
+
+#define RST_N(n)                                            \
+    OP(rst_##n) {                                           \
+        push16 (state, state->pc + 1);                      \
+        state->pc = (n * 8);                                \
+        return 0;                                           \
+    }
+
+RST_N(0) RST_N(1) RST_N(2) RST_N(3) RST_N(4) RST_N(5) RST_N(6) RST_N(7)
+
+/*----------------------------------------------------------------------------*/
+/* Stack                                                                      */
+/*----------------------------------------------------------------------------*/
+#define PUSH_POP_RP(rp, hi, lo)                             \
+    OP(push_##rp) {                                         \
+        i8080_wr (state, state->sp - 1, state->hi);         \
+        i8080_wr (state, state->sp - 2, state->lo);         \
+        state->sp -= 2;                                     \
+        state->pc++;                                        \
+        return 0;                                           \
+    }                                                       \
+    OP(pop_##rp) {                                          \
+        state->lo = i8080_rd (state, state->sp);            \
+        state->hi = i8080_rd (state, state->sp + 1);        \
+        state->sp += 2;                                     \
+        state->pc++;                                        \
+        return 0;                                           \
+    }
+
+PUSH_POP_RP(b, b, c) PUSH_POP_RP(d, d, e) PUSH_POP_RP(h, h, l)
+
+OP(push_psw) {
+    i8080_wr (state, state->sp - 1, state->a);
+    i8080_wr (state, state->sp - 2, state->f);
+    state->sp -= 2;
+    state->pc++;
+    return 0;
+}
+
+OP(pop_psw) {
+    const uint8_t psw = i8080_rd (state, state->sp);
+    state->a = i8080_rd (state, (uint16_t)(state->sp + 1));
+    state->f = ((psw & I8080_FLAG_MASK) | I8080_FLAG_ONE);
+    state->sp += 2;
+    state->pc++;
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/* I/O and machine control                                                    */
+/*----------------------------------------------------------------------------*/
+OP(in) {
+    state->a = i8080_in (state, (arg & 0xff));
+    state->pc += 2;
+    return 0;
+}
+
+OP(out) {
+    i8080_out (state, (arg & 0xff), state->a);
+    state->pc += 2;
+    return 0;
+}
+
+OP(ei) {
+    state->i = 1;
+    state->pc++;
+    return 0;
+}
+
+OP(di) {
+    state->i = 0;
+    state->pc++;
+    return 0;
+}
+
+OP(nop) {
+    state->pc++;
+    return 0;
+}
+
+OP(hlt) {
+    state->halted = 1;
+    state->pc++;
+    return 1;
+}
+
+OP(unknown) {
+    fprintf (state->log, "0x%04x: 0x%02x [unknown opcode]\n", state->pc, i8080_rd (state, state->pc));
+    return -1;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Dispatch table                                                             */
+/*----------------------------------------------------------------------------*/
+#define MOV_ROW(base, dst)                                                  \
+    [base+0] = op_mov_##dst##_b, [base+1] = op_mov_##dst##_c,               \
+    [base+2] = op_mov_##dst##_d, [base+3] = op_mov_##dst##_e,               \
+    [base+4] = op_mov_##dst##_h, [base+5] = op_mov_##dst##_l,               \
+    [base+6] = op_mov_##dst##_m, [base+7] = op_mov_##dst##_a
+
+#define ALU_ROW(base, op)                                                   \
+    [base+0] = op_##op##_b, [base+1] = op_##op##_c,                         \
+    [base+2] = op_##op##_d, [base+3] = op_##op##_e,                         \
+    [base+4] = op_##op##_h, [base+5] = op_##op##_l,                         \
+    [base+6] = op_##op##_m, [base+7] = op_##op##_a
+
+const i8080_op_fn_t i8080_op_table[256] = {
+    [0x00] = op_nop,    [0x01] = op_lxi_b,  [0x02] = op_stax_b, [0x03] = op_inx_b,
+    [0x04] = op_inr_b,  [0x05] = op_dcr_b,  [0x06] = op_mvi_b,  [0x07] = op_rlc,
+    [0x08] = op_unknown, [0x09] = op_dad_b,  [0x0a] = op_ldax_b, [0x0b] = op_dcx_b,
+    [0x0c] = op_inr_c,  [0x0d] = op_dcr_c,  [0x0e] = op_mvi_c,  [0x0f] = op_rrc,
+
+    [0x10] = op_unknown, [0x11] = op_lxi_d,  [0x12] = op_stax_d, [0x13] = op_inx_d,
+    [0x14] = op_inr_d,  [0x15] = op_dcr_d,  [0x16] = op_mvi_d,  [0x17] = op_ral,
+    [0x18] = op_unknown, [0x19] = op_dad_d,  [0x1a] = op_ldax_d, [0x1b] = op_dcx_d,
+    [0x1c] = op_inr_e,  [0x1d] = op_dcr_e,  [0x1e] = op_mvi_e,  [0x1f] = op_rar,
+
+    [0x20] = op_unknown, [0x21] = op_lxi_h,  [0x22] = op_shld,   [0x23] = op_inx_h,
+    [0x24] = op_inr_h,  [0x25] = op_dcr_h,  [0x26] = op_mvi_h,  [0x27] = op_daa,
+    [0x28] = op_unknown, [0x29] = op_dad_h,  [0x2a] = op_lhld,   [0x2b] = op_dcx_h,
+    [0x2c] = op_inr_l,  [0x2d] = op_dcr_l,  [0x2e] = op_mvi_l,  [0x2f] = op_cma,
+
+    [0x30] = op_unknown, [0x31] = op_lxi_sp, [0x32] = op_sta,    [0x33] = op_inx_sp,
+    [0x34] = op_inr_m,  [0x35] = op_dcr_m,  [0x36] = op_mvi_m,  [0x37] = op_stc,
+    [0x38] = op_unknown, [0x39] = op_dad_sp, [0x3a] = op_lda,    [0x3b] = op_dcx_sp,
+    [0x3c] = op_inr_a,  [0x3d] = op_dcr_a,  [0x3e] = op_mvi_a,  [0x3f] = op_cmc,
+
+    MOV_ROW(0x40, b), MOV_ROW(0x48, c), MOV_ROW(0x50, d), MOV_ROW(0x58, e),
+    MOV_ROW(0x60, h), MOV_ROW(0x68, l), MOV_ROW(0x78, a),
+
+    [0x70] = op_mov_m_b, [0x71] = op_mov_m_c, [0x72] = op_mov_m_d, [0x73] = op_mov_m_e,
+    [0x74] = op_mov_m_h, [0x75] = op_mov_m_l, [0x76] = op_hlt,     [0x77] = op_mov_m_a,
+
+    ALU_ROW(0x80, add), ALU_ROW(0x88, adc), ALU_ROW(0x90, sub), ALU_ROW(0x98, sbb),
+    ALU_ROW(0xa0, ana), ALU_ROW(0xa8, xra), ALU_ROW(0xb0, ora), ALU_ROW(0xb8, cmp),
+
+    [0xc0] = op_rnz,    [0xc1] = op_pop_b,  [0xc2] = op_jnz,    [0xc3] = op_jmp,
+    [0xc4] = op_cnz,    [0xc5] = op_push_b, [0xc6] = op_adi,    [0xc7] = op_rst_0,
+    [0xc8] = op_rz,     [0xc9] = op_ret,    [0xca] = op_jz,     [0xcb] = op_unknown,
+    [0xcc] = op_cz,     [0xcd] = op_call,   [0xce] = op_aci,    [0xcf] = op_rst_1,
+
+    [0xd0] = op_rnc,    [0xd1] = op_pop_d,  [0xd2] = op_jnc,    [0xd3] = op_out,
+    [0xd4] = op_cnc,    [0xd5] = op_push_d, [0xd6] = op_sui,    [0xd7] = op_rst_2,
+    [0xd8] = op_rc,     [0xd9] = op_unknown, [0xda] = op_jc,    [0xdb] = op_in,
+    [0xdc] = op_cc,     [0xdd] = op_unknown, [0xde] = op_sbi,   [0xdf] = op_rst_3,
+
+    [0xe0] = op_rpo,    [0xe1] = op_pop_h,  [0xe2] = op_jpo,    [0xe3] = op_xthl,
+    [0xe4] = op_cpo,    [0xe5] = op_push_h, [0xe6] = op_ani,    [0xe7] = op_rst_4,
+    [0xe8] = op_rpe,    [0xe9] = op_pchl,   [0xea] = op_jpe,    [0xeb] = op_xchg,
+    [0xec] = op_cpe,    [0xed] = op_unknown, [0xee] = op_xri,    [0xef] = op_rst_5,
+
+    [0xf0] = op_rp,     [0xf1] = op_pop_psw, [0xf2] = op_jp,    [0xf3] = op_di,
+    [0xf4] = op_cp,     [0xf5] = op_push_psw, [0xf6] = op_ori,  [0xf7] = op_rst_6,
+    [0xf8] = op_rm,     [0xf9] = op_sphl,   [0xfa] = op_jm,     [0xfb] = op_ei,
+    [0xfc] = op_cm,     [0xfd] = op_unknown, [0xfe] = op_cpi,    [0xff] = op_rst_7,
+};
+
+int i8080_exec_threaded (struct i8080_state* state)
+{
+    uint16_t pc;
+    uint64_t cycles;
+    uint8_t opcode;
+    uint16_t arg;
+    int rc;
+
+    if (i8080_unlikely (state->trace != NULL))
+        i8080_trace_state (state->trace, state);
+
+    /* a 64kiB map wraps like the CPU does (operands through i8080_fetch()),
+       the same as the inner loops of the threaded and block cache engines */
+    if (state->mem_sizeb < 0x10000 && state->pc >= (state->mem_sizeb - 1))
+        return -1;
+
+    /* check for special handling of this PC value */
+    if (state->instr_func && !state->instr_func (state))
+        return 0;
+
+    pc = state->pc;
+    cycles = state->cycles;
+    opcode = i8080_fetch (state, &arg);
+    state->cycles += i8080_cycles[opcode];
+    state->instructions++;
+
+    rc = i8080_op_table[opcode] (state, arg);
+    if (i8080_unlikely (state->profile != NULL))
+        i8080_profile_count (state, opcode, pc, cycles);
+    return rc;
+}
+
+/* Inner loop of i8080_run() for a full 64kiB memory: every 16-bit address
+   goes through the memory map, so the per instruction bounds check of
+   i8080_exec() is not needed.
+   Instantiated for each combination of instr_func callback and tracing, both
+   are sampled once per i8080_run() call; the profiling instance takes
+   them as variables instead. */
+static inline __attribute__((always_inline)) int run_loop (struct i8080_state* state, const int check_instr_func, const int trace,
+                                                           const int profile)
+{
+    while (state->cycles < state->run_until) {
+        const uint16_t pc = state->pc;
+        const uint64_t cycles = state->cycles;
+        uint8_t opcode;
+        uint16_t arg;
+        int rc;
+
+        if (trace)
+            i8080_trace_state (state->trace, state);
+
+        if (check_instr_func && !state->instr_func (state))
+            continue;
+
+        opcode = i8080_fetch (state, &arg);
+        state->cycles += i8080_cycles[opcode];
+        state->instructions++;
+
+        rc = i8080_op_table[opcode] (state, arg);
+        if (profile)
+            i8080_profile_count (state, opcode, pc, cycles);
+        if (i8080_unlikely (rc != 0))
+            return rc;
+    }
+
+    return 0;
+}
+
+int i8080_run_threaded (struct i8080_state* state)
+{
+    if (state->profile)
+        return run_loop (state, (state->instr_func != NULL), (state->trace != NULL), 1);
+
+    if (state->trace) {
+        if (state->instr_func)
+            return run_loop (state, 1, 1, 0);
+        return run_loop (state, 0, 1, 0);
+    }
+
+    if (state->instr_func)
+        return run_loop (state, 1, 0, 0);
+    return run_loop (state, 0, 0, 0);
+}
@@ -0,0 +1,753 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "i8080.h"
+#include "i8080_trace.h"
+
+/*----------------------------------------------------------------------------*/
+/* Writer                                                                     */
+/*----------------------------------------------------------------------------*/
+struct i8080_trace* i8080_trace_create (const char* const filename)
+{
+    return i8080_trace_create_format (filename, I8080_TRACE_FORMAT_RAW);
+}
+
+struct i8080_trace* i8080_trace_create_format (const char* const filename, const int format)
+{
+    struct i8080_trace* trace;
+    const uint8_t header[I8080_TRACE_HEADER_SIZEB] = {
+        I8080_TRACE_MAGIC[0], I8080_TRACE_MAGIC[1], I8080_TRACE_MAGIC[2], I8080_TRACE_MAGIC[3],
+        I8080_TRACE_VERSION, format, I8080_TRACE_RECORD_SIZEB,
+        (format == I8080_TRACE_FORMAT_DELTA) ? I8080_TRACE_KEYFRAME_LOG2 : 0
+    };
+
+    if (format != I8080_TRACE_FORMAT_RAW && format != I8080_TRACE_FORMAT_DELTA) {
+        fprintf (stderr, "Error: unknown trace format %d\n", format);
+        return NULL;
+    }
+
+    trace = malloc (sizeof(struct i8080_trace));
+    if (trace == NULL)
+        return NULL;
+    memset (trace, 0, sizeof(struct i8080_trace));
+
+    if (NULL == (trace->fp = fopen (filename, "wb"))) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+        free (trace);
+        return NULL;
+    }
+    /* the record buffer is ours, stdio buffering would only add a copy */
+    setvbuf (trace->fp, NULL, _IONBF, 0);
+
+    trace->format = format;
+    trace->buf = malloc (I8080_TRACE_BUFFER_SIZEB);
+    if (trace->buf == NULL) {
+        fclose (trace->fp);
+        free (trace);
+        return NULL;
+    }
+    memcpy (trace->buf, header, sizeof(header));
+    trace->pos = sizeof(header);
+
+    return trace;
+}
+
+void i8080_trace_flush (struct i8080_trace* trace)
+{
+    if (trace->pos) {
+        if (fwrite (trace->buf, trace->pos, 1, trace->fp) != 1)
+            fprintf (stderr, "Error: trace write failed : %s\n", strerror(errno));
+        trace->written += trace->pos;
+        trace->pos = 0;
+    }
+}
+
+void i8080_trace_destroy (struct i8080_trace* trace)
+{
+    if (trace) {
+        i8080_trace_flush (trace);
+        if (trace->index)
+            fclose (trace->index);
+        fclose (trace->fp);
+        free (trace->buf);
+        free (trace);
+    }
+}
+
+void i8080_trace_text (struct i8080_trace* trace, const char* text, const size_t len)
+{
+    size_t left = len;
+
+    /* a record holds up to 0xffff bytes, longer text takes several that
+       the readers print back to back */
+    do {
+        const size_t n = (left > 0xffff) ? 0xffff : left;
+
+        if (trace->pos + 3 + n > I8080_TRACE_BUFFER_SIZEB)
+            i8080_trace_flush (trace);
+
+        trace->buf[trace->pos++] = I8080_TRACE_TEXT_MARKER;
+        trace->buf[trace->pos++] = (n & 0xff);
+        trace->buf[trace->pos++] = (n >> 8);
+        memcpy (&trace->buf[trace->pos], text, n);
+        trace->pos += n;
+        text += n;
+        left -= n;
+    } while (left);
+}
+
+/* longest delta: tag, mask, six registers, psw, a, sp, pc */
+#define DELTA_MAX_SIZEB 14
+
+static void write_delta (struct i8080_trace* trace, const struct i8080_trace_record* rec)
+{
+    const struct i8080_trace_record* prev = &trace->prev;
+    const uint16_t pc = ((rec->pch << 8) | rec->pcl);
+    const uint16_t step = pc - ((prev->pch << 8) | prev->pcl);
+    const uint8_t* const r = &rec->b;
+    const uint8_t* const q = &prev->b;
+    uint8_t* p = &trace->buf[trace->pos];
+    uint8_t* const tag = p++;
+    uint8_t mask = 0;
+    int i;
+
+    *tag = I8080_TRACE_DELTA;
+
+    /* b c d e h l */
+    for (i = 0; i < 6; i++) {
+        if (r[i] != q[i])
+            mask |= (1 << i);
+    }
+    if (mask) {
+        *tag |= 0x01;
+        *p++ = mask;
+        for (i = 0; i < 6; i++) {
+            if (mask & (1 << i))
+                *p++ = r[i];
+        }
+    }
+    if (rec->a != prev->a) {
+        *tag |= 0x04;
+        *p++ = rec->a;
+    }
+    if (rec->psw != prev->psw) {
+        *tag |= 0x08;
+        *p++ = rec->psw;
+    }
+    if (rec->sph != prev->sph || rec->spl != prev->spl) {
+        *tag |= 0x10;
+        *p++ = rec->sph;
+        *p++ = rec->spl;
+    }
+    if (step >= 1 && step <= 3) {
+        *tag |= ((step - 1) << 5);
+    } else if ((int16_t)step >= -128 && (int16_t)step <= 127) {
+        /* short jumps, e.g. wait loops */
+        *tag |= (3 << 5) | 0x02;
+        *p++ = (uint8_t)step;
+    } else {
+        *tag |= (3 << 5);
+        *p++ = rec->pch;
+        *p++ = rec->pcl;
+    }
+
+    trace->pos = (p - trace->buf);
+}
+
+void i8080_trace_write (struct i8080_trace* trace, const struct i8080_trace_record* rec)
+{
+    if (trace->pos + DELTA_MAX_SIZEB > I8080_TRACE_BUFFER_SIZEB)
+        i8080_trace_flush (trace);
+
+    if (trace->index && (trace->records % I8080_TRACE_KEYFRAME_INTERVAL) == 0)
+        i8080_trace_index_add (trace);
+
+    if (trace->format == I8080_TRACE_FORMAT_RAW) {
+        memcpy (&trace->buf[trace->pos], rec, I8080_TRACE_RECORD_SIZEB);
+        trace->pos += I8080_TRACE_RECORD_SIZEB;
+    } else if ((trace->records % I8080_TRACE_KEYFRAME_INTERVAL) == 0) {
+        trace->buf[trace->pos++] = I8080_TRACE_KEYFRAME;
+        memcpy (&trace->buf[trace->pos], rec, I8080_TRACE_RECORD_SIZEB);
+        trace->pos += I8080_TRACE_RECORD_SIZEB;
+    } else {
+        write_delta (trace, rec);
+    }
+
+    trace->prev = *rec;
+    trace->records++;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Index                                                                      */
+/*----------------------------------------------------------------------------*/
+#define INDEX_ENTRY_SIZEB 32
+
+static void put_le (uint8_t* p, uint64_t val, const int sizeb)
+{
+    int i;
+
+    for (i = 0; i < sizeb; i++, val >>= 8)
+        p[i] = (val & 0xff);
+}
+
+static uint64_t get_le (const uint8_t* p, const int sizeb)
+{
+    uint64_t val = 0;
+    int i;
+
+    for (i = sizeb - 1; i >= 0; i--)
+        val = ((val << 8) | p[i]);
+    return val;
+}
+
+static FILE* index_open (const char* const filename, const uint32_t interval)
+{
+    uint8_t header[I8080_TRACE_INDEX_HEADER_SIZEB] = {
+        I8080_TRACE_INDEX_MAGIC[0], I8080_TRACE_INDEX_MAGIC[1],
+        I8080_TRACE_INDEX_MAGIC[2], I8080_TRACE_INDEX_MAGIC[3],
+        I8080_TRACE_INDEX_VERSION
+    };
+    FILE* fp;
+
+    if (NULL == (fp = fopen (filename, "wb"))) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    put_le (&header[8], interval, 4);
+    if (fwrite (header, sizeof(header), 1, fp) != 1) {
+        fprintf (stderr, "Error: index write failed : %s\n", strerror(errno));
+        fclose (fp);
+        return NULL;
+    }
+    return fp;
+}
+
+static int index_write (FILE* fp, const struct i8080_trace_index_entry* entry)
+{
+    uint8_t p[INDEX_ENTRY_SIZEB];
+
+    put_le (&p[0], entry->record, 8);
+    put_le (&p[8], entry->offset, 8);
+    put_le (&p[16], entry->line, 8);
+    put_le (&p[24], entry->cycles, 8);
+    if (fwrite (p, sizeof(p), 1, fp) != 1) {
+        fprintf (stderr, "Error: index write failed : %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int i8080_trace_index_create (struct i8080_trace* trace, const char* const filename)
+{
+    if (trace->records) {
+        fprintf (stderr, "Error: trace index has to be created before the first record\n");
+        return -1;
+    }
+    if (NULL == (trace->index = index_open (filename, I8080_TRACE_KEYFRAME_INTERVAL)))
+        return -1;
+    return 0;
+}
+
+/* entry for the record about to be written */
+void i8080_trace_index_add (struct i8080_trace* trace)
+{
+    struct i8080_trace_index_entry entry;
+
+    entry.record = trace->records;
+    entry.offset = trace->written + trace->pos;
+    entry.line = 0;
+    entry.cycles = trace->cycles;
+    index_write (trace->index, &entry);
+}
+
+int i8080_trace_index_build (const char* const trace_file, const char* const index_file, uint32_t interval)
+{
+    struct i8080_trace_reader* reader;
+    struct i8080_trace_record rec;
+    struct i8080_trace_index_entry entry;
+    FILE* fp;
+    int ret = 0;
+    int rc;
+
+    if (interval == 0)
+        interval = I8080_TRACE_KEYFRAME_INTERVAL;
+
+    if (NULL == (reader = i8080_trace_reader_open (trace_file)))
+        return -1;
+
+    /* a delta trace can only be entered at a keyframe */
+    if (reader->format == I8080_TRACE_FORMAT_DELTA)
+        interval = ((interval + I8080_TRACE_KEYFRAME_INTERVAL - 1) / I8080_TRACE_KEYFRAME_INTERVAL) * I8080_TRACE_KEYFRAME_INTERVAL;
+
+    if (NULL == (fp = index_open (index_file, interval))) {
+        i8080_trace_reader_close (reader);
+        return -1;
+    }
+
+    for (;;) {
+        entry.record = reader->records;
+        entry.offset = i8080_trace_reader_tell (reader);
+        entry.line = reader->line;
+        entry.cycles = UINT64_MAX;
+
+        rc = i8080_trace_read (reader, &rec);
+        if (rc == I8080_TRACE_EOF)
+            break;
+        if (rc == I8080_TRACE_ERROR) {
+            fprintf (stderr, "Error: %s: bad record %llu\n", trace_file, (unsigned long long)reader->records);
+            ret = -1;
+            break;
+        }
+        if (rc == I8080_TRACE_STATE && (entry.record % interval) == 0) {
+            if (index_write (fp, &entry) < 0) {
+                ret = -1;
+                break;
+            }
+        }
+    }
+
+    i8080_trace_reader_close (reader);
+    if (fclose (fp) != 0)
+        ret = -1;
+    return ret;
+}
+
+struct i8080_trace_index* i8080_trace_index_load (const char* const filename)
+{
+    struct i8080_trace_index* index;
+    uint8_t header[I8080_TRACE_INDEX_HEADER_SIZEB];
+    uint8_t p[INDEX_ENTRY_SIZEB];
+    size_t max = 0;
+    FILE* fp;
+
+    if (NULL == (fp = fopen (filename, "rb"))) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+        return NULL;
+    }
+
+    if (fread (header, sizeof(header), 1, fp) != 1 ||
+        memcmp (header, I8080_TRACE_INDEX_MAGIC, 4) ||
+        header[4] != I8080_TRACE_INDEX_VERSION) {
+        fprintf (stderr, "Error: %s is not a trace index\n", filename);
+        fclose (fp);
+        return NULL;
+    }
+
+    index = malloc (sizeof(struct i8080_trace_index));
+    if (index == NULL) {
+        fclose (fp);
+        return NULL;
+    }
+    memset (index, 0, sizeof(struct i8080_trace_index));
+    index->interval = get_le (&header[8], 4);
+
+    while (fread (p, sizeof(p), 1, fp) == 1) {
+        struct i8080_trace_index_entry* e;
+
+        if (index->count == max) {
+            max = max ? (max * 2) : 1024;
+            e = realloc (index->entry, max * sizeof(struct i8080_trace_index_entry));
+            if (e == NULL) {
+                i8080_trace_index_free (index);
+                fclose (fp);
+                return NULL;
+            }
+            index->entry = e;
+        }
+        e = &index->entry[index->count++];
+        e->record = get_le (&p[0], 8);
+        e->offset = get_le (&p[8], 8);
+        e->line = get_le (&p[16], 8);
+        e->cycles = get_le (&p[24], 8);
+    }
+
+    fclose (fp);
+    return index;
+}
+
+void i8080_trace_index_free (struct i8080_trace_index* index)
+{
+    if (index) {
+        free (index->entry);
+        free (index);
+    }
+}
+
+/* entries are sorted on both record and cycles (when known) */
+const struct i8080_trace_index_entry* i8080_trace_index_find (const struct i8080_trace_index* index, const uint64_t record)
+{
+    size_t lo = 0;
+    size_t hi = index->count;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (index->entry[mid].record <= record)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo ? &index->entry[lo - 1] : NULL;
+}
+
+const struct i8080_trace_index_entry* i8080_trace_index_find_cycle (const struct i8080_trace_index* index, const uint64_t cycles)
+{
+    size_t lo = 0;
+    size_t hi = index->count;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (index->entry[mid].cycles <= cycles)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo ? &index->entry[lo - 1] : NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Reader                                                                     */
+/*----------------------------------------------------------------------------*/
+static int reader_fill (struct i8080_trace_reader* reader, const size_t need)
+{
+    size_t avail = reader->len - reader->pos;
+
+    if (avail >= need)
+        return 1;
+
+    memmove (reader->buf, &reader->buf[reader->pos], avail);
+    reader->base += reader->pos;
+    reader->pos = 0;
+    reader->len = avail;
+    reader->len += fread (&reader->buf[avail], 1, I8080_TRACE_BUFFER_SIZEB - avail, reader->fp);
+
+    return (reader->len >= need);
+}
+
+struct i8080_trace_reader* i8080_trace_reader_open (const char* const filename)
+{
+    struct i8080_trace_reader* reader;
+
+    reader = malloc (sizeof(struct i8080_trace_reader));
+    if (reader == NULL)
+        return NULL;
+    memset (reader, 0, sizeof(struct i8080_trace_reader));
+
+    if (NULL == (reader->fp = fopen (filename, "rb"))) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+        free (reader);
+        return NULL;
+    }
+    reader->buf = malloc (I8080_TRACE_BUFFER_SIZEB);
+    if (reader->buf == NULL) {
+        fclose (reader->fp);
+        free (reader);
+        return NULL;
+    }
+
+    if (!reader_fill (reader, I8080_TRACE_HEADER_SIZEB) ||
+        memcmp (reader->buf, I8080_TRACE_MAGIC, 4)) {
+        /* no header, an RTL text trace (or empty) */
+        reader->format = I8080_TRACE_FORMAT_TEXT;
+        return reader;
+    }
+
+    if (reader->buf[4] != I8080_TRACE_VERSION ||
+        (reader->buf[5] != I8080_TRACE_FORMAT_RAW && reader->buf[5] != I8080_TRACE_FORMAT_DELTA) ||
+        reader->buf[6] != I8080_TRACE_RECORD_SIZEB) {
+        fprintf (stderr, "Error: %s is not a binary state trace\n", filename);
+        i8080_trace_reader_close (reader);
+        return NULL;
+    }
+    reader->format = reader->buf[5];
+    reader->pos = I8080_TRACE_HEADER_SIZEB;
+
+    return reader;
+}
+
+uint64_t i8080_trace_reader_tell (const struct i8080_trace_reader* reader)
+{
+    return reader->base + reader->pos;
+}
+
+int i8080_trace_reader_seek (struct i8080_trace_reader* reader, const struct i8080_trace_index_entry* entry)
+{
+    if (fseek (reader->fp, (long)entry->offset, SEEK_SET) != 0) {
+        fprintf (stderr, "Error: trace seek failed : %s\n", strerror(errno));
+        return -1;
+    }
+    reader->base = entry->offset;
+    reader->pos = 0;
+    reader->len = 0;
+    reader->records = entry->record;
+    reader->line = entry->line;
+    reader->keyed = 0;
+    return 0;
+}
+
+void i8080_trace_reader_close (struct i8080_trace_reader* reader)
+{
+    if (reader) {
+        fclose (reader->fp);
+        free (reader->buf);
+        free (reader);
+    }
+}
+
+/* next line of a text trace into reader->text, newline included; 0 at
+   the end of the file */
+static int read_line (struct i8080_trace_reader* reader)
+{
+    size_t n = 0;
+
+    while (reader_fill (reader, 1)) {
+        const uint8_t* const start = &reader->buf[reader->pos];
+        const uint8_t* const nl = memchr (start, '\n', reader->len - reader->pos);
+        const size_t chunk = nl ? (size_t)(nl - start + 1) : (reader->len - reader->pos);
+        const size_t keep = (chunk < (sizeof(reader->text) - 1 - n)) ? chunk : (sizeof(reader->text) - 1 - n);
+
+        memcpy (&reader->text[n], start, keep);
+        n += keep;
+        reader->pos += chunk;
+        if (nl)
+            break;
+    }
+
+    if (n == 0)
+        return 0;
+
+    reader->text[n] = '\0';
+    reader->text_len = n;
+    reader->line++;
+    return 1;
+}
+
+static int read_text_trace (struct i8080_trace_reader* reader, struct i8080_trace_record* rec)
+{
+    if (!read_line (reader))
+        return I8080_TRACE_EOF;
+
+    if (reader->text[0] != '{')
+        return I8080_TRACE_TEXT;
+
+    if (!i8080_trace_parse (reader->text, reader->text_len, rec)) {
+        fprintf (stderr, "Error: line %llu is not a state record\n", (unsigned long long)reader->line);
+        return I8080_TRACE_ERROR;
+    }
+    reader->records++;
+    return I8080_TRACE_STATE;
+}
+
+/* bytes of the delta item starting with tag, mask = its mask byte */
+static size_t delta_sizeb (const uint8_t tag, const uint8_t mask)
+{
+    size_t n = 1;
+    int i;
+
+    if (tag & 0x01) {
+        n++;
+        for (i = 0; i < 6; i++)
+            n += ((mask >> i) & 1);
+    }
+    n += ((tag >> 2) & 1);          /* a */
+    n += ((tag >> 3) & 1);          /* psw */
+    n += ((tag >> 4) & 1) * 2;      /* sp */
+    if (((tag >> 5) & 3) == 3)        /* pc */
+        n += (tag & 0x02) ? 1 : 2;
+    return n;
+}
+
+static int read_delta (struct i8080_trace_reader* reader, struct i8080_trace_record* rec)
+{
+    struct i8080_trace_record* prev = &reader->prev;
+    uint8_t* const r = &prev->b;
+    const uint8_t* p;
+    uint8_t tag;
+    uint8_t mask = 0;
+    uint16_t pc;
+    int i;
+
+    tag = reader->buf[reader->pos];
+
+    if (tag == I8080_TRACE_KEYFRAME) {
+        if (!reader_fill (reader, 1 + I8080_TRACE_RECORD_SIZEB))
+            return I8080_TRACE_ERROR;
+        memcpy (prev, &reader->buf[reader->pos + 1], I8080_TRACE_RECORD_SIZEB);
+        reader->pos += 1 + I8080_TRACE_RECORD_SIZEB;
+        reader->keyed = 1;
+        *rec = *prev;
+        reader->records++;
+        return I8080_TRACE_STATE;
+    }
+
+    /* a delta needs the record before it, decoding starts at a keyframe */
+    if (!(tag & I8080_TRACE_DELTA) || !reader->keyed)
+        return I8080_TRACE_ERROR;
+
+    if (tag & 0x01) {
+        if (!reader_fill (reader, 2))
+            return I8080_TRACE_ERROR;
+        mask = reader->buf[reader->pos + 1];
+    }
+    if (!reader_fill (reader, delta_sizeb (tag, mask)))
+        return I8080_TRACE_ERROR;
+
+    p = &reader->buf[reader->pos + 1 + (tag & 0x01)];
+    for (i = 0; i < 6; i++) {
+        if (mask & (1 << i))
+            r[i] = *p++;
+    }
+    if (tag & 0x04)
+        prev->a = *p++;
+    if (tag & 0x08)
+        prev->psw = *p++;
+    if (tag & 0x10) {
+        prev->sph = p[0];
+        prev->spl = p[1];
+        p += 2;
+    }
+    pc = ((prev->pch << 8) | prev->pcl);
+    if (((tag >> 5) & 3) == 3 && (tag & 0x02)) {
+        pc += (int8_t)p[0];
+        p += 1;
+    } else if (((tag >> 5) & 3) == 3) {
+        pc = ((p[0] << 8) | p[1]);
+        p += 2;
+    } else {
+        pc += ((tag >> 5) & 3) + 1;
+    }
+    prev->pch = (pc >> 8);
+    prev->pcl = (pc & 0xff);
+
+    *rec = *prev;
+    reader->pos = (p - reader->buf);
+    reader->records++;
+    return I8080_TRACE_STATE;
+}
+
+int i8080_trace_read (struct i8080_trace_reader* reader, struct i8080_trace_record* rec)
+{
+    if (reader->format == I8080_TRACE_FORMAT_TEXT)
+        return read_text_trace (reader, rec);
+
+    if (!reader_fill (reader, 1))
+        return I8080_TRACE_EOF;
+
+    if (reader->buf[reader->pos] == I8080_TRACE_TEXT_MARKER) {
+        if (!reader_fill (reader, 3))
+            return I8080_TRACE_ERROR;
+        reader->text_len = (reader->buf[reader->pos + 1] | (reader->buf[reader->pos + 2] << 8));
+        if (!reader_fill (reader, 3 + reader->text_len))
+            return I8080_TRACE_ERROR;
+        memcpy (reader->text, &reader->buf[reader->pos + 3], reader->text_len);
+        reader->pos += 3 + reader->text_len;
+        return I8080_TRACE_TEXT;
+    }
+
+    if (reader->format == I8080_TRACE_FORMAT_DELTA)
+        return read_delta (reader, rec);
+
+    if (!reader_fill (reader, I8080_TRACE_RECORD_SIZEB))
+        return I8080_TRACE_ERROR;
+
+    memcpy (rec, &reader->buf[reader->pos], I8080_TRACE_RECORD_SIZEB);
+    reader->pos += I8080_TRACE_RECORD_SIZEB;
+    reader->records++;
+
+    return I8080_TRACE_STATE;
+}
+
+int i8080_trace_format (const struct i8080_trace_record* rec, char* buf)
+{
+    return sprintf (buf, "{%d %d %d %d %d} %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
+                    (rec->psw >> 0) & 1, (rec->psw >> 4) & 1, (rec->psw >> 6) & 1,
+                    (rec->psw >> 2) & 1, (rec->psw >> 7) & 1,
+                    rec->b, rec->c, rec->d, rec->e, rec->h, rec->l, rec->a,
+                    rec->sph, rec->spl, rec->pch, rec->pcl);
+}
+
+static int parse_hex (const char** p, const char* end, uint8_t* val)
+{
+    int i;
+
+    *val = 0;
+    while (*p < end && **p == ' ')
+        (*p)++;
+    for (i = 0; i < 2; i++, (*p)++) {
+        const char ch = (*p < end) ? **p : '\0';
+
+        if (ch >= '0' && ch <= '9')
+            *val = (*val << 4) | (ch - '0');
+        else if (ch >= 'a' && ch <= 'f')
+            *val = (*val << 4) | (ch - 'a' + 10);
+        else if (ch >= 'A' && ch <= 'F')
+            *val = (*val << 4) | (ch - 'A' + 10);
+        else
+            return 0;
+    }
+    return 1;
+}
+
+int i8080_trace_parse (const char* text, const size_t len, struct i8080_trace_record* rec)
+{
+    /* flag order of the text format and their PSW bits */
+    static const uint8_t flag_bit[5] = {
+        I8080_FLAG_CY, I8080_FLAG_AC, I8080_FLAG_Z, I8080_FLAG_P, I8080_FLAG_S
+    };
+    uint8_t* const regs[11] = {
+        &rec->b, &rec->c, &rec->d, &rec->e, &rec->h, &rec->l, &rec->a,
+        &rec->sph, &rec->spl, &rec->pch, &rec->pcl
+    };
+    const char* p = text;
+    const char* const end = text + len;
+    int i;
+
+    if (p == end || *p++ != '{')
+        return 0;
+
+    rec->psw = I8080_FLAG_ONE;
+    for (i = 0; i < 5; i++) {
+        while (p < end && *p == ' ')
+            p++;
+        if (p == end || (*p != '0' && *p != '1'))
+            return 0;
+        if (*p++ == '1')
+            rec->psw |= flag_bit[i];
+    }
+    while (p < end && *p == ' ')
+        p++;
+    if (p == end || *p++ != '}')
+        return 0;
+
+    for (i = 0; i < 11; i++) {
+        if (!parse_hex (&p, end, regs[i]))
+            return 0;
+    }
+    return 1;
+}
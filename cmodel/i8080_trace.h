@@ -0,0 +1,239 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Binary state trace.
+
+  File layout: an 8 byte header ("I8TR", version, format, record size,
+  log2 of the keyframe interval) followed by a stream of items:
+
+    state record : 12 bytes, psw b c d e h l a sph spl pch pcl
+    text record  : 0x00, length (16-bit little endian), length bytes;
+                   longer text is written as consecutive text records
+
+  The first byte of a state record is the PSW as pushed by PUSH PSW, which
+  always has bit 1 set, so a leading 0x00 unambiguously marks text (e.g. the
+  BDOS output that is interleaved with the RTL traces).
+
+  The delta format replaces the state records with
+
+    keyframe     : 0x01, the 12 byte state record
+    delta        : tag, then the changed fields: [mask, B..L], A, PSW, SP, PC
+
+  where the tag is 1ppsfajm: bits 6-5 the PC step (+1, +2, +3, or 3 = the
+  PC follows, as a signed 8-bit step if bit 1 is set and as a 16-bit
+  address otherwise), bit 4 SP follows, bit 3 PSW follows, bit 2 A follows
+  and bit 0 a mask byte follows with bits 0-5 for B C D E H L. Every
+  I8080_TRACE_KEYFRAME_INTERVAL-th record is a keyframe, so a reader can
+  start at any keyframe.
+
+  The reader also takes the text traces of the RTL test benches (any file
+  without the header): lines starting with '{' are state records, every
+  other line is returned as text.
+*/
+
+#ifndef __I8080_TRACE_H__
+#define __I8080_TRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "i8080.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define I8080_TRACE_MAGIC        "I8TR"
+#define I8080_TRACE_VERSION      1
+#define I8080_TRACE_FORMAT_RAW   0
+#define I8080_TRACE_FORMAT_DELTA 1
+#define I8080_TRACE_FORMAT_TEXT  0xff /* reader only, RTL text trace */
+#define I8080_TRACE_HEADER_SIZEB 8
+#define I8080_TRACE_RECORD_SIZEB 12
+#define I8080_TRACE_TEXT_MARKER  0x00
+#define I8080_TRACE_KEYFRAME     0x01
+#define I8080_TRACE_DELTA        0x80
+
+#define I8080_TRACE_KEYFRAME_LOG2     12
+#define I8080_TRACE_KEYFRAME_INTERVAL (1 << I8080_TRACE_KEYFRAME_LOG2)
+
+#define I8080_TRACE_BUFFER_SIZEB (1024*1024)
+
+/* Index side-file ("trace.idx"): a 16 byte header ("I8IX", version, 0 x3,
+   interval, 0 as 32-bit little endian) followed by one entry per interval
+   records, four 64-bit little endian words each, pointing at a record the
+   reader can start from (a keyframe in delta traces). cycles is only known
+   when the cmodel writes the index while tracing, UINT64_MAX otherwise. */
+#define I8080_TRACE_INDEX_MAGIC    "I8IX"
+#define I8080_TRACE_INDEX_VERSION  1
+#define I8080_TRACE_INDEX_HEADER_SIZEB 16
+
+struct i8080_trace_index_entry
+{
+    uint64_t record;  /* state records before this one */
+    uint64_t offset;  /* byte offset of the record in the trace */
+    uint64_t line;    /* text traces: lines before the record */
+    uint64_t cycles;  /* state->cycles when the record was written */
+};
+
+struct i8080_trace_index
+{
+    uint32_t interval;
+    size_t count;
+    struct i8080_trace_index_entry* entry;
+};
+
+/* reader results */
+#define I8080_TRACE_EOF    0
+#define I8080_TRACE_STATE  1
+#define I8080_TRACE_TEXT   2
+#define I8080_TRACE_ERROR -1
+
+struct i8080_trace_record
+{
+    uint8_t psw;
+    uint8_t b;
+    uint8_t c;
+    uint8_t d;
+    uint8_t e;
+    uint8_t h;
+    uint8_t l;
+    uint8_t a;
+    uint8_t sph;
+    uint8_t spl;
+    uint8_t pch;
+    uint8_t pcl;
+};
+
+struct i8080_trace
+{
+    FILE* fp;
+    uint8_t* buf;
+    size_t pos;
+    uint64_t records;
+    int format;                       /* I8080_TRACE_FORMAT_RAW or _DELTA */
+    struct i8080_trace_record prev;   /* delta: last record written */
+    uint64_t written;                 /* bytes flushed to fp */
+    uint64_t cycles;                  /* of the state being written, for the index */
+    FILE* index;                      /* NULL = no index side-file */
+};
+
+struct i8080_trace_reader
+{
+    FILE* fp;
+    uint8_t* buf;
+    size_t pos;
+    size_t len;
+    uint64_t base;  /* file offset of buf[0] */
+    uint64_t records;
+    int format;     /* I8080_TRACE_FORMAT_xxx */
+    struct i8080_trace_record prev; /* delta: last record read */
+    int keyed;      /* delta: prev holds a decoded record */
+    uint64_t line;  /* text traces: line of the last item read */
+    char text[0x10000];
+    uint16_t text_len;
+};
+
+struct i8080_trace* i8080_trace_create (const char* const filename);
+struct i8080_trace* i8080_trace_create_format (const char* const filename, const int format);
+void i8080_trace_destroy (struct i8080_trace* trace);
+void i8080_trace_flush (struct i8080_trace* trace);
+void i8080_trace_text (struct i8080_trace* trace, const char* text, const size_t len);
+
+/* append a state record, in either format */
+void i8080_trace_write (struct i8080_trace* trace, const struct i8080_trace_record* rec);
+
+/* also write an index side-file (with cycle counts) while tracing; call
+   before the first record */
+int i8080_trace_index_create (struct i8080_trace* trace, const char* const filename);
+void i8080_trace_index_add (struct i8080_trace* trace);
+
+struct i8080_trace_reader* i8080_trace_reader_open (const char* const filename);
+void i8080_trace_reader_close (struct i8080_trace_reader* reader);
+int i8080_trace_read (struct i8080_trace_reader* reader, struct i8080_trace_record* rec);
+
+/* byte offset of the next item, and a jump to an index entry */
+uint64_t i8080_trace_reader_tell (const struct i8080_trace_reader* reader);
+int i8080_trace_reader_seek (struct i8080_trace_reader* reader, const struct i8080_trace_index_entry* entry);
+
+/* index of an existing trace (no cycle counts), interval is rounded up to
+   a multiple of the keyframe interval for delta traces */
+int i8080_trace_index_build (const char* const trace_file, const char* const index_file, uint32_t interval);
+struct i8080_trace_index* i8080_trace_index_load (const char* const filename);
+void i8080_trace_index_free (struct i8080_trace_index* index);
+
+/* last entry at or before record / cycle count, NULL if none */
+const struct i8080_trace_index_entry* i8080_trace_index_find (const struct i8080_trace_index* index, const uint64_t record);
+const struct i8080_trace_index_entry* i8080_trace_index_find_cycle (const struct i8080_trace_index* index, const uint64_t cycles);
+
+/* "{cy ac z p s} bb cc dd ee hh ll aa sh sl ph pl", as produced by the RTL
+   test benches; buf must hold at least 48 bytes */
+int i8080_trace_format (const struct i8080_trace_record* rec, char* buf);
+
+/* the reverse of i8080_trace_format(), 0 if text is not a state line */
+int i8080_trace_parse (const char* text, const size_t len, struct i8080_trace_record* rec);
+
+static inline void i8080_trace_state (struct i8080_trace* trace, const struct i8080_state* state)
+{
+    struct i8080_trace_record rec;
+    uint8_t* p;
+
+    trace->cycles = state->cycles;
+
+    if (trace->format != I8080_TRACE_FORMAT_RAW) {
+        p = &rec.psw;
+    } else {
+        if (trace->pos + I8080_TRACE_RECORD_SIZEB > I8080_TRACE_BUFFER_SIZEB)
+            i8080_trace_flush (trace);
+        p = &trace->buf[trace->pos];
+    }
+
+    p[0]  = state->f;
+    p[1]  = state->b;
+    p[2]  = state->c;
+    p[3]  = state->d;
+    p[4]  = state->e;
+    p[5]  = state->h;
+    p[6]  = state->l;
+    p[7]  = state->a;
+    p[8]  = (state->sp >> 8);
+    p[9]  = (state->sp & 0xff);
+    p[10] = (state->pc >> 8);
+    p[11] = (state->pc & 0xff);
+
+    if (trace->format != I8080_TRACE_FORMAT_RAW) {
+        i8080_trace_write (trace, &rec);
+        return;
+    }
+    if (trace->index && (trace->records % I8080_TRACE_KEYFRAME_INTERVAL) == 0)
+        i8080_trace_index_add (trace);
+    trace->pos += I8080_TRACE_RECORD_SIZEB;
+    trace->records++;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*  __I8080_TRACE_H__ */
@@ -23,8 +23,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "i8080.h"
+#include "i8080_trace.h"
+
+/* echo guest console output to stdout and, when tracing, into the trace */
+static void console_write (struct i8080_state* state, const char* text, const size_t len)
+{
+    fwrite (text, 1, len, stdout);
+    if (state->trace)
+        i8080_trace_text (state->trace, text, len);
+}
 
 static int instr_handler (struct i8080_state* state)
 {
@@ -32,17 +43,21 @@ static int instr_handler (struct i8080_state* state)
         switch (state->c) {
             case 0x2: { /* BDOS: C_WRITE */
                 /* e = char to write */
-                putchar (state->e);
+                char ch = state->e;
+                console_write (state, &ch, 1);
                 break;
             }
             case 0x9: { /* BDOS: C_WRITESTR */
                 /* de = address of string */
                 uint16_t de = (((uint8_t)state->d << 8 ) | ((uint8_t)state->e << 0));
-                while (state->mem[de] != '$') {
-                    putchar (state->mem[de]);
+                char str[0x10000];
+                size_t len = 0;
+                while (state->mem[de] != '$' && len < sizeof(str) - 1) {
+                    str[len++] = state->mem[de];
                     de++;
                 }
-                putchar('\n');
+                str[len++] = '\n';
+                console_write (state, str, len);
                 break;
             }
             default: {
@@ -59,16 +74,95 @@ static int instr_handler (struct i8080_state* state)
     return -1;
 }
 
-int main ()
+static void usage (const char* prog)
+{
+    fprintf (stderr, "usage: %s [-e switch|threaded|bbcache] [-t trace.bin] [-d] [-x] [-p name]\n", prog);
+    fprintf (stderr, "  -d : write the trace in the delta format\n");
+    fprintf (stderr, "  -x : also write the trace index (trace.bin.idx)\n");
+    fprintf (stderr, "  -p name : write the opcode profile to name.csv and name.json,\n");
+    fprintf (stderr, "            the PC histogram to name_pc.csv\n");
+    exit (-1);
+}
+
+int main (int argc, char** argv)
 {
-    uint8_t* ram = (uint8_t*)malloc (0x10000 /* 64kiB */);
-    struct i8080_state* state = i8080_create (ram, 0x10000 /* 64kiB */);
+    int opt;
+    int rc;
+    int engine = I8080_ENGINE_SWITCH;
+    const char* trace_file = NULL;
+    int trace_format = I8080_TRACE_FORMAT_RAW;
+    int trace_index = 0;
+    const char* profile_name = NULL;
+    uint8_t* ram;
+    struct i8080_state* state;
+    struct i8080_trace* trace = NULL;
+    struct i8080_profile* profile = NULL;
+
+    while ((opt = getopt (argc, argv, "e:t:dxp:")) != -1) {
+        switch (opt) {
+            case 'e': {
+                if (!strcmp (optarg, "switch"))
+                    engine = I8080_ENGINE_SWITCH;
+                else if (!strcmp (optarg, "threaded"))
+                    engine = I8080_ENGINE_THREADED;
+                else if (!strcmp (optarg, "bbcache"))
+                    engine = I8080_ENGINE_BBCACHE;
+                else
+                    usage (argv[0]);
+                break;
+            }
+            case 't': trace_file = optarg; break;
+            case 'd': trace_format = I8080_TRACE_FORMAT_DELTA; break;
+            case 'x': trace_index = 1; break;
+            case 'p': profile_name = optarg; break;
+            default: usage (argv[0]);
+        }
+    }
+
+    ram = (uint8_t*)malloc (0x10000 /* 64kiB */);
+    state = i8080_create_engine (ram, 0x10000 /* 64kiB */, engine);
 
     i8080_load_memory (state, 0x0000, "cpudiag_mod.bin");
     i8080_set_pc (state, 0x0000);
     i8080_set_instr_handler (state, instr_handler);
 
-    while (!i8080_exec (state)) {
+    if (trace_file) {
+        if (NULL == (trace = i8080_trace_create_format (trace_file, trace_format)))
+            exit (-1);
+        if (trace_index) {
+            char index_file[4096];
+
+            snprintf (index_file, sizeof(index_file), "%s.idx", trace_file);
+            if (i8080_trace_index_create (trace, index_file) < 0)
+                exit (-1);
+        }
+        i8080_set_trace (state, trace);
+    }
+
+    if (profile_name) {
+        if (NULL == (profile = i8080_profile_create ()) || i8080_profile_enable_pc (profile) < 0)
+            exit (-1);
+        i8080_set_profile (state, profile);
+    }
+
+    while ((rc = i8080_run (state, UINT64_MAX)) == I8080_RUN_BUDGET) {
+    }
+
+    if (rc == I8080_RUN_HALT && trace == NULL)
+        printf ("HLT\n");
+
+    i8080_trace_destroy (trace);
+
+    if (profile) {
+        char name[4096];
+
+        snprintf (name, sizeof(name), "%s.csv", profile_name);
+        i8080_profile_write_csv (profile, name);
+        snprintf (name, sizeof(name), "%s.json", profile_name);
+        i8080_profile_write_json (profile, name);
+        snprintf (name, sizeof(name), "%s_pc.csv", profile_name);
+        i8080_profile_write_pc_csv (profile, name);
+        i8080_profile_destroy (profile);
     }
 
     return 0;
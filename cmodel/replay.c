@@ -0,0 +1,231 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/* Replay a log of IN values and interrupts (see i8080_replay.h) with no
+   devices attached and check that the run ends in the recorded state.
+   The machine named in the log sets up the memory:
+
+     invaders  8kiB ROM at 0000, 8kiB RAM at 2000 mirrored up to ffff
+     flat      64kiB RAM, the program loaded at 0000
+
+   A trace of the replay (-t) can be compared with tracecmp or cut with
+   tracewin, which is how a logged field run is debugged. An invaders
+   replay can also be watched or recorded: every FRAME_CYCLES -S publishes
+   the video RAM to a shared memory frame ring (see invaders/fbring.h) and
+   -V streams it to a video file (see invaders/vstream.h). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i8080.h"
+#include "i8080_trace.h"
+#include "i8080_replay.h"
+#include "fbring.h"
+#include "vstream.h"
+
+#define SLICE_CYCLES 1000000
+#define FRAME_CYCLES 16667 /* the interrupt period of the arcade board */
+#define VRAM         0x2400
+
+static void usage (const char* prog)
+{
+    fprintf (stderr, "usage: %s [-e switch|threaded|bbcache] [-i image] [-t trace.bin] [-d] [-S name] log\n", prog);
+    fprintf (stderr, "  -i FILE : ROM or program image (default ../tb/invaders.rom)\n");
+    fprintf (stderr, "  -t FILE : write a state trace of the replay, -d in the delta format\n");
+    fprintf (stderr, "  -S NAME : publish the video RAM of an invaders log to the frame ring NAME\n");
+    fprintf (stderr, "  -V FILE : stream it to FILE.y4m, FILE.gray or FILE.vram, -D N keeping every Nth\n");
+    fprintf (stderr, "exit status 0 = replayed exactly, 1 = diverged, 2 = error\n");
+    exit (2);
+}
+
+static int setup (struct i8080_state* state, const char* machine, const char* image)
+{
+    uint16_t addr;
+
+    if (!strcmp (machine, "invaders")) {
+        i8080_load_memory (state, 0x0000, image);
+        i8080_map (state, 0x0000, 0x2000, state->mem, I8080_PAGE_ROM);
+        for (addr = 0x2000; addr != 0; addr += 0x2000)
+            i8080_map (state, addr, 0x2000, &state->mem[0x2000], I8080_PAGE_RAM);
+        return 0;
+    }
+    if (!strcmp (machine, "flat")) {
+        i8080_load_memory (state, 0x0000, image);
+        return 0;
+    }
+    fprintf (stderr, "Error: unknown machine %s\n", machine);
+    return -1;
+}
+
+struct frames
+{
+    struct invaders_fb* fb;
+    struct invaders_vstream* vs;
+    int failed;     /* writing the video stream failed, the replay stops */
+};
+
+/* an event every FRAME_CYCLES, which leaves the replayed state alone */
+static void publish_frame (struct i8080_state* state, void* ctx, const uint64_t when)
+{
+    struct frames* f = ctx;
+
+    if (f->fb)
+        invaders_fb_publish (f->fb, &state->mem[VRAM], when / FRAME_CYCLES);
+    if (f->vs && invaders_vstream_frame (f->vs, &state->mem[VRAM]) < 0) {
+        f->failed = 1;
+        i8080_stop (state);
+        return;
+    }
+    i8080_schedule (state, when + FRAME_CYCLES, publish_frame, f);
+}
+
+int main (int argc, char** argv)
+{
+    struct i8080_replay_header header;
+    struct i8080_replay* replay;
+    struct i8080_state* state;
+    struct i8080_trace* trace = NULL;
+    struct frames frames = { NULL, NULL, 0 };
+    struct timespec t0;
+    struct timespec t1;
+    int engine = I8080_ENGINE_SWITCH;
+    const char* image = "../tb/invaders.rom";
+    const char* trace_file = NULL;
+    const char* fb_name = NULL;
+    const char* video_file = NULL;
+    unsigned decimate = 1;
+    int result = 0;
+    int trace_format = I8080_TRACE_FORMAT_RAW;
+    uint64_t start;
+    double secs;
+    uint8_t* ram;
+    int rc = I8080_RUN_BUDGET;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "e:i:t:dS:V:D:h")) != -1) {
+        switch (opt) {
+            case 'e': {
+                if (!strcmp (optarg, "switch"))
+                    engine = I8080_ENGINE_SWITCH;
+                else if (!strcmp (optarg, "threaded"))
+                    engine = I8080_ENGINE_THREADED;
+                else if (!strcmp (optarg, "bbcache"))
+                    engine = I8080_ENGINE_BBCACHE;
+                else
+                    usage (argv[0]);
+                break;
+            }
+            case 'i': image = optarg; break;
+            case 't': trace_file = optarg; break;
+            case 'd': trace_format = I8080_TRACE_FORMAT_DELTA; break;
+            case 'S': fb_name = optarg; break;
+            case 'V': video_file = optarg; break;
+            case 'D': decimate = strtoul (optarg, NULL, 0); break;
+            default: usage (argv[0]);
+        }
+    }
+    if ((argc - optind) != 1)
+        usage (argv[0]);
+
+    if (i8080_replay_info (argv[optind], &header) < 0)
+        return 2;
+
+    ram = (uint8_t*)malloc (0x10000 /* 64kiB */);
+    if (NULL == (state = i8080_create_engine (ram, 0x10000 /* 64kiB */, engine)))
+        return 2;
+    if (setup (state, header.machine, image) < 0)
+        return 2;
+
+    /* the recording may have started later, but not from another state */
+    if (header.start_instructions || header.start_cycles) {
+        fprintf (stderr, "Error: %s starts at instruction %llu, replays start at reset\n", argv[optind],
+                 (unsigned long long)header.start_instructions);
+        return 2;
+    }
+    if (NULL == (replay = i8080_replay_play (state, argv[optind])))
+        return 2;
+
+    if (trace_file) {
+        if (NULL == (trace = i8080_trace_create_format (trace_file, trace_format)))
+            return 2;
+        i8080_set_trace (state, trace);
+    }
+
+    if (fb_name || video_file) {
+        if (strcmp (header.machine, "invaders")) {
+            fprintf (stderr, "Error: -S and -V need an invaders log, %s is a %s log\n", argv[optind], header.machine);
+            return 2;
+        }
+        if (fb_name && NULL == (frames.fb = invaders_fb_create (fb_name)))
+            return 2;
+        if (video_file && NULL == (frames.vs = invaders_vstream_create (video_file, 1, decimate)))
+            return 2;
+        i8080_schedule (state, FRAME_CYCLES, publish_frame, &frames);
+    }
+
+    /* to the recorded end, or while items are left in a log never closed */
+    start = state->instructions;
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    while (rc == I8080_RUN_BUDGET || rc == I8080_RUN_HALT) {
+        uint64_t budget = SLICE_CYCLES;
+
+        if (header.end_instructions) {
+            if (state->cycles >= header.end_cycles)
+                break;
+            if (budget > header.end_cycles - state->cycles)
+                budget = header.end_cycles - state->cycles;
+        } else if (replay->kind == 0) {
+            break;
+        }
+        rc = i8080_run (state, budget);
+    }
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+
+    if (rc == I8080_RUN_ERROR)
+        fprintf (stderr, "Error: unknown opcode or PC out of range at %04x\n", state->pc);
+    if (frames.failed)
+        fprintf (stderr, "Error: replay stopped at cycle %llu, the video stream could not be written\n",
+                 (unsigned long long)state->cycles);
+
+    printf ("%s log: %llu items, %llu instructions, %llu cycles in %.3f s (%.1f MIPS)\n", header.machine,
+            (unsigned long long)replay->items, (unsigned long long)(state->instructions - start),
+            (unsigned long long)state->cycles, secs, (state->instructions - start) / (secs * 1e6));
+
+    i8080_trace_destroy (trace);
+    invaders_fb_close (frames.fb);
+    if (frames.vs) {
+        printf ("%llu frames to %s, replay stalled %.3f s\n", (unsigned long long)invaders_vstream_frames (frames.vs),
+                video_file, invaders_vstream_stall_secs (frames.vs));
+        if (invaders_vstream_close (frames.vs) < 0)
+            result = 1;
+    }
+    if (i8080_replay_close (replay) < 0 || rc == I8080_RUN_ERROR || frames.failed)
+        return 1;
+    printf ("replayed exactly\n");
+    return result;
+}
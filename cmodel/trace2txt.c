@@ -0,0 +1,62 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/* Convert a binary state trace (i8080 -t) back to the text format used by
+   the RTL test benches, so the traces can still be diffed as before. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "i8080.h"
+#include "i8080_trace.h"
+
+int main (int argc, char** argv)
+{
+    int rc;
+    char line[64];
+    struct i8080_trace_record rec;
+    struct i8080_trace_reader* reader;
+
+    if (argc != 2) {
+        fprintf (stderr, "usage: %s trace.bin\n", argv[0]);
+        return -1;
+    }
+
+    if (NULL == (reader = i8080_trace_reader_open (argv[1])))
+        return -1;
+
+    while ((rc = i8080_trace_read (reader, &rec)) != I8080_TRACE_EOF) {
+        if (rc == I8080_TRACE_STATE) {
+            fwrite (line, 1, i8080_trace_format (&rec, line), stdout);
+        } else if (rc == I8080_TRACE_TEXT) {
+            fwrite (reader->text, 1, reader->text_len, stdout);
+        } else {
+            fprintf (stderr, "Error: %s is truncated\n", argv[1]);
+            i8080_trace_reader_close (reader);
+            return -1;
+        }
+    }
+
+    i8080_trace_reader_close (reader);
+    return 0;
+}
@@ -0,0 +1,209 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/* Compare two state traces record by record and report the first
+   divergence. Each trace may be binary (i8080 -t) or an RTL text trace;
+   text lines other than state records (BDOS output) are skipped. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "i8080.h"
+#include "i8080_trace.h"
+
+#define CONTEXT_MAX 1024
+
+struct source
+{
+    const char* name;
+    struct i8080_trace_reader* reader;
+    uint64_t line; /* text traces: line of the last record */
+};
+
+/* next state record, 0 at the end, -1 on error */
+static int next_record (struct source* src, struct i8080_trace_record* rec)
+{
+    int rc;
+
+    while ((rc = i8080_trace_read (src->reader, rec)) == I8080_TRACE_TEXT)
+        ;
+
+    if (rc == I8080_TRACE_ERROR) {
+        fprintf (stderr, "Error: %s is truncated or malformed\n", src->name);
+        return -1;
+    }
+    src->line = src->reader->line;
+    return (rc == I8080_TRACE_STATE);
+}
+
+static int same (const struct i8080_trace_record* x, const struct i8080_trace_record* y)
+{
+    /* PSW bits 1, 3 and 5 are fixed and not in the RTL text traces */
+    return ((x->psw & I8080_FLAG_MASK) == (y->psw & I8080_FLAG_MASK) &&
+            !memcmp (&x->b, &y->b, I8080_TRACE_RECORD_SIZEB - 1));
+}
+
+static void print_record (const char* tag, const uint64_t index, const struct i8080_trace_record* rec)
+{
+    char line[64];
+
+    i8080_trace_format (rec, line);
+    printf ("%s %10llu  %s", tag, (unsigned long long)index, line);
+}
+
+static void print_diff (const struct i8080_trace_record* x, const struct i8080_trace_record* y)
+{
+    static const struct { const char* name; uint8_t flag; } flags[5] = {
+        { "cy", I8080_FLAG_CY }, { "ac", I8080_FLAG_AC }, { "z", I8080_FLAG_Z },
+        { "p", I8080_FLAG_P }, { "s", I8080_FLAG_S }
+    };
+    static const char* const names[7] = { "b", "c", "d", "e", "h", "l", "a" };
+    const uint8_t* const rx = &x->b;
+    const uint8_t* const ry = &y->b;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+        if ((x->psw ^ y->psw) & flags[i].flag)
+            printf ("  %-4s %d -> %d\n", flags[i].name, !!(x->psw & flags[i].flag), !!(y->psw & flags[i].flag));
+    }
+    for (i = 0; i < 7; i++) {
+        if (rx[i] != ry[i])
+            printf ("  %-4s %02x -> %02x\n", names[i], rx[i], ry[i]);
+    }
+    if (x->sph != y->sph || x->spl != y->spl)
+        printf ("  %-4s %02x%02x -> %02x%02x\n", "sp", x->sph, x->spl, y->sph, y->spl);
+    if (x->pch != y->pch || x->pcl != y->pcl)
+        printf ("  %-4s %02x%02x -> %02x%02x\n", "pc", x->pch, x->pcl, y->pch, y->pcl);
+}
+
+static void usage (const char* prog)
+{
+    fprintf (stderr, "usage: %s [-n context] trace-a trace-b\n", prog);
+    fprintf (stderr, "  -n N : records of context before and after the divergence (default 8)\n");
+    fprintf (stderr, "exit status 0 = identical, 1 = different, 2 = error\n");
+}
+
+int main (int argc, char** argv)
+{
+    static struct i8080_trace_record history[CONTEXT_MAX];
+    struct i8080_trace_record ra;
+    struct i8080_trace_record rb;
+    struct i8080_trace_record prev;
+    struct source a;
+    struct source b;
+    uint64_t index = 0;
+    int context = 8;
+    int result = 0;
+    int ea;
+    int eb;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "n:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                context = atoi (optarg);
+                context = (context < 0) ? 0 : (context > CONTEXT_MAX) ? CONTEXT_MAX : context;
+                break;
+            default:
+                usage (argv[0]);
+                return 2;
+        }
+    }
+    if ((argc - optind) != 2) {
+        usage (argv[0]);
+        return 2;
+    }
+
+    memset (&prev, 0, sizeof(prev));
+    memset (&a, 0, sizeof(a));
+    memset (&b, 0, sizeof(b));
+    a.name = argv[optind];
+    b.name = argv[optind + 1];
+    if (NULL == (a.reader = i8080_trace_reader_open (a.name)) ||
+        NULL == (b.reader = i8080_trace_reader_open (b.name))) {
+        i8080_trace_reader_close (a.reader);
+        return 2;
+    }
+
+    for (;;) {
+        ea = next_record (&a, &ra);
+        eb = next_record (&b, &rb);
+        if (ea < 0 || eb < 0) {
+            result = 2;
+            break;
+        }
+        if (!ea || !eb || !same (&ra, &rb))
+            break;
+        if (context)
+            history[index % context] = ra;
+        prev = ra;
+        index++;
+    }
+
+    if (result == 0 && (ea || eb)) {
+        const uint64_t first = (index > (uint64_t)context) ? (index - context) : 0;
+        uint64_t k;
+
+        result = 1;
+        printf ("first divergence at record %llu", (unsigned long long)index);
+        if (ea && a.reader->format == I8080_TRACE_FORMAT_TEXT)
+            printf (", %s line %llu", a.name, (unsigned long long)a.line);
+        if (eb && b.reader->format == I8080_TRACE_FORMAT_TEXT)
+            printf (", %s line %llu", b.name, (unsigned long long)b.line);
+        printf ("\n");
+
+        /* a record is the state before its instruction, so the previous
+           instruction produced the difference */
+        if (index > 0) {
+            printf ("after the instruction at pc %02x%02x (record %llu)\n",
+                    prev.pch, prev.pcl, (unsigned long long)(index - 1));
+        }
+
+        if (ea && eb) {
+            printf ("%s -> %s:\n", a.name, b.name);
+            print_diff (&ra, &rb);
+        } else {
+            printf ("%s ends after %llu records\n", ea ? b.name : a.name, (unsigned long long)index);
+        }
+
+        printf ("\n");
+        for (k = first; k < index; k++)
+            print_record (" ", k, &history[k % context]);
+        for (k = index; k < index + context + 1 && ea > 0; k++) {
+            print_record ("<", k, &ra);
+            ea = next_record (&a, &ra);
+        }
+        for (k = index; k < index + context + 1 && eb > 0; k++) {
+            print_record (">", k, &rb);
+            eb = next_record (&b, &rb);
+        }
+    } else if (result == 0) {
+        printf ("%llu records identical\n", (unsigned long long)index);
+    }
+
+    i8080_trace_reader_close (a.reader);
+    i8080_trace_reader_close (b.reader);
+    return result;
+}
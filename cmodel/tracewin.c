@@ -0,0 +1,209 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/* Print a window of a state trace around a record, the first record at a
+   PC, or a cycle time, without reading the trace from the start: the
+   reader seeks to the nearest entry of the index side-file (trace.idx),
+   which is built on first use if missing or older than the trace. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "i8080.h"
+#include "i8080_trace.h"
+
+static void print_record (const char* tag, const uint64_t index, const struct i8080_trace_record* rec)
+{
+    char line[64];
+
+    i8080_trace_format (rec, line);
+    printf ("%s %10llu  %s", tag, (unsigned long long)index, line);
+}
+
+/* next state record, 0 at the end, -1 on error */
+static int next_record (struct i8080_trace_reader* reader, struct i8080_trace_record* rec)
+{
+    int rc;
+
+    while ((rc = i8080_trace_read (reader, rec)) == I8080_TRACE_TEXT)
+        ;
+
+    if (rc == I8080_TRACE_ERROR) {
+        fprintf (stderr, "Error: trace is truncated or malformed\n");
+        return -1;
+    }
+    return (rc == I8080_TRACE_STATE);
+}
+
+/* reader positioned at the nearest indexed record at or before record */
+static int seek_record (struct i8080_trace_reader* reader, const struct i8080_trace_index* index, const uint64_t record)
+{
+    const struct i8080_trace_index_entry* entry = i8080_trace_index_find (index, record);
+
+    if (entry == NULL)
+        return 0;
+    return i8080_trace_reader_seek (reader, entry);
+}
+
+/* skip to record, returns next_record() of it */
+static int skip_to (struct i8080_trace_reader* reader, const uint64_t record, struct i8080_trace_record* rec)
+{
+    int rc;
+
+    while ((rc = next_record (reader, rec)) > 0 && (reader->records - 1) < record)
+        ;
+    return rc;
+}
+
+static int index_fresh (const char* trace_file, const char* index_file)
+{
+    struct stat ts;
+    struct stat is;
+
+    if (stat (trace_file, &ts) != 0 || stat (index_file, &is) != 0)
+        return 0;
+    return (is.st_mtime >= ts.st_mtime);
+}
+
+static void usage (const char* prog)
+{
+    fprintf (stderr, "usage: %s [-r record] [-p pc] [-c cycles] [-n context] [-i interval] [-f] trace\n", prog);
+    fprintf (stderr, "  -r N : record N (default 0), with -p where the search starts\n");
+    fprintf (stderr, "  -p X : first record with pc X (hex)\n");
+    fprintf (stderr, "  -c N : indexed record nearest to cycle time N (index written by i8080 -x)\n");
+    fprintf (stderr, "  -n N : records of context before and after (default 8)\n");
+    fprintf (stderr, "  -i N : records per index entry when building the index\n");
+    fprintf (stderr, "  -f   : rebuild the index\n");
+}
+
+int main (int argc, char** argv)
+{
+    struct i8080_trace_reader* reader;
+    struct i8080_trace_index* index;
+    struct i8080_trace_record rec;
+    const char* trace_file;
+    char index_file[4096];
+    uint64_t record = 0;
+    uint64_t cycles = 0;
+    uint64_t first;
+    uint64_t k;
+    uint32_t interval = 0;
+    int context = 8;
+    int pc = -1;
+    int by_cycles = 0;
+    int rebuild = 0;
+    int result = 0;
+    int rc;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "r:p:c:n:i:fh")) != -1) {
+        switch (opt) {
+            case 'r': record = strtoull (optarg, NULL, 0); break;
+            case 'p': pc = (strtoul (optarg, NULL, 16) & 0xffff); break;
+            case 'c': cycles = strtoull (optarg, NULL, 0); by_cycles = 1; break;
+            case 'n': context = atoi (optarg); context = (context < 0) ? 0 : context; break;
+            case 'i': interval = strtoul (optarg, NULL, 0); break;
+            case 'f': rebuild = 1; break;
+            default:
+                usage (argv[0]);
+                return 2;
+        }
+    }
+    if ((argc - optind) != 1 || (by_cycles && pc >= 0)) {
+        usage (argv[0]);
+        return 2;
+    }
+    trace_file = argv[optind];
+    snprintf (index_file, sizeof(index_file), "%s.idx", trace_file);
+
+    if (rebuild || !index_fresh (trace_file, index_file)) {
+        if (i8080_trace_index_build (trace_file, index_file, interval) < 0)
+            return 2;
+    }
+    if (NULL == (index = i8080_trace_index_load (index_file)))
+        return 2;
+    if (NULL == (reader = i8080_trace_reader_open (trace_file))) {
+        i8080_trace_index_free (index);
+        return 2;
+    }
+
+    if (by_cycles) {
+        const struct i8080_trace_index_entry* entry = i8080_trace_index_find_cycle (index, cycles);
+
+        if (index->count && index->entry[0].cycles == UINT64_MAX) {
+            fprintf (stderr, "Error: %s has no cycle times, write it with i8080 -x\n", index_file);
+            result = 2;
+            goto done;
+        }
+        if (entry == NULL) {
+            fprintf (stderr, "Error: no record at cycle %llu\n", (unsigned long long)cycles);
+            result = 2;
+            goto done;
+        }
+        record = entry->record;
+        printf ("cycle %llu: record %llu at cycle %llu\n", (unsigned long long)cycles,
+                (unsigned long long)entry->record, (unsigned long long)entry->cycles);
+    } else if (pc >= 0) {
+        if (seek_record (reader, index, record) < 0) {
+            result = 2;
+            goto done;
+        }
+        while ((rc = skip_to (reader, record, &rec)) > 0 &&
+               ((rec.pch << 8) | rec.pcl) != pc) {
+            record = reader->records;
+        }
+        if (rc <= 0) {
+            if (rc == 0)
+                fprintf (stderr, "Error: pc %04x not reached\n", pc);
+            result = (rc == 0) ? 1 : 2;
+            goto done;
+        }
+        record = reader->records - 1;
+        printf ("pc %04x: record %llu\n", pc, (unsigned long long)record);
+    }
+
+    first = (record > (uint64_t)context) ? (record - context) : 0;
+    if (seek_record (reader, index, first) < 0) {
+        result = 2;
+        goto done;
+    }
+    rc = skip_to (reader, first, &rec);
+    for (k = first; rc > 0 && k <= record + context; k++) {
+        print_record ((k == record) ? ">" : " ", k, &rec);
+        rc = next_record (reader, &rec);
+    }
+    if (rc < 0) {
+        result = 2;
+    } else if (k <= record) {
+        fprintf (stderr, "Error: trace ends after %llu records\n", (unsigned long long)reader->records);
+        result = 1;
+    }
+
+done:
+    i8080_trace_reader_close (reader);
+    i8080_trace_index_free (index);
+    return result;
+}
@@ -0,0 +1,185 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include <QMutexLocker>
+
+#include "framesource.h"
+#include "vram.h"
+
+#define VRAM_SIZEB (INVADERS_VRAM_LINES * INVADERS_VRAM_LINE_SIZEB)
+#define HALF_SIZEB (VRAM_SIZEB / 2)
+
+// how long a wait may run before stop () is noticed
+#define WAIT_MS 100
+
+FrameSource::FrameSource (const char* ring, int s, QObject* parent)
+    : QThread (parent), ring_name (ring), scale (s), stopping (false),
+      ready (false), count (0), half (HALF_SIZEB)
+{
+    memset (image_bin, 0, sizeof(image_bin));
+    memset (image_cpy, 0, sizeof(image_cpy));
+}
+
+FrameSource::~FrameSource ()
+{
+    stop ();
+    wait ();
+}
+
+void FrameSource::stop ()
+{
+    QMutexLocker lock (&mutex);
+
+    stopping = true;
+    taken.wakeAll ();
+}
+
+bool FrameSource::take (QImage& image)
+{
+    QMutexLocker lock (&mutex);
+
+    if (!ready)
+        return false;
+    image = frame;
+    frame = QImage ();
+    ready = false;
+    taken.wakeAll ();
+    return true;
+}
+
+QImage FrameSource::draw (const uint8_t* vram)
+{
+    QImage image (INVADERS_VRAM_OUT_WIDTH * scale, INVADERS_VRAM_OUT_HEIGHT * scale, QImage::Format_RGB32);
+
+    // rotated and scaled straight into the image, in one pass
+    invaders_vram_rgba (vram, (uint32_t*)image.bits (), image.bytesPerLine () / 4, scale,
+                        0xffffffff, 0xff000000);
+    return image;
+}
+
+// hand image to the GUI thread; a frame not yet taken is replaced, unless
+// every frame is to be shown (wait)
+void FrameSource::deliver (const QImage& image, bool wait)
+{
+    QMutexLocker lock (&mutex);
+
+    while (wait && ready && !stopping)
+        taken.wait (&mutex, WAIT_MS);
+    frame = image;
+    if (!ready) {
+        ready = true;
+        emit frameReady ();
+    }
+}
+
+void FrameSource::run ()
+{
+    if (ring_name)
+        runRing ();
+    else
+        runFiles ();
+}
+
+void FrameSource::runRing ()
+{
+    struct invaders_fb* fb = 0;
+    const struct invaders_fb_slot* slot;
+    uint64_t seq;
+
+    while (!stopping) {
+        if (!fb && !(fb = invaders_fb_open (ring_name))) {
+            msleep (WAIT_MS);   // no producer yet
+            continue;
+        }
+        switch (invaders_fb_wait (fb, WAIT_MS)) {
+            case 1: break;
+            case 0: continue;
+            default: msleep (WAIT_MS); continue;
+        }
+
+        // the newest frame, straight from the shared memory
+        while ((slot = invaders_fb_latest (fb, &seq))) {
+            QImage image = draw (slot->vram);
+
+            if (invaders_fb_valid (slot, seq)) {
+                deliver (image, false);
+                break;
+            }
+            // the producer came round to the slot while it was drawn
+        }
+    }
+
+    invaders_fb_close (fb);
+}
+
+// image_<count>.bin once it is complete
+bool FrameSource::readFile ()
+{
+    char buf[128];
+    ssize_t len;
+    int fd;
+
+    sprintf (buf, "image_%d.bin", count);
+    if (-1 == (fd = open (buf, O_RDONLY)))
+        return false;
+    len = read (fd, image_cpy, VRAM_SIZEB);
+    ::close (fd);
+    if (len != VRAM_SIZEB)
+        return false;   // still being written, there is another event to come
+    count++;
+    return true;
+}
+
+void FrameSource::runFiles ()
+{
+    struct pollfd p;
+    char events[4096];
+
+    // without inotify the poll () below times out, which is polling the files
+    p.fd = inotify_init1 (IN_CLOEXEC);
+    p.events = POLLIN;
+    if (p.fd != -1)
+        inotify_add_watch (p.fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO);
+
+    while (!stopping) {
+        if (readFile ()) {
+            // the dumps are taken at every interrupt, one half of the
+            // screen at a time is drawn from the newest
+            memcpy (&image_bin[half], &image_cpy[half], HALF_SIZEB);
+            half = (half == 0) ? HALF_SIZEB : 0;
+            deliver (draw (image_bin), true);
+            continue;
+        }
+        if (poll (&p, 1, WAIT_MS) > 0)
+            read (p.fd, events, sizeof(events)); // drain, readFile () looks for itself
+    }
+
+    if (p.fd != -1)
+        ::close (p.fd);
+}
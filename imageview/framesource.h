@@ -0,0 +1,79 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __FRAMESOURCE_H__
+#define __FRAMESOURCE_H__
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QImage>
+
+#include <stdint.h>
+
+#include "fbring.h"
+
+// Worker thread that blocks until the producer has a new frame and draws
+// it into an image for the GUI thread. With a frame ring it sleeps in
+// invaders_fb_wait() and only ever hands over the newest frame, so the
+// window follows the producer at any rate without piling up; with files
+// it sleeps on inotify until image_N.bin shows up and hands over every
+// one in turn.
+class FrameSource : public QThread
+{
+    Q_OBJECT;
+signals:
+    // a frame is ready for take (), not raised again until it is taken
+    void frameReady ();
+public:
+    // ring = NULL reads the image_N.bin files, else the shared memory frame ring
+    FrameSource (const char* ring, int scale, QObject* parent = 0);
+    ~FrameSource ();
+
+    void stop ();
+    // the frame waiting, false if there is none
+    bool take (QImage& image);
+protected:
+    void run ();
+private:
+    void runRing ();
+    void runFiles ();
+    bool readFile ();
+    QImage draw (const uint8_t* vram);
+    void deliver (const QImage& image, bool wait);
+
+    const char* ring_name;
+    int scale;
+    volatile bool stopping;
+
+    QMutex mutex;
+    QWaitCondition taken;
+    QImage frame;       // drawn, waiting for take ()
+    bool ready;
+
+    int count;
+    int half;
+    uint8_t image_bin[1024*8];
+    uint8_t image_cpy[1024*8];
+};
+
+#endif // __FRAMESOURCE_H__
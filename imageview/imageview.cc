@@ -39,7 +39,13 @@ int main (int argc, char** argv)
 {
     QApplication app (argc, argv);
 
-    MainWin main (256, 224);
+    // imageview [-s [name]]: frames from the shared memory ring (see
+    // invaders/fbring.h) instead of the image_N.bin files
+    const char* ring = 0;
+    if (argc > 1 && !strcmp (argv[1], "-s"))
+        ring = (argc > 2) ? argv[2] : INVADERS_FB_NAME;
+
+    MainWin main (256, 224, ring);
     main.adjustSize ();
     main.move(QApplication::desktop()->screen()->rect().center() - main.rect().center());
     main.show ();
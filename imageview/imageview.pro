@@ -6,5 +6,8 @@ CONFIG += release console
 QMAKE_CFLAGS +=
 QMAKE_CXXFLAGS +=
 
-HEADERS += mainwin.h
-SOURCES += imageview.cc mainwin.cc
+INCLUDEPATH += ../invaders
+
+HEADERS += mainwin.h framesource.h ../invaders/vram.h ../invaders/fbring.h
+SOURCES += imageview.cc mainwin.cc framesource.cc ../invaders/vram.c ../invaders/fbring.c
+LIBS += -lrt
@@ -20,63 +20,38 @@
   SOFTWARE.
 */
 
-#include <cassert>
-#include <cstdio>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-
 #include <QDebug>
 
 #include "mainwin.h"
 
-static void merge (uint8_t* last, uint8_t* curr)
-{
-    static int x = (((256*224)/8)/2);
-    for (int i = x; i < (x + (((256*224)/8)/2)); i++) {
-            last[i] = curr[i];
-    }
-    x = (x == 0) ? (((256*224)/8)/2) : 0;
-}
-
-MainWin::MainWin (int w, int h, QWidget* parent)
-    : QLabel (parent), width (w), height (h), count(0)
+MainWin::MainWin (int w, int h, const char* ring, QWidget* parent)
+    : QLabel (parent), width (w), height (h), scale (3),
+      screen (h * scale, w * scale, QImage::Format_RGB32), source (ring, scale)
 {
-    trans.rotate (-90);
-    trans.scale (3,3);
-
-    updateScreen ();
+    screen.fill (0xff000000);
+    setPixmap (QPixmap::fromImage (screen));
 
-    connect (&timer, SIGNAL(timeout()), this, SLOT(onTimeout()), Qt::DirectConnection);
-    timer.start (50);
+    // repainted when the worker has drawn a new frame, nothing runs in between
+    connect (&source, SIGNAL(frameReady()), this, SLOT(onFrame()), Qt::QueuedConnection);
+    source.start ();
 }
 
-void MainWin::updateScreen ()
+MainWin::~MainWin ()
 {
-    int fd;
-    char buf[128];
-    sprintf(buf, "image_%d.bin", count);
-
-    if (-1 != (fd = open (buf, O_RDONLY))) {
-        // printf("%s\n", buf);
-        read (fd, image_cpy, (1024*7));
-        ::close (fd);
-        count++;
-    }
-    merge (image_bin, image_cpy);
-
-    QImage image ((const unsigned char*)image_bin, width, height, QImage::Format_MonoLSB);
-
-    setPixmap (QPixmap::fromImage(image).transformed(trans));
-    update ();
+    source.stop ();
+    source.wait ();
 }
 
 void MainWin::closeEvent (QCloseEvent* event)
 {
+    source.stop ();
     event->accept ();
 }
 
-void MainWin::onTimeout ()
+void MainWin::onFrame ()
 {
-    updateScreen ();
+    if (source.take (screen)) {
+        setPixmap (QPixmap::fromImage (screen));
+        update ();
+    }
 }
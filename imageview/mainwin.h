@@ -26,32 +26,31 @@
 #include <QApplication>
 #include <QWidget>
 #include <QLabel>
-#include <QTransform>
+#include <QImage>
 #include <QKeyEvent>
 #include <QVBoxLayout>
-#include <QTimer>
 
 #include <stdint.h>
 
+#include "framesource.h"
+
 class MainWin : public QLabel
 {
     Q_OBJECT;
 private slots:
-    void onTimeout ();
+    void onFrame ();
 public:
-    MainWin (int width, int height, QWidget* parent = 0);
+    // ring = NULL reads the image_N.bin files, else the shared memory frame ring
+    MainWin (int width, int height, const char* ring = 0, QWidget* parent = 0);
+    ~MainWin ();
 protected:
     void closeEvent (QCloseEvent* event);
 private:
-    void updateScreen ();
-
     int width;
     int height;
-    QTransform trans;
-    QTimer timer;
-    int count;
-    uint8_t image_bin[1024*8];
-    uint8_t image_cpy[1024*8];
+    int scale;
+    QImage screen;
+    FrameSource source;
 };
 
 #endif // __MAINWIN_H__
@@ -0,0 +1,218 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "fbring.h"
+
+static struct invaders_fb* fb_map (const char* name, const int producer)
+{
+    struct invaders_fb* fb;
+    void* p;
+    int fd;
+
+    /* viewers only read, FUTEX_WAIT works on a read only mapping */
+    if (-1 == (fd = shm_open (name, producer ? (O_RDWR | O_CREAT) : O_RDONLY, 0600))) {
+        if (producer || errno != ENOENT)
+            fprintf (stderr, "Error: unable to open shared memory %s: %s\n", name, strerror (errno));
+        return NULL;
+    }
+    if (producer) {
+        struct stat st;
+
+        /* the mode only applies to a new object: tighten one left by an
+           older build, refuse one another user created */
+        if (fstat (fd, &st) < 0 || st.st_uid != geteuid () || fchmod (fd, 0600) < 0) {
+            fprintf (stderr, "Error: shared memory %s is not private to this user\n", name);
+            close (fd);
+            return NULL;
+        }
+    }
+    if (producer && ftruncate (fd, sizeof(struct invaders_fb_ring)) < 0) {
+        fprintf (stderr, "Error: unable to size shared memory %s: %s\n", name, strerror (errno));
+        close (fd);
+        return NULL;
+    }
+    if (!producer) {
+        struct stat st;
+
+        /* a producer between shm_open() and ftruncate() */
+        if (fstat (fd, &st) < 0 || st.st_size < (off_t)sizeof(struct invaders_fb_ring)) {
+            close (fd);
+            return NULL;
+        }
+    }
+
+    p = mmap (NULL, sizeof(struct invaders_fb_ring), producer ? (PROT_READ | PROT_WRITE) : PROT_READ,
+              MAP_SHARED, fd, 0);
+    close (fd);
+    if (p == MAP_FAILED) {
+        fprintf (stderr, "Error: unable to map shared memory %s: %s\n", name, strerror (errno));
+        return NULL;
+    }
+
+    if (NULL == (fb = (struct invaders_fb*)calloc (1, sizeof(struct invaders_fb)))) {
+        munmap (p, sizeof(struct invaders_fb_ring));
+        return NULL;
+    }
+    fb->ring = (struct invaders_fb_ring*)p;
+    fb->producer = producer;
+    return fb;
+}
+
+struct invaders_fb* invaders_fb_create (const char* name)
+{
+    struct invaders_fb* fb;
+    struct invaders_fb_ring* r;
+    int i;
+
+    if (NULL == (fb = fb_map (name, 1)))
+        return NULL;
+
+    /* a viewer still mapping the ring sees head go back and every slot
+       invalid until it is written again */
+    r = fb->ring;
+    __atomic_store_n (&r->head, 0, __ATOMIC_RELEASE);
+    for (i = 0; i < INVADERS_FB_SLOTS; i++)
+        __atomic_store_n (&r->slot[i].seq, 0, __ATOMIC_RELEASE);
+    r->version = INVADERS_FB_VERSION;
+    r->slot_count = INVADERS_FB_SLOTS;
+    r->slot_sizeb = sizeof(struct invaders_fb_slot);
+    __atomic_store_n (&r->magic, INVADERS_FB_MAGIC, __ATOMIC_RELEASE);
+    return fb;
+}
+
+void invaders_fb_publish (struct invaders_fb* fb, const uint8_t* vram, const uint64_t tick)
+{
+    const uint64_t seq = ++fb->seq;
+    struct invaders_fb_slot* s = &fb->ring->slot[seq % INVADERS_FB_SLOTS];
+
+    /* invalidate the slot before any of the frame lands in it */
+    __atomic_store_n (&s->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    memcpy (s->vram, vram, INVADERS_FB_SIZEB);
+    s->tick = tick;
+    __atomic_store_n (&s->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n (&fb->ring->head, seq, __ATOMIC_RELEASE);
+
+    /* a viewer reads the futex before it checks head, so it either sees
+       the new head or the futex has moved on by the time it sleeps; no
+       count of sleepers is kept, it would leak when a viewer is killed
+       while it waits */
+    __atomic_add_fetch (&fb->ring->futex, 1, __ATOMIC_SEQ_CST);
+    syscall (SYS_futex, &fb->ring->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+struct invaders_fb* invaders_fb_open (const char* name)
+{
+    struct invaders_fb* fb;
+    const struct invaders_fb_ring* r;
+
+    if (NULL == (fb = fb_map (name, 0)))
+        return NULL;
+
+    r = fb->ring;
+    if (__atomic_load_n (&r->magic, __ATOMIC_ACQUIRE) != INVADERS_FB_MAGIC) {
+        /* not initialised yet */
+        invaders_fb_close (fb);
+        return NULL;
+    }
+    if (r->version != INVADERS_FB_VERSION || r->slot_count != INVADERS_FB_SLOTS ||
+        r->slot_sizeb != sizeof(struct invaders_fb_slot)) {
+        fprintf (stderr, "Error: shared memory %s holds an incompatible frame ring\n", name);
+        invaders_fb_close (fb);
+        return NULL;
+    }
+    return fb;
+}
+
+int invaders_fb_wait (struct invaders_fb* fb, const int timeout_ms)
+{
+    struct invaders_fb_ring* r = fb->ring;
+    struct timespec timeout;
+    uint64_t head;
+    uint32_t futex;
+    long rc;
+
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+    futex = __atomic_load_n (&r->futex, __ATOMIC_SEQ_CST);
+    head = __atomic_load_n (&r->head, __ATOMIC_SEQ_CST);
+    if (head != 0 && head != fb->seq)
+        return 1;
+    /* returns at once if a frame was published since futex was read */
+    rc = syscall (SYS_futex, &r->futex, FUTEX_WAIT, futex, &timeout, NULL, 0);
+    if (rc < 0 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+        fprintf (stderr, "Error: waiting for a frame failed: %s\n", strerror (errno));
+        return -1;
+    }
+
+    head = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+    return (head != 0 && head != fb->seq);
+}
+
+const struct invaders_fb_slot* invaders_fb_latest (struct invaders_fb* fb, uint64_t* seq)
+{
+    const struct invaders_fb_slot* s;
+    uint64_t head;
+
+    /* head going back is a restarted producer */
+    while ((head = __atomic_load_n (&fb->ring->head, __ATOMIC_ACQUIRE)) != 0 && head != fb->seq) {
+        s = &fb->ring->slot[head % INVADERS_FB_SLOTS];
+        if (__atomic_load_n (&s->seq, __ATOMIC_ACQUIRE) == head) {
+            fb->seq = head;
+            *seq = head;
+            return s;
+        }
+        /* overwritten since head was read, take the newer head */
+    }
+    return NULL;
+}
+
+int invaders_fb_valid (const struct invaders_fb_slot* slot, const uint64_t seq)
+{
+    /* the reads of the frame complete before seq is checked again */
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    return (__atomic_load_n (&slot->seq, __ATOMIC_RELAXED) == seq);
+}
+
+void invaders_fb_close (struct invaders_fb* fb)
+{
+    if (fb == NULL)
+        return;
+    munmap (fb->ring, sizeof(struct invaders_fb_ring));
+    free (fb);
+}
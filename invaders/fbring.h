@@ -0,0 +1,116 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Shared memory frame ring between a producer of Space Invaders video RAM
+  frames (the native model, the replay tools) and
+  viewers (imageview), with no files in between.
+
+  The ring is a POSIX shared memory object (/dev/shm/invaders-fb by
+  default) of INVADERS_FB_SLOTS slots of one video RAM frame each. Frame n
+  (counting from 1) goes to slot n % INVADERS_FB_SLOTS, whose seq is 0
+  while it is written and n once complete, then head is set to n and the
+  futex word bumped, waking viewers blocked in invaders_fb_wait(). A
+  viewer maps the ring read only and uses the newest slot in place: it
+  takes the frame from invaders_fb_latest(), reads the video RAM straight
+  from the mapping and then checks with invaders_fb_valid() that the
+  producer did not come round to the slot in the meantime (a seqlock),
+  retrying if it did. The producer never waits for viewers, a slow viewer
+  skips frames.
+
+  The object stays after the producer exits, so a viewer started later
+  shows the last frame; a new producer starts the sequence again. It is
+  created 0600, only processes of the producer's user can map it.
+*/
+
+#ifndef __INVADERS_FBRING_H__
+#define __INVADERS_FBRING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INVADERS_FB_NAME    "/invaders-fb"
+#define INVADERS_FB_MAGIC   0x42463849 /* "I8FB" */
+#define INVADERS_FB_VERSION 2
+#define INVADERS_FB_SLOTS   8
+#define INVADERS_FB_SIZEB   (INVADERS_VRAM_LINES * INVADERS_VRAM_LINE_SIZEB)
+
+struct invaders_fb_slot
+{
+    uint64_t seq;   /* frame in the slot, 0 while it is written */
+    uint64_t tick;  /* producer's timer tick of the frame */
+    uint8_t vram[INVADERS_FB_SIZEB];
+    uint8_t pad[48]; /* slots on cache line boundaries */
+};
+
+struct invaders_fb_ring
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count; /* not "slots", a Qt macro */
+    uint32_t slot_sizeb;
+    uint64_t head;  /* newest complete frame, 0 = none yet */
+    uint32_t futex; /* bumped after every head update */
+    uint8_t pad[36];
+    struct invaders_fb_slot slot[INVADERS_FB_SLOTS];
+};
+
+struct invaders_fb
+{
+    struct invaders_fb_ring* ring;
+    int producer;
+    uint64_t seq;   /* last frame published, or taken by the viewer */
+};
+
+/* producer side: create (or take over) the ring, NULL on error */
+struct invaders_fb* invaders_fb_create (const char* name);
+void invaders_fb_publish (struct invaders_fb* fb, const uint8_t* vram, const uint64_t tick);
+
+/* viewer side: map an existing ring read only; NULL if there is none yet
+   (quietly, so it can be polled) or on error */
+struct invaders_fb* invaders_fb_open (const char* name);
+
+/* block until there is a frame newer than the last one taken: 1 if there
+   is, 0 after timeout_ms, -1 on error */
+int invaders_fb_wait (struct invaders_fb* fb, const int timeout_ms);
+
+/* the newest frame if it is newer than the last one taken, else NULL;
+   *seq identifies it for invaders_fb_valid() */
+const struct invaders_fb_slot* invaders_fb_latest (struct invaders_fb* fb, uint64_t* seq);
+
+/* 1 if frame seq was not overwritten while it was being read */
+int invaders_fb_valid (const struct invaders_fb_slot* slot, const uint64_t seq);
+
+void invaders_fb_close (struct invaders_fb* fb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __INVADERS_FBRING_H__ */
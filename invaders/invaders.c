@@ -0,0 +1,181 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "invaders.h"
+
+/*----------------------------------------------------------------------------*/
+/* Shifter and inputs                                                         */
+/*----------------------------------------------------------------------------*/
+static uint8_t shifter_in (void* ctx, const uint8_t port)
+{
+    struct invaders* m = ctx;
+
+    (void)port;
+    return (m->shift >> (8 - m->shift_amount)) & 0xff;
+}
+
+static void shifter_out (void* ctx, const uint8_t port, const uint8_t byte)
+{
+    struct invaders* m = ctx;
+
+    if (port == 2)
+        m->shift_amount = (byte & 7);
+    else
+        m->shift = ((uint16_t)byte << 8) | (m->shift >> 8);
+}
+
+static uint8_t inputs_in (void* ctx, const uint8_t port)
+{
+    struct invaders* m = ctx;
+
+    return (port == 1) ? m->in1 : (m->in2 | INVADERS_IN2_DIP);
+}
+
+/* the test bench drives 0 for every port without a device */
+static uint8_t unused_in (void* ctx, const uint8_t port)
+{
+    (void)ctx;
+    (void)port;
+    return 0;
+}
+
+void invaders_set_inputs (struct invaders* m, const uint8_t in1, const uint8_t in2)
+{
+    m->in1 = in1;
+    m->in2 = (in2 & ~INVADERS_IN2_DIP);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Timer                                                                      */
+/*----------------------------------------------------------------------------*/
+static void poll (struct i8080_state* state, void* ctx, const uint64_t when);
+
+/* the CPU takes a pending request at the first instruction boundary with
+   interrupts enabled, until then look again at every boundary */
+static void acknowledge (struct invaders* m)
+{
+    struct i8080_state* const state = m->state;
+
+    if (!m->pending)
+        return;
+    if (!state->i) {
+        i8080_schedule (state, state->cycles + 1, poll, m);
+        return;
+    }
+    m->pending = 0;
+    m->interrupts++;
+    i8080_interrupt (state, m->nnn);
+    m->nnn ^= 3; /* RST 1, RST 2, RST 1, ... */
+}
+
+static void poll (struct i8080_state* state, void* ctx, const uint64_t when)
+{
+    (void)state;
+    (void)when;
+    acknowledge (ctx);
+}
+
+static void tick (struct i8080_state* state, void* ctx, const uint64_t when)
+{
+    struct invaders* m = ctx;
+
+    m->ticks++;
+    if (m->frame_fn)
+        m->frame_fn (m->frame_ctx, &m->mem[INVADERS_VRAM], m->ticks);
+
+    /* a request while one is pending is lost, as in invaders-timer.vhd */
+    if (m->devices && !m->pending) {
+        m->pending = 1;
+        acknowledge (m);
+    }
+    i8080_schedule (state, when + m->period, tick, m);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Machine                                                                    */
+/*----------------------------------------------------------------------------*/
+struct invaders* invaders_create (const char* const rom, const int engine, const uint64_t period, const int devices)
+{
+    struct invaders* m;
+    uint16_t addr;
+
+    if (period == 0) {
+        fprintf (stderr, "Error: the interrupt period must not be 0\n");
+        return NULL;
+    }
+    if (NULL == (m = calloc (1, sizeof(struct invaders))) || NULL == (m->mem = malloc (0x10000))) {
+        fprintf (stderr, "Error: out of memory\n");
+        free (m);
+        return NULL;
+    }
+    if (NULL == (m->state = i8080_create_engine (m->mem, 0x10000, engine))) {
+        free (m->mem);
+        free (m);
+        return NULL;
+    }
+    m->period = period;
+    m->devices = devices;
+    m->nnn = 1;
+
+    i8080_load_memory (m->state, 0x0000, rom);
+    i8080_map (m->state, 0x0000, INVADERS_ROM_SIZEB, m->mem, I8080_PAGE_ROM);
+    for (addr = 0x2000; addr != 0; addr += 0x2000)
+        i8080_map (m->state, addr, 0x2000, &m->mem[0x2000], I8080_PAGE_RAM);
+
+    if (devices) {
+        i8080_set_port_default (m->state, unused_in, NULL, NULL);
+        i8080_set_port_in (m->state, 1, inputs_in, m);
+        i8080_set_port_in (m->state, 2, inputs_in, m);
+        i8080_set_port_in (m->state, 3, shifter_in, m);
+        i8080_set_port_out (m->state, 2, shifter_out, m);
+        i8080_set_port_out (m->state, 4, shifter_out, m);
+    }
+    i8080_schedule (m->state, period, tick, m);
+    return m;
+}
+
+void invaders_destroy (struct invaders* m)
+{
+    if (m == NULL)
+        return;
+    i8080_destroy (m->state);
+    free (m->mem);
+    free (m);
+}
+
+void invaders_set_frame_fn (struct invaders* m, invaders_frame_fn_t fn, void* ctx)
+{
+    m->frame_fn = fn;
+    m->frame_ctx = ctx;
+}
+
+int invaders_run (struct invaders* m, const uint64_t cycles)
+{
+    return i8080_run (m->state, cycles);
+}
@@ -0,0 +1,130 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Native Space Invaders machine model.
+
+  The cmodel wired to C versions of the test bench devices of the
+  ModelSim flow (tb/invaders-tb.vhd):
+
+    memory    8kiB ROM at 0000, 1kiB RAM at 2000, 7kiB video RAM at 2400,
+              the 8kiB RAM block mirrored up to ffff
+    shifter   OUT 2 shift amount, OUT 4 shift data, IN 3 result
+              (invaders-shifter.vhd)
+    inputs    IN 1 and IN 2, player controls and DIP switches
+              (invaders-inputs.vhd), every other port reads 0
+    timer     an interrupt request every period cycles (invaders-counter.vhd,
+              HZ60DIV2 + 1 clocks), held until the CPU has interrupts
+              enabled, alternating RST 1 and RST 2 on every acknowledge
+              (invaders-timer.vhd)
+
+  OUT 3 and 5 (sound) and 6 (watchdog) are ignored. The period is counted
+  in cmodel cycles; the RTL test bench runs one clock per state at 10MHz,
+  so INVADERS_PERIOD_RTL matches it, INVADERS_PERIOD_HW is the 2MHz arcade
+  board.
+
+  Without devices (for replays, see i8080_replay.h) only the memory is set
+  up and the timer only marks frames.
+*/
+
+#ifndef __INVADERS_H__
+#define __INVADERS_H__
+
+#include <stdint.h>
+
+#include "i8080.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INVADERS_ROM_SIZEB  0x2000
+#define INVADERS_VRAM       0x2400
+#define INVADERS_VRAM_SIZEB (1024*7)
+#define INVADERS_WIDTH      256 /* pixels per VRAM line, the screen is rotated */
+#define INVADERS_HEIGHT     224
+
+#define INVADERS_PERIOD_RTL 83334 /* cycles between interrupts */
+#define INVADERS_PERIOD_HW  16667
+
+/* IN 1 */
+#define INVADERS_CREDIT    0x01
+#define INVADERS_P2_START  0x02
+#define INVADERS_P1_START  0x04
+#define INVADERS_P1_SHOT   0x10
+#define INVADERS_P1_LEFT   0x20
+#define INVADERS_P1_RIGHT  0x40
+
+/* IN 2, the DIP switches are fixed as in the test bench */
+#define INVADERS_TILT      0x04
+#define INVADERS_P2_SHOT   0x10
+#define INVADERS_P2_LEFT   0x20
+#define INVADERS_P2_RIGHT  0x40
+#define INVADERS_IN2_DIP   0x0b
+
+/* called at every timer tick (two per frame) with the video RAM */
+typedef void (*invaders_frame_fn_t)(void* ctx, const uint8_t* vram, const uint64_t tick);
+
+struct invaders
+{
+    struct i8080_state* state;
+    uint8_t* mem;
+    uint64_t period;
+    int devices;
+
+    /* shifter */
+    uint16_t shift;
+    uint8_t shift_amount;
+
+    /* inputs, IN 1 and the player bits of IN 2 */
+    uint8_t in1;
+    uint8_t in2;
+
+    /* timer */
+    int pending;        /* request not yet acknowledged */
+    uint8_t nnn;        /* RST of the next acknowledge, 1 or 2 */
+    uint64_t ticks;
+    uint64_t interrupts;
+
+    invaders_frame_fn_t frame_fn;
+    void* frame_ctx;
+};
+
+/* A machine in the reset state with the ROM loaded, NULL on error. devices
+   = 0 leaves the ports and interrupts to a replay. */
+struct invaders* invaders_create (const char* const rom, const int engine, const uint64_t period, const int devices);
+void invaders_destroy (struct invaders* m);
+
+void invaders_set_frame_fn (struct invaders* m, invaders_frame_fn_t fn, void* ctx);
+
+/* the INVADERS_xxx bits held from now on */
+void invaders_set_inputs (struct invaders* m, const uint8_t in1, const uint8_t in2);
+
+/* run for cycles, returns the i8080_run() result */
+int invaders_run (struct invaders* m, const uint64_t cycles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __INVADERS_H__ */
@@ -0,0 +1,333 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/* Headless runner of the native Space Invaders model, see invaders.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i8080.h"
+#include "i8080_replay.h"
+#include "invaders.h"
+#include "fbring.h"
+#include "vstream.h"
+
+#define KEYS_MAX 4096
+
+/* inputs held from frame on, see load_keys() */
+struct keys
+{
+    uint64_t frame;
+    uint8_t in1;
+    uint8_t in2;
+};
+
+static const struct { const char* name; uint8_t in1; uint8_t in2; } key_names[] = {
+    { "coin",    INVADERS_CREDIT,   0 },
+    { "p1start", INVADERS_P1_START, 0 },
+    { "p2start", INVADERS_P2_START, 0 },
+    { "p1shot",  INVADERS_P1_SHOT,  0 },
+    { "p1left",  INVADERS_P1_LEFT,  0 },
+    { "p1right", INVADERS_P1_RIGHT, 0 },
+    { "p2shot",  0, INVADERS_P2_SHOT },
+    { "p2left",  0, INVADERS_P2_LEFT },
+    { "p2right", 0, INVADERS_P2_RIGHT },
+    { "tilt",    0, INVADERS_TILT },
+};
+
+#define KEY_NAMES ((int)(sizeof(key_names) / sizeof(key_names[0])))
+
+/* where the frames go: files, the shared memory ring, a video stream */
+struct dump
+{
+    const char* dir;
+    uint64_t count;
+    struct invaders_fb* fb;
+    struct invaders_vstream* vs;
+    int failed;     /* writing the video stream failed, the run stops */
+};
+
+static void usage (const char* prog)
+{
+    int i;
+
+    fprintf (stderr, "usage: %s [options]\n", prog);
+    fprintf (stderr, "  -e E    : engine switch, threaded or bbcache (default bbcache)\n");
+    fprintf (stderr, "  -r FILE : ROM (default ../tb/invaders.rom)\n");
+    fprintf (stderr, "  -n N    : frames to run (default 600)\n");
+    fprintf (stderr, "  -p P    : interrupt period, rtl (%d cycles, default), hw (%d) or cycles\n",
+             INVADERS_PERIOD_RTL, INVADERS_PERIOD_HW);
+    fprintf (stderr, "  -k FILE : input script, lines of \"frame key...\" holding the keys from\n");
+    fprintf (stderr, "            that frame on; keys:");
+    for (i = 0; i < KEY_NAMES; i++)
+        fprintf (stderr, " %s", key_names[i].name);
+    fprintf (stderr, "\n");
+    fprintf (stderr, "  -w DIR  : write the video RAM at every interrupt to DIR/image_N.bin\n");
+    fprintf (stderr, "  -S NAME : publish it to the shared memory frame ring NAME (e.g. %s)\n", INVADERS_FB_NAME);
+    fprintf (stderr, "  -T      : run no faster than the arcade board, for watching\n");
+    fprintf (stderr, "  -V FILE : stream the frames to FILE.y4m, FILE.gray or FILE.vram\n");
+    fprintf (stderr, "  -D N    : keep every Nth frame in the stream (default 1)\n");
+    fprintf (stderr, "  -R FILE : record the IN values and interrupts to FILE\n");
+    fprintf (stderr, "  -P FILE : replay FILE without devices instead (-n and -k are ignored)\n");
+    exit (2);
+}
+
+static int load_keys (const char* filename, struct keys* keys, int* count)
+{
+    char line[1024];
+    FILE* fp;
+    int lineno = 0;
+
+    if (NULL == (fp = fopen (filename, "r"))) {
+        fprintf (stderr, "Error: unable to open %s\n", filename);
+        return -1;
+    }
+
+    *count = 0;
+    while (fgets (line, sizeof(line), fp)) {
+        struct keys* k = &keys[*count];
+        char* tok;
+        char* end;
+
+        lineno++;
+        if ((tok = strpbrk (line, "#;")) != NULL)
+            *tok = '\0';
+        if (NULL == (tok = strtok (line, " \t\r\n")))
+            continue;
+        if (*count == KEYS_MAX) {
+            fprintf (stderr, "Error: %s has more than %d entries\n", filename, KEYS_MAX);
+            break;
+        }
+        k->frame = strtoull (tok, &end, 0);
+        if (*end != '\0' || (*count > 0 && k->frame < keys[*count - 1].frame)) {
+            fprintf (stderr, "Error: %s:%d: frame numbers must be increasing\n", filename, lineno);
+            break;
+        }
+        k->in1 = 0;
+        k->in2 = 0;
+        while (NULL != (tok = strtok (NULL, " \t\r\n"))) {
+            int i;
+
+            for (i = 0; i < KEY_NAMES && strcmp (tok, key_names[i].name); i++)
+                ;
+            if (i == KEY_NAMES) {
+                fprintf (stderr, "Error: %s:%d: unknown key %s\n", filename, lineno, tok);
+                fclose (fp);
+                return -1;
+            }
+            k->in1 |= key_names[i].in1;
+            k->in2 |= key_names[i].in2;
+        }
+        (*count)++;
+    }
+
+    lineno = feof (fp) ? 0 : -1;
+    fclose (fp);
+    return lineno;
+}
+
+static void dump_frame (void* ctx, const uint8_t* vram, const uint64_t tick)
+{
+    struct dump* d = ctx;
+    char filename[4096];
+    FILE* fp;
+
+    if (d->fb)
+        invaders_fb_publish (d->fb, vram, tick);
+    if (d->vs && !d->failed && invaders_vstream_frame (d->vs, vram) < 0)
+        d->failed = 1;
+    if (d->dir == NULL)
+        return;
+
+    snprintf (filename, sizeof(filename), "%s/image_%llu.bin", d->dir, (unsigned long long)d->count++);
+    if (NULL == (fp = fopen (filename, "wb")) || fwrite (vram, INVADERS_VRAM_SIZEB, 1, fp) != 1)
+        fprintf (stderr, "Error: unable to write %s\n", filename);
+    if (fp)
+        fclose (fp);
+}
+
+/* sleep until the ticks so far have taken as long as on the board */
+static void pace (const struct invaders* m, const struct timespec* t0)
+{
+    struct timespec now;
+    double ahead;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    ahead = (m->ticks / 120.0) - ((now.tv_sec - t0->tv_sec) + (now.tv_nsec - t0->tv_nsec) * 1e-9);
+    if (ahead > 0.001)
+        usleep ((useconds_t)(ahead * 1e6));
+}
+
+int main (int argc, char** argv)
+{
+    static struct keys keys[KEYS_MAX];
+    struct i8080_replay_header header;
+    struct i8080_replay* replay = NULL;
+    struct invaders* m;
+    struct dump dump;
+    struct timespec t0;
+    struct timespec t1;
+    int engine = I8080_ENGINE_BBCACHE;
+    const char* rom = "../tb/invaders.rom";
+    const char* key_file = NULL;
+    const char* record_file = NULL;
+    const char* play_file = NULL;
+    const char* fb_name = NULL;
+    const char* video_file = NULL;
+    unsigned decimate = 1;
+    int realtime = 0;
+    uint64_t period = INVADERS_PERIOD_RTL;
+    uint64_t frames = 600;
+    uint64_t frame;
+    double secs;
+    int nkeys = 0;
+    int k = 0;
+    int rc = I8080_RUN_BUDGET;
+    int result = 0;
+    int opt;
+
+    memset (&dump, 0, sizeof(dump));
+    while ((opt = getopt (argc, argv, "e:r:n:p:k:w:S:TV:D:R:P:h")) != -1) {
+        switch (opt) {
+            case 'e': {
+                if (!strcmp (optarg, "switch"))
+                    engine = I8080_ENGINE_SWITCH;
+                else if (!strcmp (optarg, "threaded"))
+                    engine = I8080_ENGINE_THREADED;
+                else if (!strcmp (optarg, "bbcache"))
+                    engine = I8080_ENGINE_BBCACHE;
+                else
+                    usage (argv[0]);
+                break;
+            }
+            case 'r': rom = optarg; break;
+            case 'n': frames = strtoull (optarg, NULL, 0); break;
+            case 'p': {
+                if (!strcmp (optarg, "rtl"))
+                    period = INVADERS_PERIOD_RTL;
+                else if (!strcmp (optarg, "hw"))
+                    period = INVADERS_PERIOD_HW;
+                else
+                    period = strtoull (optarg, NULL, 0);
+                break;
+            }
+            case 'k': key_file = optarg; break;
+            case 'w': dump.dir = optarg; break;
+            case 'S': fb_name = optarg; break;
+            case 'T': realtime = 1; break;
+            case 'V': video_file = optarg; break;
+            case 'D': decimate = strtoul (optarg, NULL, 0); break;
+            case 'R': record_file = optarg; break;
+            case 'P': play_file = optarg; break;
+            default: usage (argv[0]);
+        }
+    }
+    if (optind != argc || (record_file && play_file))
+        usage (argv[0]);
+
+    if (key_file && !play_file && load_keys (key_file, keys, &nkeys) < 0)
+        return 2;
+    if (play_file) {
+        if (i8080_replay_info (play_file, &header) < 0)
+            return 2;
+        if (strcmp (header.machine, "invaders")) {
+            fprintf (stderr, "Error: %s is a %s log\n", play_file, header.machine);
+            return 2;
+        }
+    }
+
+    if (NULL == (m = invaders_create (rom, engine, period, (play_file == NULL))))
+        return 2;
+    if (fb_name && NULL == (dump.fb = invaders_fb_create (fb_name)))
+        return 2;
+    if (video_file && NULL == (dump.vs = invaders_vstream_create (video_file, 1, decimate)))
+        return 2;
+    if (dump.dir || dump.fb || dump.vs)
+        invaders_set_frame_fn (m, dump_frame, &dump);
+    if (record_file && NULL == (replay = i8080_replay_record (m->state, record_file, "invaders")))
+        return 2;
+    if (play_file && NULL == (replay = i8080_replay_play (m->state, play_file)))
+        return 2;
+
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    if (play_file) {
+        /* to the end of the recording, or of the items of a log never closed */
+        while ((rc == I8080_RUN_BUDGET || rc == I8080_RUN_HALT) && !dump.failed &&
+               (header.end_instructions ? (m->state->cycles < header.end_cycles) : (replay->kind != 0))) {
+            uint64_t budget = 2 * period;
+
+            if (header.end_instructions && budget > header.end_cycles - m->state->cycles)
+                budget = header.end_cycles - m->state->cycles;
+            rc = invaders_run (m, budget);
+            if (realtime)
+                pace (m, &t0);
+        }
+    } else {
+        for (frame = 0; frame < frames && (rc == I8080_RUN_BUDGET || rc == I8080_RUN_HALT) && !dump.failed; frame++) {
+            for (; k < nkeys && keys[k].frame <= frame; k++)
+                invaders_set_inputs (m, keys[k].in1, keys[k].in2);
+            rc = invaders_run (m, 2 * period);
+            if (realtime)
+                pace (m, &t0);
+        }
+    }
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+
+    if (rc == I8080_RUN_ERROR) {
+        fprintf (stderr, "Error: unknown opcode or PC out of range at %04x\n", m->state->pc);
+        result = 1;
+    }
+    if (dump.failed) {
+        fprintf (stderr, "Error: run stopped after %llu frames, the video stream could not be written\n",
+                 (unsigned long long)(m->ticks / 2));
+        result = 1;
+    }
+
+    /* the arcade board interrupts 120 times a second */
+    printf ("%llu frames, %llu %s, %llu instructions, %llu cycles in %.3f s: %.1f MIPS, %.0fx real time\n",
+            (unsigned long long)(m->ticks / 2), (unsigned long long)(play_file ? replay->items : m->interrupts),
+            play_file ? "log items" : "interrupts", (unsigned long long)m->state->instructions,
+            (unsigned long long)m->state->cycles, secs, m->state->instructions / (secs * 1e6),
+            (m->ticks / 120.0) / secs);
+
+    if (dump.vs) {
+        printf ("%llu frames to %s, producer stalled %.3f s\n", (unsigned long long)invaders_vstream_frames (dump.vs),
+                video_file, invaders_vstream_stall_secs (dump.vs));
+        if (invaders_vstream_close (dump.vs) < 0)
+            result = 1;
+    }
+
+    if (replay && i8080_replay_close (replay) < 0)
+        result = 1;
+    else if (play_file)
+        printf ("replayed exactly\n");
+
+    invaders_fb_close (dump.fb);
+    invaders_destroy (m);
+    return result;
+}
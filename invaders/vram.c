@@ -0,0 +1,300 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "vram.h"
+
+/*----------------------------------------------------------------------------*/
+/* Reference                                                                  */
+/*----------------------------------------------------------------------------*/
+#define PIXEL(vram, y, x) (((vram)[((y) * INVADERS_VRAM_LINE_SIZEB) + ((x) >> 3)] >> ((x) & 7)) & 1)
+
+void invaders_vram_gray_ref (const uint8_t* vram, uint8_t* dst, const int stride, const int scale,
+                             const uint8_t fg, const uint8_t bg)
+{
+    int y;
+    int x;
+    int i;
+    int j;
+
+    for (y = 0; y < INVADERS_VRAM_LINES; y++) {
+        for (x = 0; x < 256; x++) {
+            const uint8_t v = PIXEL (vram, y, x) ? fg : bg;
+            uint8_t* p = &dst[((255 - x) * scale * stride) + (y * scale)];
+
+            for (i = 0; i < scale; i++, p += stride) {
+                for (j = 0; j < scale; j++)
+                    p[j] = v;
+            }
+        }
+    }
+}
+
+void invaders_vram_rgba_ref (const uint8_t* vram, uint32_t* dst, const int stride, const int scale,
+                             const uint32_t fg, const uint32_t bg)
+{
+    int y;
+    int x;
+    int i;
+    int j;
+
+    for (y = 0; y < INVADERS_VRAM_LINES; y++) {
+        for (x = 0; x < 256; x++) {
+            const uint32_t v = PIXEL (vram, y, x) ? fg : bg;
+            uint32_t* p = &dst[((255 - x) * scale * stride) + (y * scale)];
+
+            for (i = 0; i < scale; i++, p += stride) {
+                for (j = 0; j < scale; j++)
+                    p[j] = v;
+            }
+        }
+    }
+}
+
+#if defined(__SSE2__)
+/*----------------------------------------------------------------------------*/
+/* SSE2                                                                       */
+/*----------------------------------------------------------------------------*/
+#include <emmintrin.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+/* Transpose a 16x16 byte tile: r[i] = 16 bytes of line i in, r[j] = byte j
+   of the 16 lines out. One round of interleaving rows k and k+8 into rows
+   2k and 2k+1 rotates the 8 bits of (row, column) left by one, four rounds
+   swap row and column. */
+static inline void transpose16 (__m128i r[16])
+{
+    __m128i t[16];
+    int round;
+    int k;
+
+    for (round = 0; round < 4; round++) {
+        for (k = 0; k < 8; k++) {
+            t[2 * k] = _mm_unpacklo_epi8 (r[k], r[k + 8]);
+            t[2 * k + 1] = _mm_unpackhi_epi8 (r[k], r[k + 8]);
+        }
+        memcpy (r, t, sizeof(t));
+    }
+}
+
+/* the video RAM by byte column: t[b * LINES + y] = byte b of line y, so
+   each output row reads 224 consecutive bytes */
+static void transpose_vram (const uint8_t* vram, uint8_t* t)
+{
+    __m128i r[16];
+    int y0;
+    int b0;
+    int i;
+
+    for (b0 = 0; b0 < INVADERS_VRAM_LINE_SIZEB; b0 += 16) {
+        for (y0 = 0; y0 < INVADERS_VRAM_LINES; y0 += 16) {
+            for (i = 0; i < 16; i++)
+                r[i] = _mm_loadu_si128 ((const __m128i*)&vram[((y0 + i) * INVADERS_VRAM_LINE_SIZEB) + b0]);
+            transpose16 (r);
+            for (i = 0; i < 16; i++)
+                _mm_store_si128 ((__m128i*)&t[((b0 + i) * INVADERS_VRAM_LINES) + y0], r[i]);
+        }
+    }
+}
+
+/* 0xff where bit k of the byte is set */
+static inline __m128i bit_mask (const __m128i v, const int k)
+{
+    const __m128i bit = _mm_set1_epi8 ((char)(1 << k));
+
+    return _mm_cmpeq_epi8 (_mm_and_si128 (v, bit), bit);
+}
+
+static inline __m128i blend (const __m128i m, const __m128i fg, const __m128i bg)
+{
+    return _mm_or_si128 (_mm_and_si128 (m, fg), _mm_andnot_si128 (m, bg));
+}
+
+/* 16 pixels scaled horizontally, up to 4 * 16 bytes; 0 = no vector path */
+static inline int expand_gray (const __m128i px, const int scale, __m128i out[4])
+{
+    switch (scale) {
+        case 1:
+            out[0] = px;
+            return 1;
+        case 2:
+            out[0] = _mm_unpacklo_epi8 (px, px);
+            out[1] = _mm_unpackhi_epi8 (px, px);
+            return 2;
+#if defined(__SSSE3__)
+        case 3:
+            out[0] = _mm_shuffle_epi8 (px, _mm_setr_epi8 (0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5));
+            out[1] = _mm_shuffle_epi8 (px, _mm_setr_epi8 (5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10));
+            out[2] = _mm_shuffle_epi8 (px, _mm_setr_epi8 (10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15));
+            return 3;
+#endif
+        case 4: {
+            const __m128i lo = _mm_unpacklo_epi8 (px, px);
+            const __m128i hi = _mm_unpackhi_epi8 (px, px);
+
+            out[0] = _mm_unpacklo_epi16 (lo, lo);
+            out[1] = _mm_unpackhi_epi16 (lo, lo);
+            out[2] = _mm_unpacklo_epi16 (hi, hi);
+            out[3] = _mm_unpackhi_epi16 (hi, hi);
+            return 4;
+        }
+        default:
+            return 0;
+    }
+}
+
+void invaders_vram_gray (const uint8_t* vram, uint8_t* dst, const int stride, const int scale,
+                         const uint8_t fg, const uint8_t bg)
+{
+    const __m128i vfg = _mm_set1_epi8 ((char)fg);
+    const __m128i vbg = _mm_set1_epi8 ((char)bg);
+    __m128i t[INVADERS_VRAM_LINE_SIZEB * INVADERS_VRAM_LINES / 16];
+    __m128i out[4];
+    int r;
+    int y0;
+    int i;
+    int n;
+
+    transpose_vram (vram, (uint8_t*)t);
+
+    /* output rows top to bottom, so the stores are sequential */
+    for (r = 0; r < INVADERS_VRAM_OUT_HEIGHT; r++) {
+        const int x = 255 - r;
+        const __m128i* col = &t[(x >> 3) * (INVADERS_VRAM_LINES / 16)];
+        uint8_t* row = &dst[r * scale * stride];
+
+        for (y0 = 0; y0 < INVADERS_VRAM_LINES; y0 += 16) {
+            const __m128i px = blend (bit_mask (col[y0 / 16], x & 7), vfg, vbg);
+            uint8_t* p = &row[y0 * scale];
+
+            if ((n = expand_gray (px, scale, out)) != 0) {
+                for (i = 0; i < n; i++)
+                    _mm_storeu_si128 ((__m128i*)&p[i * 16], out[i]);
+            } else {
+                uint8_t b[16];
+
+                _mm_storeu_si128 ((__m128i*)b, px);
+                for (i = 0; i < 16 * scale; i++)
+                    p[i] = b[i / scale];
+            }
+        }
+        for (i = 1; i < scale; i++)
+            memcpy (&row[i * stride], row, INVADERS_VRAM_OUT_WIDTH * scale);
+    }
+}
+
+/* 4 RGBA pixels scaled horizontally, up to 4 * 4 pixels; 0 = no vector path */
+static inline int expand_rgba (const __m128i px, const int scale, __m128i out[4])
+{
+    switch (scale) {
+        case 1:
+            out[0] = px;
+            return 1;
+        case 2:
+            out[0] = _mm_unpacklo_epi32 (px, px);
+            out[1] = _mm_unpackhi_epi32 (px, px);
+            return 2;
+        case 3:
+            out[0] = _mm_shuffle_epi32 (px, _MM_SHUFFLE (1, 0, 0, 0));
+            out[1] = _mm_shuffle_epi32 (px, _MM_SHUFFLE (2, 2, 1, 1));
+            out[2] = _mm_shuffle_epi32 (px, _MM_SHUFFLE (3, 3, 3, 2));
+            return 3;
+        case 4:
+            out[0] = _mm_shuffle_epi32 (px, _MM_SHUFFLE (0, 0, 0, 0));
+            out[1] = _mm_shuffle_epi32 (px, _MM_SHUFFLE (1, 1, 1, 1));
+            out[2] = _mm_shuffle_epi32 (px, _MM_SHUFFLE (2, 2, 2, 2));
+            out[3] = _mm_shuffle_epi32 (px, _MM_SHUFFLE (3, 3, 3, 3));
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+void invaders_vram_rgba (const uint8_t* vram, uint32_t* dst, const int stride, const int scale,
+                         const uint32_t fg, const uint32_t bg)
+{
+    const __m128i vfg = _mm_set1_epi32 ((int)fg);
+    const __m128i vbg = _mm_set1_epi32 ((int)bg);
+    __m128i t[INVADERS_VRAM_LINE_SIZEB * INVADERS_VRAM_LINES / 16];
+    __m128i out[4];
+    int r;
+    int y0;
+    int q;
+    int i;
+
+    if (scale > 4) {
+        invaders_vram_rgba_ref (vram, dst, stride, scale, fg, bg);
+        return;
+    }
+
+    transpose_vram (vram, (uint8_t*)t);
+
+    for (r = 0; r < INVADERS_VRAM_OUT_HEIGHT; r++) {
+        const int x = 255 - r;
+        const __m128i* col = &t[(x >> 3) * (INVADERS_VRAM_LINES / 16)];
+        uint32_t* row = &dst[r * scale * stride];
+
+        for (y0 = 0; y0 < INVADERS_VRAM_LINES; y0 += 16) {
+            /* the byte mask widened to four 32-bit masks */
+            const __m128i m = bit_mask (col[y0 / 16], x & 7);
+            const __m128i lo = _mm_unpacklo_epi8 (m, m);
+            const __m128i hi = _mm_unpackhi_epi8 (m, m);
+            const __m128i px[4] = {
+                blend (_mm_unpacklo_epi16 (lo, lo), vfg, vbg),
+                blend (_mm_unpackhi_epi16 (lo, lo), vfg, vbg),
+                blend (_mm_unpacklo_epi16 (hi, hi), vfg, vbg),
+                blend (_mm_unpackhi_epi16 (hi, hi), vfg, vbg)
+            };
+            uint32_t* p = &row[y0 * scale];
+
+            for (q = 0; q < 4; q++, p += 4 * scale) {
+                const int n = expand_rgba (px[q], scale, out);
+
+                for (i = 0; i < n; i++)
+                    _mm_storeu_si128 ((__m128i*)&p[i * 4], out[i]);
+            }
+        }
+        for (i = 1; i < scale; i++)
+            memcpy (&row[i * stride], row, INVADERS_VRAM_OUT_WIDTH * scale * sizeof(uint32_t));
+    }
+}
+
+#else
+
+void invaders_vram_gray (const uint8_t* vram, uint8_t* dst, const int stride, const int scale,
+                         const uint8_t fg, const uint8_t bg)
+{
+    invaders_vram_gray_ref (vram, dst, stride, scale, fg, bg);
+}
+
+void invaders_vram_rgba (const uint8_t* vram, uint32_t* dst, const int stride, const int scale,
+                         const uint32_t fg, const uint32_t bg)
+{
+    invaders_vram_rgba_ref (vram, dst, stride, scale, fg, bg);
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Space Invaders video RAM to pixels.
+
+  The 7kiB of video RAM at 2400 hold 224 lines of 256 pixels, one bit per
+  pixel, least significant bit first. The monitor is turned by 90 degrees,
+  so the picture is the video RAM rotated by -90 degrees: 224 pixels wide
+  and 256 high, line y becoming column y (bottom to top). The converters
+  produce that picture scaled by an integer factor, with fg for set bits and
+  bg for clear ones, in one pass over the video RAM. The x86 versions
+  transpose 16x16 byte tiles with SSE2 and test 16 pixels per compare; the
+  _ref versions are the plain per pixel definition they are checked
+  against (vram2img -c).
+
+  dst holds (INVADERS_VRAM_OUT_WIDTH * scale) x (INVADERS_VRAM_OUT_HEIGHT *
+  scale) pixels, stride is in pixels.
+*/
+
+#ifndef __INVADERS_VRAM_H__
+#define __INVADERS_VRAM_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INVADERS_VRAM_LINES      224
+#define INVADERS_VRAM_LINE_SIZEB 32
+#define INVADERS_VRAM_OUT_WIDTH  224
+#define INVADERS_VRAM_OUT_HEIGHT 256
+
+void invaders_vram_gray (const uint8_t* vram, uint8_t* dst, const int stride, const int scale,
+                         const uint8_t fg, const uint8_t bg);
+void invaders_vram_rgba (const uint8_t* vram, uint32_t* dst, const int stride, const int scale,
+                         const uint32_t fg, const uint32_t bg);
+
+void invaders_vram_gray_ref (const uint8_t* vram, uint8_t* dst, const int stride, const int scale,
+                             const uint8_t fg, const uint8_t bg);
+void invaders_vram_rgba_ref (const uint8_t* vram, uint32_t* dst, const int stride, const int scale,
+                             const uint32_t fg, const uint32_t bg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __INVADERS_VRAM_H__ */
@@ -0,0 +1,313 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Convert Space Invaders video RAM dumps (image_N.bin, as written by the
+  ModelSim testbench or invaders -w) to PGM or PAM pictures, and check the
+  vector converters against the reference ones. A .vram stream (see
+  vstream.h) becomes one picture per frame, name_N.pgm.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vram.h"
+
+#define VRAM_SIZEB (INVADERS_VRAM_LINES * INVADERS_VRAM_LINE_SIZEB)
+
+#define FG_GRAY 0xff
+#define BG_GRAY 0x00
+#define FG_RGBA 0xffffffff
+#define BG_RGBA 0xff000000
+
+static void usage (const char* prog)
+{
+    fprintf (stderr, "usage: %s [-s scale] [-r] image.bin|stream.vram...\n", prog);
+    fprintf (stderr, "       %s -c [-s scale] [image.bin...]\n", prog);
+    fprintf (stderr, "  -s N : scale the picture by N (default 1)\n");
+    fprintf (stderr, "  -r   : write RGBA PAM (image.pam) instead of PGM (image.pgm)\n");
+    fprintf (stderr, "  -c   : compare the converters with the reference ones on random\n");
+    fprintf (stderr, "         frames and the given images, at scales 1 to N (default 5)\n");
+    exit (-1);
+}
+
+static int load_vram (const char* filename, uint8_t* vram)
+{
+    FILE* fp;
+    int rc;
+
+    if (NULL == (fp = fopen (filename, "rb"))) {
+        fprintf (stderr, "Error: failed to open '%s'\n", filename);
+        return -1;
+    }
+    rc = (fread (vram, VRAM_SIZEB, 1, fp) == 1) ? 0 : -1;
+    fclose (fp);
+    if (rc < 0)
+        fprintf (stderr, "Error: '%s' is shorter than %d bytes\n", filename, VRAM_SIZEB);
+    return rc;
+}
+
+static int write_image (const char* filename, const uint8_t* vram, const int scale, const int rgba)
+{
+    const int w = INVADERS_VRAM_OUT_WIDTH * scale;
+    const int h = INVADERS_VRAM_OUT_HEIGHT * scale;
+    const size_t size = (size_t)w * h * (rgba ? 4 : 1);
+    void* pixels;
+    FILE* fp;
+    int rc;
+
+    if (NULL == (pixels = malloc (size))) {
+        fprintf (stderr, "Error: out of memory\n");
+        return -1;
+    }
+    if (rgba) {
+        uint32_t* p = (uint32_t*)pixels;
+        size_t i;
+
+        invaders_vram_rgba (vram, p, w, scale, FG_RGBA, BG_RGBA);
+        /* PAM RGB_ALPHA is R, G, B, A in memory order */
+        for (i = 0; i < (size_t)w * h; i++) {
+            uint8_t* b = (uint8_t*)&p[i];
+            const uint32_t v = p[i];
+
+            b[0] = v >> 16; b[1] = v >> 8; b[2] = v; b[3] = v >> 24;
+        }
+    } else {
+        invaders_vram_gray (vram, (uint8_t*)pixels, w, scale, FG_GRAY, BG_GRAY);
+    }
+
+    if (NULL == (fp = fopen (filename, "wb"))) {
+        fprintf (stderr, "Error: failed to create '%s'\n", filename);
+        free (pixels);
+        return -1;
+    }
+    if (rgba)
+        fprintf (fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", w, h);
+    else
+        fprintf (fp, "P5\n%d %d\n255\n", w, h);
+    rc = (fwrite (pixels, size, 1, fp) == 1) ? 0 : -1;
+    if (fclose (fp) != 0)
+        rc = -1;
+    if (rc < 0)
+        fprintf (stderr, "Error: failed to write '%s'\n", filename);
+    free (pixels);
+    return rc;
+}
+
+/* every frame of a .vram stream to name_N */
+static int write_stream (const char* stream, const int len, const int scale, const int rgba)
+{
+    uint8_t vram[VRAM_SIZEB];
+    char filename[4096];
+    unsigned long n = 0;
+    FILE* fp;
+    int rc = 0;
+
+    if (NULL == (fp = fopen (stream, "rb"))) {
+        fprintf (stderr, "Error: failed to open '%s'\n", stream);
+        return -1;
+    }
+    while (rc == 0 && fread (vram, VRAM_SIZEB, 1, fp) == 1) {
+        snprintf (filename, sizeof(filename), "%.*s_%lu.%s", len, stream, n++, rgba ? "pam" : "pgm");
+        rc = write_image (filename, vram, scale, rgba);
+    }
+    fclose (fp);
+    return rc;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Check                                                                      */
+/*----------------------------------------------------------------------------*/
+/* a few pixels of padding per row, so the stride is exercised */
+#define CHECK_PAD 5
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint8_t rng_byte (void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint8_t)(rng_state >> 24);
+}
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + (ts.tv_nsec * 1e-9));
+}
+
+/* both converters into buffers prefilled with the same junk, then compare
+   everything including the padding */
+static int check_frame (const char* name, const uint8_t* vram, const int scale)
+{
+    const int stride = (INVADERS_VRAM_OUT_WIDTH * scale) + CHECK_PAD;
+    const size_t n = (size_t)stride * INVADERS_VRAM_OUT_HEIGHT * scale;
+    uint8_t* g0 = (uint8_t*)malloc (n);
+    uint8_t* g1 = (uint8_t*)malloc (n);
+    uint32_t* c0 = (uint32_t*)malloc (n * 4);
+    uint32_t* c1 = (uint32_t*)malloc (n * 4);
+    int bad = 0;
+
+    if (!g0 || !g1 || !c0 || !c1) {
+        fprintf (stderr, "Error: out of memory\n");
+        exit (-1);
+    }
+
+    memset (g0, 0x5a, n);
+    memset (g1, 0x5a, n);
+    invaders_vram_gray (vram, g0, stride, scale, 0xc3, 0x1e);
+    invaders_vram_gray_ref (vram, g1, stride, scale, 0xc3, 0x1e);
+    if (memcmp (g0, g1, n)) {
+        fprintf (stderr, "Error: %s: gray differs at scale %d\n", name, scale);
+        bad++;
+    }
+
+    memset (c0, 0x5a, n * 4);
+    memset (c1, 0x5a, n * 4);
+    invaders_vram_rgba (vram, c0, stride, scale, 0xff20ff40, 0x80102030);
+    invaders_vram_rgba_ref (vram, c1, stride, scale, 0xff20ff40, 0x80102030);
+    if (memcmp (c0, c1, n * 4)) {
+        fprintf (stderr, "Error: %s: rgba differs at scale %d\n", name, scale);
+        bad++;
+    }
+
+    free (g0);
+    free (g1);
+    free (c0);
+    free (c1);
+    return bad;
+}
+
+/* ns per frame of a converter */
+static double time_convert (const uint8_t* vram, const int rgba, const int scale, const int ref)
+{
+    const int w = INVADERS_VRAM_OUT_WIDTH * scale;
+    void* dst = malloc ((size_t)w * INVADERS_VRAM_OUT_HEIGHT * scale * 4);
+    const int frames = 200;
+    double t;
+    int i;
+
+    if (!dst) {
+        fprintf (stderr, "Error: out of memory\n");
+        exit (-1);
+    }
+    memset (dst, 0, (size_t)w * INVADERS_VRAM_OUT_HEIGHT * scale * 4);
+    t = now ();
+    for (i = 0; i < frames; i++) {
+        if (rgba)
+            (ref ? invaders_vram_rgba_ref : invaders_vram_rgba) (vram, (uint32_t*)dst, w, scale, FG_RGBA, BG_RGBA);
+        else
+            (ref ? invaders_vram_gray_ref : invaders_vram_gray) (vram, (uint8_t*)dst, w, scale, FG_GRAY, BG_GRAY);
+    }
+    t = now () - t;
+    free (dst);
+    return (t * 1e9 / frames);
+}
+
+static int check (char** files, const int nfiles, const int max_scale)
+{
+    uint8_t vram[VRAM_SIZEB];
+    char name[64];
+    int bad = 0;
+    int frames = 0;
+    int scale;
+    int i;
+    int j;
+
+    for (i = 0; i < 16 + nfiles; i++) {
+        if (i < 16) {
+            /* random frames of varying density, plus all clear and all set */
+            for (j = 0; j < VRAM_SIZEB; j++) {
+                const uint8_t r = rng_byte ();
+                vram[j] = (i == 0) ? 0x00 : (i == 1) ? 0xff : (i & 1) ? r : (r & rng_byte ());
+            }
+            snprintf (name, sizeof(name), "random %d", i);
+        } else {
+            if (load_vram (files[i - 16], vram) < 0)
+                return -1;
+            snprintf (name, sizeof(name), "%.63s", files[i - 16]);
+        }
+        for (scale = 1; scale <= max_scale; scale++)
+            bad += check_frame (name, vram, scale);
+        frames++;
+    }
+
+    fprintf (stderr, "checked %d frames at scales 1 to %d: %s\n", frames, max_scale, bad ? "FAIL" : "ok");
+    fprintf (stderr, "gray x1: %.0f ns/frame, reference %.0f ns/frame\n",
+             time_convert (vram, 0, 1, 0), time_convert (vram, 0, 1, 1));
+    /* as drawn by imageview */
+    fprintf (stderr, "rgba x3: %.0f ns/frame, reference %.0f ns/frame\n",
+             time_convert (vram, 1, 3, 0), time_convert (vram, 1, 3, 1));
+    return bad ? -1 : 0;
+}
+
+int main (int argc, char** argv)
+{
+    int opt;
+    int scale = 0;
+    int rgba = 0;
+    int check_mode = 0;
+    int i;
+
+    while ((opt = getopt (argc, argv, "s:rc")) != -1) {
+        switch (opt) {
+            case 's': scale = atoi (optarg); break;
+            case 'r': rgba = 1; break;
+            case 'c': check_mode = 1; break;
+            default: usage (argv[0]);
+        }
+    }
+    if (scale < 0 || scale > 16)
+        usage (argv[0]);
+
+    if (check_mode)
+        return (check (&argv[optind], argc - optind, scale ? scale : 5) < 0) ? 1 : 0;
+
+    if (optind >= argc)
+        usage (argv[0]);
+
+    for (i = optind; i < argc; i++) {
+        uint8_t vram[VRAM_SIZEB];
+        char filename[4096];
+        const char* dot = strrchr (argv[i], '.');
+        const int len = (dot && !strchr (dot, '/')) ? (int)(dot - argv[i]) : (int)strlen (argv[i]);
+
+        if (dot && !strcmp (dot, ".vram")) {
+            if (write_stream (argv[i], len, scale ? scale : 1, rgba) < 0)
+                return 1;
+            continue;
+        }
+        snprintf (filename, sizeof(filename), "%.*s.%s", len, argv[i], rgba ? "pam" : "pgm");
+        if (load_vram (argv[i], vram) < 0 || write_image (filename, vram, scale ? scale : 1, rgba) < 0)
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,303 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vram.h"
+#include "vstream.h"
+
+#define VRAM_SIZEB (INVADERS_VRAM_LINES * INVADERS_VRAM_LINE_SIZEB)
+
+struct invaders_vstream
+{
+    char* filename;
+    int fd;
+    int format;
+    int scale;
+    unsigned decimate;
+    size_t frame_sizeb;     /* bytes written per frame */
+
+    /* producer */
+    uint64_t offered;
+    uint64_t frames;
+    int head;               /* batch being filled */
+    int fill;               /* frames in it */
+    double stall_secs;
+
+    /* batches handed to the writer: full[tail..] */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int tail;
+    int full;
+    int count[INVADERS_VSTREAM_BATCHES];
+    int closing;
+    int error;
+
+    uint8_t* batch[INVADERS_VSTREAM_BATCHES];
+    uint8_t* block;         /* writer side output */
+    size_t block_sizeb;
+};
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + (ts.tv_nsec * 1e-9));
+}
+
+static int write_all (struct invaders_vstream* vs, const uint8_t* buf, size_t len)
+{
+    while (len) {
+        const ssize_t n = write (vs->fd, buf, len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            fprintf (stderr, "Error: failed to write %s: %s\n", vs->filename, strerror (errno));
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* convert and write one batch in blocks of up to block_sizeb */
+static int write_batch (struct invaders_vstream* vs, const uint8_t* frames, const int count)
+{
+    const int w = INVADERS_VRAM_OUT_WIDTH * vs->scale;
+    size_t len = 0;
+    int i;
+
+    if (vs->format == INVADERS_VSTREAM_VRAM)
+        return write_all (vs, frames, (size_t)count * VRAM_SIZEB);
+
+    for (i = 0; i < count; i++) {
+        uint8_t* p;
+
+        if (len + vs->frame_sizeb > vs->block_sizeb) {
+            if (write_all (vs, vs->block, len) < 0)
+                return -1;
+            len = 0;
+        }
+        p = &vs->block[len];
+        if (vs->format == INVADERS_VSTREAM_Y4M) {
+            memcpy (p, "FRAME\n", 6);
+            p += 6;
+        }
+        invaders_vram_gray (&frames[(size_t)i * VRAM_SIZEB], p, w, vs->scale, 0xff, 0x00);
+        len += vs->frame_sizeb;
+    }
+    return write_all (vs, vs->block, len);
+}
+
+static void* writer (void* arg)
+{
+    struct invaders_vstream* vs = arg;
+    int error = 0;
+
+    pthread_mutex_lock (&vs->lock);
+    for (;;) {
+        int b;
+
+        while (vs->full == 0 && !vs->closing)
+            pthread_cond_wait (&vs->cond, &vs->lock);
+        if (vs->full == 0)
+            break;
+        b = vs->tail;
+        pthread_mutex_unlock (&vs->lock);
+
+        /* after a failure the batches are only drained */
+        if (!error && write_batch (vs, vs->batch[b], vs->count[b]) < 0)
+            error = 1;
+
+        pthread_mutex_lock (&vs->lock);
+        __atomic_store_n (&vs->error, error, __ATOMIC_RELAXED);
+        vs->tail = (vs->tail + 1) % INVADERS_VSTREAM_BATCHES;
+        vs->full--;
+        pthread_cond_broadcast (&vs->cond);
+    }
+    pthread_mutex_unlock (&vs->lock);
+    return NULL;
+}
+
+struct invaders_vstream* invaders_vstream_create (const char* filename, const int scale, const unsigned decimate)
+{
+    const char* suffix = strrchr (filename, '.');
+    struct invaders_vstream* vs;
+    char header[128];
+    int i;
+
+    if (scale < 1 || decimate < 1) {
+        fprintf (stderr, "Error: bad video scale %d or decimation %u\n", scale, decimate);
+        return NULL;
+    }
+    if (NULL == (vs = (struct invaders_vstream*)calloc (1, sizeof(struct invaders_vstream))))
+        return NULL;
+
+    if (suffix && !strcmp (suffix, ".y4m"))
+        vs->format = INVADERS_VSTREAM_Y4M;
+    else if (suffix && !strcmp (suffix, ".gray"))
+        vs->format = INVADERS_VSTREAM_GRAY;
+    else if (suffix && !strcmp (suffix, ".vram"))
+        vs->format = INVADERS_VSTREAM_VRAM;
+    else {
+        fprintf (stderr, "Error: %s: the video file must end in .y4m, .gray or .vram\n", filename);
+        free (vs);
+        return NULL;
+    }
+    vs->scale = scale;
+    vs->decimate = decimate;
+    vs->frame_sizeb = (vs->format == INVADERS_VSTREAM_VRAM) ? VRAM_SIZEB :
+        ((size_t)INVADERS_VRAM_OUT_WIDTH * INVADERS_VRAM_OUT_HEIGHT * scale * scale +
+         ((vs->format == INVADERS_VSTREAM_Y4M) ? 6 : 0));
+    vs->block_sizeb = (vs->frame_sizeb > INVADERS_VSTREAM_BLOCK) ? vs->frame_sizeb : INVADERS_VSTREAM_BLOCK;
+
+    vs->filename = strdup (filename);
+    vs->block = (vs->format == INVADERS_VSTREAM_VRAM) ? NULL : (uint8_t*)malloc (vs->block_sizeb);
+    for (i = 0; i < INVADERS_VSTREAM_BATCHES; i++)
+        vs->batch[i] = (uint8_t*)malloc ((size_t)INVADERS_VSTREAM_BATCH * VRAM_SIZEB);
+    for (i = 0; i < INVADERS_VSTREAM_BATCHES && vs->batch[i]; i++)
+        ;
+    if (!vs->filename || i < INVADERS_VSTREAM_BATCHES || (vs->format != INVADERS_VSTREAM_VRAM && !vs->block)) {
+        fprintf (stderr, "Error: out of memory\n");
+        vs->fd = -1;
+        goto fail;
+    }
+
+    if (-1 == (vs->fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644))) {
+        fprintf (stderr, "Error: failed to create %s: %s\n", filename, strerror (errno));
+        goto fail;
+    }
+    if (vs->format == INVADERS_VSTREAM_Y4M) {
+        snprintf (header, sizeof(header), "YUV4MPEG2 W%d H%d F120:%u Ip A1:1 Cmono\n",
+                  INVADERS_VRAM_OUT_WIDTH * scale, INVADERS_VRAM_OUT_HEIGHT * scale, decimate);
+        if (write_all (vs, (const uint8_t*)header, strlen (header)) < 0)
+            goto fail;
+    }
+
+    pthread_mutex_init (&vs->lock, NULL);
+    pthread_cond_init (&vs->cond, NULL);
+    if (pthread_create (&vs->thread, NULL, writer, vs) != 0) {
+        fprintf (stderr, "Error: failed to start the video writer\n");
+        pthread_mutex_destroy (&vs->lock);
+        pthread_cond_destroy (&vs->cond);
+        goto fail;
+    }
+    return vs;
+
+fail:
+    if (vs->fd != -1)
+        close (vs->fd);
+    for (i = 0; i < INVADERS_VSTREAM_BATCHES; i++)
+        free (vs->batch[i]);
+    free (vs->block);
+    free (vs->filename);
+    free (vs);
+    return NULL;
+}
+
+/* hand the batch being filled to the writer, waiting for a free one */
+static void submit (struct invaders_vstream* vs)
+{
+    pthread_mutex_lock (&vs->lock);
+    if (vs->full == INVADERS_VSTREAM_BATCHES) {
+        const double t = now ();
+
+        while (vs->full == INVADERS_VSTREAM_BATCHES)
+            pthread_cond_wait (&vs->cond, &vs->lock);
+        vs->stall_secs += now () - t;
+    }
+    vs->count[vs->head] = vs->fill;
+    vs->full++;
+    pthread_cond_broadcast (&vs->cond);
+    pthread_mutex_unlock (&vs->lock);
+
+    vs->head = (vs->head + 1) % INVADERS_VSTREAM_BATCHES;
+    vs->fill = 0;
+}
+
+int invaders_vstream_frame (struct invaders_vstream* vs, const uint8_t* vram)
+{
+    if ((vs->offered++ % vs->decimate) != 0)
+        return 0;
+
+    memcpy (&vs->batch[vs->head][(size_t)vs->fill * VRAM_SIZEB], vram, VRAM_SIZEB);
+    vs->frames++;
+    if (++vs->fill == INVADERS_VSTREAM_BATCH)
+        submit (vs);
+    /* unlocked peek, an error shows up a batch late at worst */
+    return __atomic_load_n (&vs->error, __ATOMIC_RELAXED) ? -1 : 0;
+}
+
+uint64_t invaders_vstream_frames (const struct invaders_vstream* vs)
+{
+    return vs->frames;
+}
+
+double invaders_vstream_stall_secs (const struct invaders_vstream* vs)
+{
+    return vs->stall_secs;
+}
+
+int invaders_vstream_close (struct invaders_vstream* vs)
+{
+    int rc;
+    int i;
+
+    if (vs == NULL)
+        return 0;
+
+    if (vs->fill)
+        submit (vs);
+    pthread_mutex_lock (&vs->lock);
+    vs->closing = 1;
+    pthread_cond_broadcast (&vs->cond);
+    pthread_mutex_unlock (&vs->lock);
+    pthread_join (vs->thread, NULL);
+
+    rc = vs->error ? -1 : 0;
+    if (close (vs->fd) < 0) {
+        fprintf (stderr, "Error: failed to close %s: %s\n", vs->filename, strerror (errno));
+        rc = -1;
+    }
+
+    pthread_mutex_destroy (&vs->lock);
+    pthread_cond_destroy (&vs->cond);
+    for (i = 0; i < INVADERS_VSTREAM_BATCHES; i++)
+        free (vs->batch[i]);
+    free (vs->block);
+    free (vs->filename);
+    free (vs);
+    return rc;
+}
@@ -0,0 +1,81 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Streaming export of Space Invaders video RAM frames, one file for a
+  whole run instead of an image_N.bin per interrupt:
+
+    .y4m   YUV4MPEG2, 8-bit mono, the rotated picture (ffmpeg, mpv and
+           most players read it as is)
+    .gray  the same pictures as raw 8-bit gray, no headers
+           (ffmpeg -f rawvideo -pix_fmt gray -s 224x256)
+    .vram  the 7kiB video RAM of every frame back to back, as the
+           image_N.bin files hold them (vram2img converts them)
+
+  chosen by the file name suffix. The producer only copies the video RAM
+  into a batch; a writer thread converts full batches and writes them in
+  large blocks, so the emulator runs on while the disk catches up. Only
+  when every batch is waiting for the disk does the producer block (the
+  stream is never lossy), and the time spent there is counted in
+  stall_secs. decimate = N keeps every Nth frame offered. The frame rate
+  written to the Y4M header is 120 / decimate, a frame per interrupt of
+  the arcade board.
+*/
+
+#ifndef __INVADERS_VSTREAM_H__
+#define __INVADERS_VSTREAM_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INVADERS_VSTREAM_VRAM 0
+#define INVADERS_VSTREAM_GRAY 1
+#define INVADERS_VSTREAM_Y4M  2
+
+#define INVADERS_VSTREAM_BATCH   256 /* frames per batch */
+#define INVADERS_VSTREAM_BATCHES 8
+#define INVADERS_VSTREAM_BLOCK   (8*1024*1024) /* bytes per write */
+
+struct invaders_vstream;
+
+/* NULL on error; scale applies to the picture formats */
+struct invaders_vstream* invaders_vstream_create (const char* filename, const int scale, const unsigned decimate);
+
+/* offer a frame, -1 once writing has failed */
+int invaders_vstream_frame (struct invaders_vstream* vs, const uint8_t* vram);
+
+/* frames written so far and the time the producer was blocked */
+uint64_t invaders_vstream_frames (const struct invaders_vstream* vs);
+double invaders_vstream_stall_secs (const struct invaders_vstream* vs);
+
+/* write the rest and close, -1 if any write failed */
+int invaders_vstream_close (struct invaders_vstream* vs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __INVADERS_VSTREAM_H__ */
@@ -0,0 +1,325 @@
+/*
+  Copyright (c) 2018 Brendan Fennell <bfennell@skynet.ie>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Lockstep co-simulation of the RTL against the cmodel.
+
+  Loaded with vsim -foreign "cosim_init tb/fli/cosim.so [hexfile]" next to
+  the cpudiag test bench. On the rising clock edge where the control unit
+  enters fetch_1 (the point where tb/cpudiag.do writes a trace line) the
+  register file and the flags are compared with the cmodel, then the
+  cmodel executes one instruction; further edges that find it still in
+  fetch_1 are the same instruction. The first mismatch is reported and ends
+  the simulation, so no trace files or diff pass are needed.
+*/
+
+#include "mti.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "i8080.h"
+#include "i8080_trace.h"
+
+#define TB "/cpu8080_testbench"
+
+/* tb/cpudiag.do register file indices */
+#define REG_B    0
+#define REG_C    1
+#define REG_D    2
+#define REG_E    3
+#define REG_H    4
+#define REG_L    5
+#define REG_A    7
+#define REG_SPH 12
+#define REG_SPL 13
+#define REG_PCH 14
+#define REG_PCL 15
+#define NR_REGS 16
+
+/* std_logic positions */
+#define SL_0 2
+#define SL_1 3
+#define SL_L 6
+#define SL_H 7
+
+typedef struct {
+    mtiSignalIdT clk;
+    mtiSignalIdT curstate;
+    mtiSignalIdT reg[NR_REGS];
+    mtiSignalIdT flag[5];   /* carry aux_carry zero parity sign */
+    mtiInt32T fetch_1;
+    int in_fetch_1;         /* curstate was fetch_1 at the previous rising edge */
+    struct i8080_state* state;
+    uint8_t* mem;
+    uint64_t compared;
+    int failed;
+} cosim_t;
+
+static const char* hexfile = "tb/cpudiag_mod.hex";
+
+/* the same layout tb/cpudiag-memory-sim.vhd reads: one byte per line,
+   two hex digits, anything after them is a comment */
+static void load_hexfile (uint8_t* mem, const char* const filename)
+{
+    char line[256];
+    int addr = 0;
+    FILE* f = fopen (filename, "r");
+
+    if (NULL == f) {
+        fprintf (stderr, "Error: unable to open %s : %s\n", filename, strerror(errno));
+        exit(-1);
+    }
+
+    while (addr < 0x10000 && fgets (line, sizeof(line), f)) {
+        unsigned int byte;
+
+        if (sscanf (line, "%2x", &byte) == 1)
+            mem[addr] = (uint8_t)byte;
+        addr++;
+    }
+    fclose (f);
+}
+
+/* -1 for anything but 0/1/L/H */
+static int sl_bit (const mtiInt32T v)
+{
+    if (v == SL_1 || v == SL_H)
+        return 1;
+    if (v == SL_0 || v == SL_L)
+        return 0;
+    return -1;
+}
+
+static int read_reg (cosim_t* cp, const int idx)
+{
+    char bits[8];
+    int val = 0;
+    int i;
+
+    /* unsigned(7 downto 0), element 0 is the MSB */
+    mti_GetArraySignalValue (cp->reg[idx], bits);
+    for (i = 0; i < 8; i++) {
+        const int b = sl_bit (bits[i]);
+
+        if (b < 0)
+            return -1;
+        val = (val << 1) | b;
+    }
+    return val;
+}
+
+/* the RTL state as a trace record, 0 if a bit is not 0 or 1 */
+static int rtl_record (cosim_t* cp, struct i8080_trace_record* rec)
+{
+    static const uint8_t flag_bit[5] = {
+        I8080_FLAG_CY, I8080_FLAG_AC, I8080_FLAG_Z, I8080_FLAG_P, I8080_FLAG_S
+    };
+    static const int order[11] = {
+        REG_B, REG_C, REG_D, REG_E, REG_H, REG_L, REG_A,
+        REG_SPH, REG_SPL, REG_PCH, REG_PCL
+    };
+    uint8_t* const dst[11] = {
+        &rec->b, &rec->c, &rec->d, &rec->e, &rec->h, &rec->l, &rec->a,
+        &rec->sph, &rec->spl, &rec->pch, &rec->pcl
+    };
+    int ok = 1;
+    int i;
+
+    rec->psw = I8080_FLAG_ONE;
+    for (i = 0; i < 5; i++) {
+        const int b = sl_bit (mti_GetSignalValue (cp->flag[i]));
+
+        ok &= (b >= 0);
+        if (b > 0)
+            rec->psw |= flag_bit[i];
+    }
+    for (i = 0; i < 11; i++) {
+        const int v = read_reg (cp, order[i]);
+
+        ok &= (v >= 0);
+        *dst[i] = (uint8_t)v;
+    }
+    return ok;
+}
+
+static void cmodel_record (const struct i8080_state* state, struct i8080_trace_record* rec)
+{
+    rec->psw = (state->f & I8080_FLAG_MASK) | I8080_FLAG_ONE;
+    rec->b = state->b;
+    rec->c = state->c;
+    rec->d = state->d;
+    rec->e = state->e;
+    rec->h = state->h;
+    rec->l = state->l;
+    rec->a = state->a;
+    rec->sph = (state->sp >> 8);
+    rec->spl = (state->sp & 0xff);
+    rec->pch = (state->pc >> 8);
+    rec->pcl = (state->pc & 0xff);
+}
+
+/* BDOS console output, as the trace in tb/cpudiag.do prints it */
+static void bdos (const struct i8080_state* state)
+{
+    char str[128];
+    uint16_t de = ((state->d << 8) | state->e);
+    size_t len = 0;
+
+    if (state->pc != 0x5 || state->c != 0x9)
+        return;
+
+    while (state->mem[de] != '$' && len < 100)
+        str[len++] = state->mem[de++];
+    str[len] = '\0';
+    mti_PrintFormatted ("%s\n", str);
+}
+
+static void cosim (void* param)
+{
+    cosim_t* cp = (cosim_t*)param;
+    struct i8080_trace_record rtl;
+    struct i8080_trace_record ref;
+    char line_rtl[64];
+    char line_ref[64];
+
+    if (cp->failed || sl_bit (mti_GetSignalValue (cp->clk)) != 1)
+        return;
+
+    if (mti_GetSignalValue (cp->curstate) != cp->fetch_1) {
+        cp->in_fetch_1 = 0;
+        return;
+    }
+    /* still in fetch_1 from the previous edge, the same instruction */
+    if (cp->in_fetch_1)
+        return;
+    cp->in_fetch_1 = 1;
+
+    cmodel_record (cp->state, &ref);
+    if (!rtl_record (cp, &rtl) || memcmp (&rtl, &ref, sizeof(rtl))) {
+        i8080_trace_format (&rtl, line_rtl);
+        i8080_trace_format (&ref, line_ref);
+        mti_PrintFormatted ("cosim: mismatch at instruction %llu\n", (unsigned long long)cp->compared);
+        mti_PrintFormatted ("  rtl    %s", line_rtl);
+        mti_PrintFormatted ("  cmodel %s", line_ref);
+        cp->failed = 1;
+        mti_FatalError ();
+        return;
+    }
+
+    bdos (cp->state);
+    cp->compared++;
+
+    if (i8080_exec (cp->state) < 0) {
+        mti_PrintFormatted ("cosim: cmodel error at pc %04x\n", cp->state->pc);
+        cp->failed = 1;
+        mti_FatalError ();
+    }
+}
+
+/* tb/cpu8080_testbench ties port_i low */
+static uint8_t port_in (void* ctx, const uint8_t port)
+{
+    (void)ctx;
+    (void)port;
+    return 0;
+}
+
+static void cosim_quit (void* param)
+{
+    cosim_t* cp = (cosim_t*)param;
+
+    mti_PrintFormatted ("cosim: %llu instructions compared, %s\n",
+                        (unsigned long long)cp->compared, cp->failed ? "FAILED" : "no mismatch");
+}
+
+static mtiSignalIdT find_signal (const char* name)
+{
+    mtiSignalIdT sig = mti_FindSignal ((char*)name);
+
+    if (sig == NULL) {
+        fprintf (stderr, "Error: cosim: signal %s not found\n", name);
+        exit(-1);
+    }
+    return sig;
+}
+
+/* the design is only there once loading is done */
+static void cosim_load_done (void* param)
+{
+    cosim_t* cp = (cosim_t*)param;
+    mtiSignalIdT* elems;
+    mtiTypeIdT type;
+    char** names;
+    int i;
+
+    cp->clk = find_signal (TB "/clk");
+    cp->curstate = find_signal (TB "/inst_cpu8080/inst_ctrl/curstate");
+
+    type = mti_GetSignalType (cp->curstate);
+    names = mti_GetEnumValues (type);
+    cp->fetch_1 = -1;
+    for (i = 0; i < mti_TickLength (type); i++) {
+        if (!strcmp (names[i], "fetch_1"))
+            cp->fetch_1 = i;
+    }
+
+    elems = mti_GetSignalSubelements (find_signal (TB "/inst_cpu8080/inst_regfile/regfile"), NULL);
+    for (i = 0; i < NR_REGS; i++)
+        cp->reg[i] = elems[i];
+    mti_VsimFree (elems);
+
+    elems = mti_GetSignalSubelements (find_signal (TB "/inst_cpu8080/inst_ctrlreg/alu_flags_tmp_rg"), NULL);
+    for (i = 0; i < 5; i++)
+        cp->flag[i] = elems[i];
+    mti_VsimFree (elems);
+
+    mti_Sensitize (mti_CreateProcess ("cosim_p", cosim, cp), cp->clk, MTI_EVENT);
+}
+
+void cosim_init (mtiRegionIdT       region,     // location in the design
+                 char              *parameters, // hex file, default tb/cpudiag_mod.hex
+                 mtiInterfaceListT *generics,   // not used
+                 mtiInterfaceListT *ports)      // not used
+{
+    cosim_t* cp = (cosim_t*)mti_Malloc (sizeof(cosim_t));
+
+    (void)region;
+    (void)generics;
+    (void)ports;
+
+    memset (cp, 0, sizeof(cosim_t));
+    if (parameters && parameters[0])
+        hexfile = parameters;
+
+    /* tb/cpu8080_testbench ties int_i low, no interrupts to model */
+    cp->mem = (uint8_t*)malloc (0x10000 /* 64kiB */);
+    cp->state = i8080_create (cp->mem, 0x10000 /* 64kiB */);
+    i8080_set_port_default (cp->state, port_in, NULL, NULL);
+    load_hexfile (cp->mem, hexfile);
+
+    mti_AddLoadDoneCB (cosim_load_done, cp);
+    mti_AddQuitCB (cosim_quit, cp);
+}